@@ -0,0 +1,39 @@
+# Generates a header with compiled SPIR-V embedded as aligned uint32_t arrays.
+#
+# Usage: cmake -DOUTPUT=<header> -DSHADERS=<a.spv|b.spv|...> -P EmbedShaders.cmake
+#
+# Every shader becomes "alignas(4) constexpr uint32_t <name>_spv[]", and
+# EMBEDDED_SHADERS lists all of them by their original file name
+# (e.g. "render.vert.spv") so that they can be looked up at runtime.
+
+# string(APPEND) needs CMake 3.4
+cmake_minimum_required(VERSION 3.5)
+
+string(REPLACE "|" ";" SHADER_LIST "${SHADERS}")
+
+set(CONTENT "// Generated by EmbedShaders.cmake, do not edit.\n")
+string(APPEND CONTENT "#pragma once\n\n#include <cstddef>\n#include <cstdint>\n\n")
+string(APPEND CONTENT "struct EmbeddedShader {\n    const char *name;\n    const uint32_t *code;\n    size_t size;\n};\n\n")
+
+set(TABLE "")
+foreach (SHADER IN LISTS SHADER_LIST)
+    get_filename_component(NAME ${SHADER} NAME)
+    string(MAKE_C_IDENTIFIER ${NAME} IDENTIFIER)
+
+    # SPIR-V is a stream of little-endian 32-bit words
+    file(READ ${SHADER} HEX_CONTENT HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])" "0x\\4\\3\\2\\1u, " WORDS "${HEX_CONTENT}")
+    set(WORD "0x[0-9a-f]+u, ")
+    string(REGEX REPLACE "(${WORD}${WORD}${WORD}${WORD}${WORD}${WORD}${WORD}${WORD})" "\\1\n    " WORDS "${WORDS}")
+    string(STRIP "${WORDS}" WORDS)
+
+    string(APPEND CONTENT "alignas(4) constexpr uint32_t ${IDENTIFIER}[] = {\n    ${WORDS}\n};\n\n")
+    string(APPEND TABLE "    { \"${NAME}\", ${IDENTIFIER}, sizeof(${IDENTIFIER}) },\n")
+endforeach()
+
+string(APPEND CONTENT "constexpr EmbeddedShader EMBEDDED_SHADERS[] = {\n${TABLE}};\n")
+
+# Only touch the header when a shader actually changed
+file(WRITE ${OUTPUT}.tmp "${CONTENT}")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
@@ -1,6 +1,8 @@
+set(EMBED_SHADERS_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/EmbedShaders.cmake)
+
 function(BUILD_EXAMPLE EXPNAME)
     # Parse arguments
-    set(options)
+    set(options EMBED_SHADERS)
     set(oneValueArgs FOLDER)
     set(multiValueArgs)
     cmake_parse_arguments(BUILD_EXAMPLE "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
@@ -8,7 +10,10 @@ function(BUILD_EXAMPLE EXPNAME)
     # Glob source files
     file(GLOB SOURCE_FILES "${EXPNAME}/*.cpp" "${EXPNAME}/*.h")
     file(GLOB SHADER_FILES "${EXPNAME}/shaders/*.vert"
-                           "${EXPNAME}/shaders/*.frag")
+                           "${EXPNAME}/shaders/*.frag"
+                           "${EXPNAME}/shaders/*.comp"
+                           "${EXPNAME}/shaders/*.task"
+                           "${EXPNAME}/shaders/*.mesh")
 
     # Output directory
     set(CMAKE_RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/${EXPNAME}/bin)
@@ -25,6 +30,9 @@ function(BUILD_EXAMPLE EXPNAME)
     target_link_libraries(${EXPNAME} ${OPENGL_LIBRARIES} ${GLFW3_LIBRARIES} ${VULKAN_LIBRARIES})
     set_target_properties(${EXPNAME} PROPERTIES DEBUG_POSTFIX ${CMAKE_DEBUG_POSTFIX})
 
+    # Lets the examples find their GLSL sources for shader hot reload
+    target_compile_definitions(${EXPNAME} PRIVATE "SHADER_SOURCE_DIR=\"${CMAKE_CURRENT_SOURCE_DIR}/${EXPNAME}/shaders\"")
+
     source_group("Source Files" FILES ${SOURCE_FILES})
     source_group("Shader Files" FILES ${SHADER_FILES})
 
@@ -32,25 +40,59 @@ function(BUILD_EXAMPLE EXPNAME)
     set(OUTPUT_SHADERS "")
     set(SHADER_OUTPUT_DIR "${CMAKE_BINARY_DIR}/${EXPNAME}/shaders")
 
+    # Hot reload writes its SPIR-V where the build puts it, wherever the example is started from
+    target_compile_definitions(${EXPNAME} PRIVATE "SHADER_BINARY_DIR=\"${SHADER_OUTPUT_DIR}\"")
+
     foreach (SHADER IN LISTS SHADER_FILES)
         get_filename_component(BASE_NAME ${SHADER} NAME)
         set(OUTPUT_SHADER ${SHADER_OUTPUT_DIR}/${BASE_NAME}.spv)
 
+        # Task and mesh shaders (GL_EXT_mesh_shader) need SPIR-V 1.4
+        set(TARGET_ENV_ARGS "")
+        if (SHADER MATCHES "\\.(task|mesh)$")
+            set(TARGET_ENV_ARGS --target-env spirv1.4)
+        endif()
+
         add_custom_command(OUTPUT ${OUTPUT_SHADER}
                            COMMAND ${CMAKE_COMMAND}
                            ARGS -E remove "${OUTPUT_SHADER}"
                            COMMAND ${CMAKE_COMMAND}
                            ARGS -E make_directory  "${SHADER_OUTPUT_DIR}"
                            COMMAND glslangValidator
-                           ARGS -i "${SHADER}" -V -o "${OUTPUT_SHADER}"
+                           ARGS -i "${SHADER}" -V ${TARGET_ENV_ARGS} -o "${OUTPUT_SHADER}"
                            DEPENDS ${SHADER})
 
         set(CUSTOM_TARGET_NAME GLSLANG_${EXPNAME}_${BASE_NAME})
         add_custom_target(${CUSTOM_TARGET_NAME} ALL SOURCES ${OUTPUT_SHADER})
         add_dependencies(${EXPNAME} ${CUSTOM_TARGET_NAME})
         set_target_properties(${CUSTOM_TARGET_NAME} PROPERTIES FOLDER "GLSLang")
+
+        list(APPEND OUTPUT_SHADERS ${OUTPUT_SHADER})
     endforeach()
 
+    # Embed the compiled SPIR-V into a generated header, for examples that include it
+    if (EMBED_SHADERS AND BUILD_EXAMPLE_EMBED_SHADERS AND OUTPUT_SHADERS)
+        set(EMBEDDED_SHADERS_DIR "${CMAKE_BINARY_DIR}/${EXPNAME}/generated")
+        set(EMBEDDED_SHADERS_HEADER "${EMBEDDED_SHADERS_DIR}/embedded_shaders.h")
+        string(REPLACE ";" "|" EMBEDDED_SHADERS_ARG "${OUTPUT_SHADERS}")
+
+        add_custom_command(OUTPUT ${EMBEDDED_SHADERS_HEADER}
+                           COMMAND ${CMAKE_COMMAND}
+                           ARGS -E make_directory "${EMBEDDED_SHADERS_DIR}"
+                           COMMAND ${CMAKE_COMMAND}
+                           ARGS "-DOUTPUT=${EMBEDDED_SHADERS_HEADER}" "-DSHADERS=${EMBEDDED_SHADERS_ARG}" -P "${EMBED_SHADERS_SCRIPT}"
+                           DEPENDS ${OUTPUT_SHADERS} ${EMBED_SHADERS_SCRIPT}
+                           VERBATIM)
+
+        set(EMBED_TARGET_NAME EMBED_${EXPNAME}_SHADERS)
+        add_custom_target(${EMBED_TARGET_NAME} ALL SOURCES ${EMBEDDED_SHADERS_HEADER})
+        add_dependencies(${EXPNAME} ${EMBED_TARGET_NAME})
+        set_target_properties(${EMBED_TARGET_NAME} PROPERTIES FOLDER "GLSLang")
+
+        target_include_directories(${EXPNAME} PRIVATE ${EMBEDDED_SHADERS_DIR})
+        target_compile_definitions(${EXPNAME} PRIVATE EMBED_SHADERS)
+    endif()
+
     if (MSVC)
         set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} /Zi")
         set_property(TARGET ${EXPNAME} APPEND PROPERTY LINK_FLAGS "/DEBUG /PROFILE")
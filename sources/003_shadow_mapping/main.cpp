@@ -14,24 +14,97 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
+#ifdef EMBED_SHADERS
+#include "embedded_shaders.h"
+#endif
+
 #include <iostream>
 #include <stdexcept>
 #include <functional>
 #include <chrono>
 #include <fstream>
 #include <algorithm>
+#include <numeric>
 #include <vector>
 #include <cstring>
 #include <array>
+#include <iterator>
 #include <set>
 #include <optional>
 #include <unordered_map>
+#include <future>
+#include <deque>
+#include <queue>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <limits>
+#include <thread>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CULL_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULL_SIMD_SSE
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
 const int SHADOW_MAP_SIZE = 2048;
 const int MAX_FRAMES_IN_FLIGHT = 2;
 const glm::vec3 LIGHT_POS = glm::vec3(0.0f, 15.0f, 0.0f);
+const float INSTANCE_SPACING = 4.0f;
+const float FLOOR_SIZE = 40.0f;
+const uint32_t NUM_TEAPOT_MATERIALS = 4;
+const uint32_t INSTANCE_FLAG_CAST_SHADOW = 0x1;
+const float CAMERA_NEAR = 1.0f;
+const float CAMERA_FAR = 50.0f;
+
+// Froxel grid of the clustered lighting: screen tiles times exponential depth slices
+const uint32_t CLUSTER_GRID_X = 16;
+const uint32_t CLUSTER_GRID_Y = 9;
+const uint32_t CLUSTER_GRID_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+const uint32_t CLUSTER_LIGHT_CAPACITY = 127;
+const uint32_t MAX_POINT_LIGHTS = 4096;
+
+// With more than one shadowed light the shadow map becomes an atlas of per-light tiles
+const uint32_t MAX_SHADOW_LIGHTS = 16;
+const uint32_t SHADOW_ATLAS_SIZE = 4096;
+const uint32_t SHADOW_TILE_MIN_SIZE = 128;
+
+// With --cube-shadows the key light casts shadows in every direction from a cube map
+const uint32_t CUBE_SHADOW_SIZE = 1024;
+const float CUBE_SHADOW_NEAR = 0.1f;
+const float CUBE_SHADOW_RANGE = 50.0f;
+
+// With --meshlets the meshes are split into meshlets that are culled one by one. The sizes fit
+// the mesh shader outputs of every VK_EXT_mesh_shader device; a task shader workgroup culls
+// MESHLET_TASK_GROUP_SIZE meshlets.
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+const uint32_t MESHLET_TASK_GROUP_SIZE = 32;
+// Guaranteed workgroup count per dimension of a dispatch; more objects use the next dimension
+const uint32_t MAX_WORKGROUPS_PER_DIMENSION = 65535;
+// Frames drawn before and during each step of the --bench-* benchmarks
+const uint32_t BENCHMARK_WARMUP_FRAMES = 20;
+const uint32_t BENCHMARK_MEASURED_FRAMES = 200;
+// Detail levels of a mesh with --lods, including the full mesh
+const uint32_t MAX_LODS = 6;
 
 const std::string DATA_FOLDER = "../../../data/";
 const std::string MODEL_PATH = DATA_FOLDER + "teapot.obj";
@@ -136,519 +209,4844 @@ namespace std {
     };
 }
 
-struct UBORenderPass {
-    alignas(16) glm::mat4 mvpMat;
-    alignas(16) glm::mat4 mvMat;
-    alignas(16) glm::mat4 normMat;
-    alignas(16) glm::mat4 mvpMatLightSpace;
-    alignas(16) glm::vec3 lightPos;
+// How the six faces of the cube shadow map are rendered: in one pass broadcast to all faces
+// by multiview, in one pass with gl_Layer picked per instance, or in one render pass per face
+enum CubeShadowMode {
+    CUBE_SHADOW_MULTIVIEW,
+    CUBE_SHADOW_LAYERED,
+    CUBE_SHADOW_SIX_PASSES,
+    CUBE_SHADOW_MODE_COUNT
 };
 
-struct UBOShadowMapPass {
-    alignas(16) glm::mat4 mvpMat;
+const char *const CUBE_SHADOW_MODE_NAMES[CUBE_SHADOW_MODE_COUNT] = { "multiview", "layered", "six-passes" };
+
+// How the main pass draws with --meshlets: whole objects as without it, meshlets culled by
+// meshlet_cull.comp into indirect draws, or meshlets culled by a task shader and emitted by a
+// mesh shader (VK_EXT_mesh_shader)
+enum MeshletPath {
+    MESHLET_PATH_OBJECTS,
+    MESHLET_PATH_COMPUTE,
+    MESHLET_PATH_MESH_SHADER,
+    MESHLET_PATH_COUNT
 };
 
-class HelloTriangleApplication {
-public:
-    void run() {
-        initWindow();
-        initVulkan();
-        mainLoop();
-        cleanup();
-    }
+const char *const MESHLET_PATH_NAMES[MESHLET_PATH_COUNT] = { "objects", "compute", "mesh-shader" };
+
+struct AppOptions {
+    uint32_t instanceCount = 1;
+    bool benchmarkInstancing = false;
+    bool gpuCulling = false;
+    bool cpuCulling = false;
+    bool benchmarkCpuCulling = false;
+    uint32_t recordThreadCount = 0;
+    bool drawPerObject = false;
+    bool benchmarkRecording = false;
+    bool benchmarkDescriptors = false;
+    bool pushConstants = false;
+    bool benchmarkDrawData = false;
+    bool depthPrepass = false;
+    uint32_t sampleCount = 1;
+    bool benchmarkMsaa = false;
+    bool dynamicResolution = false;
+    float resolutionTargetMs = 8.0f;
+    float minResolutionScale = 0.5f;
+    float maxResolutionScale = 1.0f;
+    bool clusteredLighting = false;
+    uint32_t pointLightCount = 0;
+    bool benchmarkLights = false;
+    uint32_t shadowLightCount = 1;
+    float shadowBudgetMtexels = 0.0f;
+    bool cubeShadows = false;
+    std::optional<CubeShadowMode> cubeShadowMode;
+    bool benchmarkCubeShadows = false;
+    bool meshlets = false;
+    std::optional<MeshletPath> meshletPath;
+    bool benchmarkMeshlets = false;
+    uint32_t lodCount = 1;
+    float lodErrorPixels = 1.0f;
+    uint32_t shadowLodBias = 1;
+    bool benchmarkLods = false;
+    uint32_t frameLimit = 0;
+    std::optional<VkPresentModeKHR> presentMode;
+    uint32_t swapChainImageCount = 0;
+    bool shaderDevMode = false;
+    bool hotReload = false;
+    std::string tracePath;
+    uint32_t traceFrameCount = 300;
+    bool printStats = false;
+
+    static AppOptions parse(int argc, char **argv) {
+        AppOptions options;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--instances" && i + 1 < argc) {
+                options.instanceCount = std::max(1u, parseUint(arg, argv[++i]));
+            } else if (arg == "--bench-instancing") {
+                options.benchmarkInstancing = true;
+            } else if (arg == "--gpu-culling") {
+                options.gpuCulling = true;
+            } else if (arg == "--cpu-culling") {
+                options.cpuCulling = true;
+            } else if (arg == "--bench-cpu-culling") {
+                options.benchmarkCpuCulling = true;
+            } else if (arg == "--record-threads" && i + 1 < argc) {
+                options.recordThreadCount = parseUint(arg, argv[++i]);
+            } else if (arg == "--draw-per-object") {
+                options.drawPerObject = true;
+            } else if (arg == "--bench-recording") {
+                options.benchmarkRecording = true;
+            } else if (arg == "--bench-descriptors") {
+                options.benchmarkDescriptors = true;
+            } else if (arg == "--push-constants") {
+                options.pushConstants = true;
+            } else if (arg == "--bench-draw-data") {
+                options.benchmarkDrawData = true;
+            } else if (arg == "--depth-prepass") {
+                options.depthPrepass = true;
+            } else if (arg == "--msaa" && i + 1 < argc) {
+                options.sampleCount = parseSampleCount(arg, argv[++i]);
+            } else if (arg == "--bench-msaa") {
+                options.benchmarkMsaa = true;
+            } else if (arg == "--dynamic-resolution") {
+                options.dynamicResolution = true;
+            } else if (arg == "--resolution-target" && i + 1 < argc) {
+                options.resolutionTargetMs = parseFloat(arg, argv[++i]);
+            } else if (arg == "--resolution-min" && i + 1 < argc) {
+                options.minResolutionScale = parseFloat(arg, argv[++i]);
+            } else if (arg == "--resolution-max" && i + 1 < argc) {
+                options.maxResolutionScale = parseFloat(arg, argv[++i]);
+            } else if (arg == "--point-lights" && i + 1 < argc) {
+                options.pointLightCount = parseUint(arg, argv[++i]);
+                options.clusteredLighting = true;
+            } else if (arg == "--bench-lights") {
+                options.benchmarkLights = true;
+                options.clusteredLighting = true;
+            } else if (arg == "--shadow-lights" && i + 1 < argc) {
+                options.shadowLightCount = parseUint(arg, argv[++i]);
+            } else if (arg == "--shadow-budget" && i + 1 < argc) {
+                options.shadowBudgetMtexels = parseFloat(arg, argv[++i]);
+            } else if (arg == "--cube-shadows") {
+                options.cubeShadows = true;
+            } else if (arg == "--cube-shadow-mode" && i + 1 < argc) {
+                options.cubeShadowMode = parseCubeShadowMode(arg, argv[++i]);
+                options.cubeShadows = true;
+            } else if (arg == "--bench-cube-shadows") {
+                options.benchmarkCubeShadows = true;
+                options.cubeShadows = true;
+            } else if (arg == "--meshlets") {
+                options.meshlets = true;
+            } else if (arg == "--meshlet-path" && i + 1 < argc) {
+                options.meshletPath = parseMeshletPath(arg, argv[++i]);
+                options.meshlets = true;
+            } else if (arg == "--bench-meshlets") {
+                options.benchmarkMeshlets = true;
+                options.meshlets = true;
+            } else if (arg == "--lods" && i + 1 < argc) {
+                options.lodCount = parseUint(arg, argv[++i]);
+            } else if (arg == "--lod-error" && i + 1 < argc) {
+                options.lodErrorPixels = parseFloat(arg, argv[++i]);
+            } else if (arg == "--shadow-lod-bias" && i + 1 < argc) {
+                options.shadowLodBias = parseUint(arg, argv[++i]);
+            } else if (arg == "--bench-lods") {
+                options.benchmarkLods = true;
+                options.lodCount = std::max(options.lodCount, MAX_LODS);
+            } else if (arg == "--frames" && i + 1 < argc) {
+                options.frameLimit = parseUint(arg, argv[++i]);
+            } else if (arg == "--present-mode" && i + 1 < argc) {
+                options.presentMode = parsePresentMode(arg, argv[++i]);
+            } else if (arg == "--swapchain-images" && i + 1 < argc) {
+                options.swapChainImageCount = parseUint(arg, argv[++i]);
+            } else if (arg == "--shader-dev") {
+                options.shaderDevMode = true;
+            } else if (arg == "--hot-reload") {
+                options.hotReload = true;
+            } else if (arg == "--trace" && i + 1 < argc) {
+#ifdef ENABLE_CPU_PROFILER
+                options.tracePath = argv[++i];
+#else
+                throw std::runtime_error("--trace requires a build with ENABLE_CPU_PROFILER");
+#endif
+            } else if (arg == "--trace-frames" && i + 1 < argc) {
+                options.traceFrameCount = std::max(1u, parseUint(arg, argv[++i]));
+            } else if (arg == "--stats") {
+                options.printStats = true;
+            } else {
+                throw std::runtime_error("unknown option: " + arg);
+            }
+        }
 
-private:
-    GLFWwindow* window;
+        if (options.gpuCulling && options.cpuCulling) {
+            throw std::runtime_error("--gpu-culling and --cpu-culling are mutually exclusive");
+        }
+        if (options.benchmarkRecording && (options.gpuCulling || options.cpuCulling)) {
+            throw std::runtime_error("--bench-recording records direct draws and cannot be combined with culling");
+        }
+        if (options.pushConstants && (options.gpuCulling || options.cpuCulling)) {
+            throw std::runtime_error("--push-constants needs direct draws and cannot be combined with culling");
+        }
+        if (options.meshlets && (options.gpuCulling || options.cpuCulling || options.pushConstants || options.benchmarkRecording)) {
+            throw std::runtime_error("--meshlets culls the camera draws itself and cannot be combined with object culling, --push-constants or --bench-recording");
+        }
+        if (options.lodCount < 1 || options.lodCount > MAX_LODS) {
+            throw std::runtime_error("--lods must be between 1 and " + std::to_string(MAX_LODS));
+        }
+        if (options.lodErrorPixels < 0.0f) {
+            throw std::runtime_error("--lod-error must not be negative");
+        }
+        if (options.lodCount > 1 && (options.gpuCulling || options.meshlets)) {
+            throw std::runtime_error("--lods selects the draws on the CPU and cannot be combined with --gpu-culling or --meshlets");
+        }
+        if (options.meshletPath == MESHLET_PATH_MESH_SHADER && options.depthPrepass) {
+            throw std::runtime_error("the mesh-shader meshlet path has no depth pre-pass");
+        }
+        if (options.pointLightCount > MAX_POINT_LIGHTS) {
+            throw std::runtime_error("--point-lights supports at most " + std::to_string(MAX_POINT_LIGHTS) + " lights");
+        }
+        if (options.shadowLightCount < 1 || options.shadowLightCount > MAX_SHADOW_LIGHTS) {
+            throw std::runtime_error("--shadow-lights must be between 1 and " + std::to_string(MAX_SHADOW_LIGHTS));
+        }
+        if (options.shadowBudgetMtexels < 0.0f) {
+            throw std::runtime_error("--shadow-budget must not be negative");
+        }
+        if (options.resolutionTargetMs <= 0.0f) {
+            throw std::runtime_error("--resolution-target must be positive");
+        }
+        // The offscreen target is allocated at the swap chain size, so the scale cannot exceed 1
+        if (options.minResolutionScale <= 0.0f || options.minResolutionScale > options.maxResolutionScale || options.maxResolutionScale > 1.0f) {
+            throw std::runtime_error("resolution scale bounds must satisfy 0 < --resolution-min <= --resolution-max <= 1");
+        }
+        return options;
+    }
 
-    VkInstance instance;
-    VkDebugUtilsMessengerEXT debugMessenger;
-    VkSurfaceKHR surface;
+    static uint32_t parseUint(const std::string &option, const std::string &value) {
+        try {
+            return static_cast<uint32_t>(std::stoul(value));
+        } catch (const std::exception&) {
+            throw std::runtime_error("invalid value for " + option + ": " + value);
+        }
+    }
 
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkDevice device;
+    static float parseFloat(const std::string &option, const std::string &value) {
+        try {
+            return std::stof(value);
+        } catch (const std::exception&) {
+            throw std::runtime_error("invalid value for " + option + ": " + value);
+        }
+    }
 
-    VkQueue graphicsQueue;
-    VkQueue presentQueue;
+    static uint32_t parseSampleCount(const std::string &option, const std::string &value) {
+        uint32_t sampleCount = parseUint(option, value);
+        if (sampleCount != 1 && sampleCount != 2 && sampleCount != 4 && sampleCount != 8) {
+            throw std::runtime_error("invalid value for " + option + ": " + value + " (expected 1, 2, 4 or 8)");
+        }
+        return sampleCount;
+    }
 
-    VkSwapchainKHR swapChain;
-    std::vector<VkImage> swapChainImages;
-    VkFormat swapChainImageFormat;
-    VkExtent2D swapChainExtent;
-    std::vector<VkImageView> swapChainImageViews;
-    std::vector<VkFramebuffer> swapChainFramebuffers;
+    static VkPresentModeKHR parsePresentMode(const std::string &option, const std::string &value) {
+        if (value == "immediate") {
+            return VK_PRESENT_MODE_IMMEDIATE_KHR;
+        } else if (value == "mailbox") {
+            return VK_PRESENT_MODE_MAILBOX_KHR;
+        } else if (value == "fifo") {
+            return VK_PRESENT_MODE_FIFO_KHR;
+        } else if (value == "fifo-relaxed") {
+            return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        }
+        throw std::runtime_error("invalid value for " + option + ": " + value + " (expected immediate, mailbox, fifo or fifo-relaxed)");
+    }
 
-    VkRenderPass renderPass;
-    VkDescriptorSetLayout descriptorSetLayout;
-    VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    static CubeShadowMode parseCubeShadowMode(const std::string &option, const std::string &value) {
+        for (uint32_t mode = 0; mode < CUBE_SHADOW_MODE_COUNT; mode++) {
+            if (value == CUBE_SHADOW_MODE_NAMES[mode]) {
+                return static_cast<CubeShadowMode>(mode);
+            }
+        }
+        throw std::runtime_error("invalid value for " + option + ": " + value + " (expected multiview, layered or six-passes)");
+    }
 
-    VkFormat shadowMapColorFormat;
-    VkFormat shadowMapDepthFormat;
-    VkImage shadowMapColorImage;
-    VkImage shadowMapDepthImage;
-    VkDeviceMemory shadowMapColorImageMemory;
-    VkDeviceMemory shadowMapDepthImageMemory;
-    VkImageView shadowMapColorImageView;
-    VkImageView shadowMapDepthImageView;
-    VkFramebuffer shadowMapFramebuffer;
+    static MeshletPath parseMeshletPath(const std::string &option, const std::string &value) {
+        for (uint32_t path = 0; path < MESHLET_PATH_COUNT; path++) {
+            if (value == MESHLET_PATH_NAMES[path]) {
+                return static_cast<MeshletPath>(path);
+            }
+        }
+        throw std::runtime_error("invalid value for " + option + ": " + value + " (expected objects, compute or mesh-shader)");
+    }
+};
 
-    VkRenderPass shadowMapRenderPass;
-    VkDescriptorSetLayout shadowMapDescriptorSetLayout;
-    VkPipelineLayout shadowMapPipelineLayout;
-    VkPipeline shadowMapGraphicsPipeline;
+const char *presentModeName(VkPresentModeKHR presentMode) {
+    switch (presentMode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR:
+        return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+        return "fifo-relaxed";
+    default:
+        return "unknown";
+    }
+}
 
-    VkCommandPool commandPool;
+// An index range of a detail level. The error estimates, from the quadrics, how far in object
+// space the simplification moved the surface.
+struct MeshLod {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    float error = 0.0f;
+};
 
-    VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
-    VkImageView depthImageView;
+struct MeshRange {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    glm::vec3 aabbMin;
+    glm::vec3 aabbMax;
+    glm::vec4 boundingSphere;
+    uint32_t firstMeshlet = 0;  // only with --meshlets
+    uint32_t meshletCount = 0;
+    std::array<MeshLod, MAX_LODS> lods = {};  // lods[0] is the full mesh
+    uint32_t lodCount = 1;
+};
 
-    uint32_t mipLevels;
-    VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
-    VkImageView textureImageView;
-    VkSampler textureSampler;
+struct DrawBatch {
+    MeshRange mesh;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
 
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
-    VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+// A run of consecutive commands in an indirect draw buffer
+struct IndirectDrawRange {
+    uint32_t firstCommand = 0;
+    uint32_t commandCount = 0;
+};
 
-    std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
+// Passes bracketed by GPU timestamps in every frame
+enum GpuPass {
+    GPU_PASS_CULL,
+    GPU_PASS_SHADOW,
+    GPU_PASS_CUBE_SHADOW,
+    GPU_PASS_LIGHT_BINNING,
+    GPU_PASS_MESHLET_CULL,
+    GPU_PASS_MAIN,
+    GPU_PASS_UPSCALE,
+    GPU_PASS_COUNT
+};
 
-    VkDescriptorPool descriptorPool;
-    std::vector<VkDescriptorSet> descriptorSets;
-    std::vector<VkCommandBuffer> commandBuffers;
+const char *const GPU_PASS_NAMES[GPU_PASS_COUNT] = { "cull pass", "shadow pass", "cube shadow pass", "light binning pass", "meshlet cull pass", "main pass", "upscale pass" };
 
-    VkBuffer shadowMapUniformBuffer;
-    VkDeviceMemory shadowMapUniformBufferMemory;
-    VkDescriptorPool shadowMapDescriptorPool;
-    VkDescriptorSet shadowMapDescriptorSet;
-    VkCommandBuffer shadowMapCommandBuffer;
-    VkSemaphore shadowMapFinishedSemaphore;
+// Pipeline statistics only count graphics work
+inline bool isComputePass(uint32_t pass) {
+    return pass == GPU_PASS_CULL || pass == GPU_PASS_LIGHT_BINNING || pass == GPU_PASS_MESHLET_CULL;
+}
 
-    std::vector<VkSemaphore> imageAvailableSemaphores;
-    std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
-    size_t currentFrame = 0;
+// Counters of the pipeline statistics queries around the graphics passes, in the order
+// in which the results are written (by increasing VkQueryPipelineStatisticFlagBits)
+enum PipelineStatistic {
+    PIPELINE_STATISTIC_VERTICES,
+    PIPELINE_STATISTIC_PRIMITIVES,
+    PIPELINE_STATISTIC_VERTEX_INVOCATIONS,
+    PIPELINE_STATISTIC_CLIPPING_PRIMITIVES,
+    PIPELINE_STATISTIC_FRAGMENT_INVOCATIONS,
+    PIPELINE_STATISTIC_COUNT
+};
 
-    bool framebufferResized = false;
+const char *const PIPELINE_STATISTIC_NAMES[PIPELINE_STATISTIC_COUNT] = {
+    "vertices", "primitives", "vertex invocations", "clipping primitives", "fragment invocations"
+};
 
-    void initWindow() {
-        glfwInit();
+// PI controller that picks the render resolution scale holding the main pass at a target
+// GPU time. It works in velocity form, so clamping the scale also stops integral windup.
+class ResolutionScaleController {
+public:
+    ResolutionScaleController() = default;
 
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    ResolutionScaleController(float targetMs, float minScale, float maxScale)
+        : targetMs(targetMs), minScale(minScale), maxScale(maxScale), currentScale(maxScale) {
+    }
 
-        window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    // The error is relative to the target, so the gains do not depend on it
+    float update(float passTimeMs) {
+        float error = (targetMs - passTimeMs) / targetMs;
+        currentScale = std::clamp(currentScale + KP * (error - previousError) + KI * error, minScale, maxScale);
+        previousError = error;
+        return currentScale;
+    }
 
-        glfwSetWindowUserPointer(window, this);
-        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    float scale() const {
+        return currentScale;
     }
 
-    static void framebufferResizeCallback(GLFWwindow *window, int width, int height) {
-        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-        app->framebufferResized = true;
+    float target() const {
+        return targetMs;
     }
 
-    void initVulkan() {
-        createInstance();
-        setupDebugMessenger();
-        createSurface();
-        pickPhysicalDevice();
-        createLogicalDevice();
+private:
+    // The measured time lags by MAX_FRAMES_IN_FLIGHT frames, so the gains are kept small
+    static constexpr float KP = 0.1f;
+    static constexpr float KI = 0.05f;
+
+    float targetMs = 1.0f;
+    float minScale = 1.0f;
+    float maxScale = 1.0f;
+    float currentScale = 1.0f;
+    float previousError = 0.0f;
+};
 
-        createSwapChain();
-        createCommandPool();
-        createImageViews();
-        createRenderPass();
+// Texel rectangle of a light in the shadow atlas; size is 0 for lights without a tile
+struct ShadowAtlasTile {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t size = 0;
+};
 
-        createShadowMapResources();
+// Packs square power-of-two shadow map tiles into a square atlas. Placed in decreasing size
+// along the Z-order curve, every tile starts at a multiple of its own area and so covers an
+// aligned square: whatever fits by area also fits without gaps.
+class ShadowAtlasAllocator {
+public:
+    ShadowAtlasAllocator() = default;
 
-        createDescriptorSetLayout();
-        createGraphicsPipeline();
-        createDepthResources();
-        createFramebuffers();
-        createTextureImage();
-        createTextureImageView();
-        createTextureSampler();
+    ShadowAtlasAllocator(uint32_t atlasSize, uint32_t minTileSize)
+        : atlasSize(atlasSize), minTileSize(minTileSize) {
+    }
 
-        createShadowMapRenderPass();
-        createShadowMapFramebuffer();
-        createShadowMapDescriptorSetLayout();
-        createShadowMapGraphicsPipeline();
+    // Rounds the desired sizes (in texels, 0 for no shadow) to powers of two and halves the
+    // largest tiles until all of them fit; lights that still do not fit at the minimum size
+    // are dropped, least important first. A light keeps its previous size while the request
+    // stays near it, so that tiles do not flip between two sizes every frame.
+    std::vector<uint32_t> fitSizes(const std::vector<float> &desiredSizes, const std::vector<uint32_t> &previousSizes) const {
+        std::vector<uint32_t> sizes(desiredSizes.size(), 0);
+        uint64_t area = 0;
+        for (size_t i = 0; i < desiredSizes.size(); i++) {
+            if (desiredSizes[i] <= 0.0f) {
+                continue;
+            }
 
-        loadModel();
-        createVertexBuffer();
-        createIndexBuffer();
-        createUniformBuffers();
-        createDescriptorPool();
-        createDescriptorSets();
-        createCommandBuffers();
+            float level = std::log2(std::clamp(desiredSizes[i], static_cast<float>(minTileSize), static_cast<float>(atlasSize)));
+            sizes[i] = 1u << static_cast<uint32_t>(std::lround(level));
+            if (i < previousSizes.size() && previousSizes[i] > 0 && std::abs(level - std::log2(static_cast<float>(previousSizes[i]))) < HYSTERESIS) {
+                sizes[i] = previousSizes[i];
+            }
+            area += static_cast<uint64_t>(sizes[i]) * sizes[i];
+        }
 
-        createShadowMapUniformBuffer();
-        createShadowMapDescriptorPool();
-        createShadowMapDescriptorSet();
-        createShadowMapCommandBuffer();
+        const uint64_t atlasArea = static_cast<uint64_t>(atlasSize) * atlasSize;
+        while (area > atlasArea) {
+            // Among the largest tiles the least important one is halved first
+            size_t victim = sizes.size();
+            for (size_t i = 0; i < sizes.size(); i++) {
+                if (sizes[i] > 0 && (victim == sizes.size() || sizes[i] > sizes[victim] || (sizes[i] == sizes[victim] && desiredSizes[i] < desiredSizes[victim]))) {
+                    victim = i;
+                }
+            }
 
-        createSyncObjects();
+            if (sizes[victim] > minTileSize) {
+                area -= 3 * static_cast<uint64_t>(sizes[victim] / 2) * (sizes[victim] / 2);
+                sizes[victim] /= 2;
+            } else {
+                for (size_t i = 0; i < sizes.size(); i++) {
+                    if (sizes[i] > 0 && desiredSizes[i] < desiredSizes[victim]) {
+                        victim = i;
+                    }
+                }
+                area -= static_cast<uint64_t>(sizes[victim]) * sizes[victim];
+                sizes[victim] = 0;
+            }
+        }
+        return sizes;
     }
 
-    void mainLoop() {
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
-            drawFrame();
+    // Sizes must come from fitSizes(); lights without a tile get a zero-sized one
+    std::vector<ShadowAtlasTile> pack(const std::vector<uint32_t> &sizes) const {
+        std::vector<size_t> order(sizes.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+        std::vector<ShadowAtlasTile> tiles(sizes.size());
+        uint64_t cursor = 0;
+        for (size_t i : order) {
+            if (sizes[i] == 0) {
+                break;
+            }
+
+            // The cursor counts minimum-sized cells along the Z-order curve
+            uint32_t cellX = 0;
+            uint32_t cellY = 0;
+            for (uint32_t bit = 0; bit < 16; bit++) {
+                cellX |= static_cast<uint32_t>((cursor >> (2 * bit)) & 1) << bit;
+                cellY |= static_cast<uint32_t>((cursor >> (2 * bit + 1)) & 1) << bit;
+            }
+            tiles[i] = { cellX * minTileSize, cellY * minTileSize, sizes[i] };
+
+            uint64_t cells = sizes[i] / minTileSize;
+            cursor += cells * cells;
         }
+        return tiles;
+    }
 
-        vkDeviceWaitIdle(device);
+    uint32_t size() const {
+        return atlasSize;
     }
 
-    void recreateSwapChain() {
-        int width = 0, height = 0;
-        while (width == 0 || height == 0) {
-            glfwGetFramebufferSize(window, &width, &height);
-            glfwWaitEvents();
-        }
+private:
+    // In octaves of the tile size
+    static constexpr float HYSTERESIS = 0.75f;
 
-        vkDeviceWaitIdle(device);
+    uint32_t atlasSize = 1;
+    uint32_t minTileSize = 1;
+};
 
-        cleanupSwapChain();
+struct UpscalePushConstants {
+    glm::vec2 uvScale;
+    glm::vec2 uvMax;
+};
 
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createDepthResources();
-        createFramebuffers();
-        createUniformBuffers();
-        createDescriptorPool();
-        createDescriptorSets();
-        createCommandBuffers();
+struct FrameStats {
+    uint32_t frameCount = 0;
+    float frameTimeSum = 0.0f;
+    std::vector<float> frameTimes;
+    std::vector<float> presentLatencies;
+    std::vector<float> displayLatencies;
+
+    uint32_t objectCount = 0;
+    uint32_t cameraVisibleCount = 0;
+    uint32_t shadowDrawCount = 0;
+    uint64_t shadowTriangleCount = 0;
+    float cullCpuTimeSum = 0.0f;
+    uint32_t cullCpuTimeCount = 0;
+    float recordCpuTimeSum = 0.0f;
+    uint32_t recordCpuTimeCount = 0;
+    uint32_t shadowTileUpdateSum = 0;
+    uint64_t shadowTexelUpdateSum = 0;
+    uint64_t meshletVisibleSum = 0;
+    uint64_t meshletTriangleSum = 0;
+    uint32_t meshletStatsCount = 0;
+    std::array<uint64_t, 2> lodTriangleSum = {};      // camera and shadow pass
+    std::array<uint64_t, 2> lodFullTriangleSum = {};
+    std::array<uint64_t, MAX_LODS> lodObjectSum = {};  // camera pass
+    uint32_t lodSelectCount = 0;
+    std::array<float, GPU_PASS_COUNT> gpuPassTimeSum = {};
+    std::array<uint32_t, GPU_PASS_COUNT> gpuPassTimeCount = {};
+    std::array<std::array<uint64_t, PIPELINE_STATISTIC_COUNT>, GPU_PASS_COUNT> pipelineStatisticSum = {};
+    std::array<uint32_t, GPU_PASS_COUNT> pipelineStatisticCount = {};
+};
+
+// Prints min / p50 / p90 / p99 / max of the samples; the samples are sorted in place
+void printDistribution(const std::string &label, std::vector<float> &samples) {
+    if (samples.empty()) {
+        return;
     }
 
-    void cleanupSwapChain() {
-        vkDestroyImageView(device, depthImageView, nullptr);
-        vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](float p) {
+        size_t index = static_cast<size_t>(p * (samples.size() - 1) + 0.5f);
+        return samples[index];
+    };
 
-        for (auto framebuffer : swapChainFramebuffers) {
-            vkDestroyFramebuffer(device, framebuffer, nullptr);
-        }
+    std::cout << label << ": min " << samples.front() << " / p50 " << percentile(0.5f) << " / p90 " << percentile(0.9f)
+              << " / p99 " << percentile(0.99f) << " / max " << samples.back() << " ms (" << samples.size() << " samples)" << std::endl;
+}
 
-        vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+#ifdef ENABLE_CPU_PROFILER
 
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
-        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-        vkDestroyRenderPass(device, renderPass, nullptr);
+// A single timed CPU zone. Names must be string literals, only the pointer is stored.
+struct CpuProfileEvent {
+    const char *name;
+    uint64_t beginNs;
+    uint64_t endNs;
+};
 
-        for (auto imageView : swapChainImageViews) {
-            vkDestroyImageView(device, imageView, nullptr);
-        }
+// A ring slot. Its fields are atomic because the reader may copy a slot while the producer
+// overwrites it; such copies are detected through claimIndex and dropped.
+struct CpuProfileSlot {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> beginNs{0};
+    std::atomic<uint64_t> endNs{0};
+};
 
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
+// Single-producer ring owned by one thread. The producer never blocks and works like a seqlock
+// writer: it claims a slot before writing it and publishes it afterwards. Slots [0, writeIndex)
+// are published; a slot whose index is below claimIndex - CAPACITY may be overwritten.
+struct CpuProfileRing {
+    static constexpr uint64_t CAPACITY = 16384;
+
+    std::array<CpuProfileSlot, CAPACITY> slots;
+    std::atomic<uint64_t> claimIndex{0};
+    std::atomic<uint64_t> writeIndex{0};
+    uint64_t readIndex = 0;
+    std::atomic<bool> retired{false};
+    uint32_t threadId = 0;
+};
 
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
-            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-        }
+class CpuProfiler {
+public:
+    static CpuProfiler &instance() {
+        static CpuProfiler profiler;
+        return profiler;
+    }
 
-        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
     }
 
-    void cleanup() {
-        cleanupSwapChain();
+    void record(const char *name, uint64_t beginNs, uint64_t endNs) {
+        CpuProfileRing &ring = threadRing();
+        uint64_t index = ring.writeIndex.load(std::memory_order_relaxed);
+        ring.claimIndex.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        CpuProfileSlot &slot = ring.slots[index % CpuProfileRing::CAPACITY];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.beginNs.store(beginNs, std::memory_order_relaxed);
+        slot.endNs.store(endNs, std::memory_order_relaxed);
+        ring.writeIndex.store(index + 1, std::memory_order_release);
+    }
 
-        vkDestroySampler(device, textureSampler, nullptr);
-        vkDestroyImageView(device, textureImageView, nullptr);
+    // Hands every event recorded since the previous call to func(threadId, event). Events that
+    // the producer overwrote before they were copied are dropped.
+    template <typename Func>
+    void drain(Func func) {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (auto &ring : rings) {
+            uint64_t end = ring->writeIndex.load(std::memory_order_acquire);
+            uint64_t begin = std::max(ring->readIndex, end > CpuProfileRing::CAPACITY ? end - CpuProfileRing::CAPACITY : 0);
+
+            drainedEvents.clear();
+            for (uint64_t i = begin; i < end; i++) {
+                const CpuProfileSlot &slot = ring->slots[i % CpuProfileRing::CAPACITY];
+                drainedEvents.push_back({ slot.name.load(std::memory_order_relaxed), slot.beginNs.load(std::memory_order_relaxed), slot.endNs.load(std::memory_order_relaxed) });
+            }
 
-        vkDestroyImage(device, textureImage, nullptr);
-        vkFreeMemory(device, textureImageMemory, nullptr);
+            // Any write that reached the copied slots has claimed an index visible after this fence
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t claimed = ring->claimIndex.load(std::memory_order_relaxed);
+            uint64_t firstIntact = std::max(begin, claimed > CpuProfileRing::CAPACITY ? claimed - CpuProfileRing::CAPACITY : 0);
+            for (uint64_t i = firstIntact; i < end; i++) {
+                func(ring->threadId, drainedEvents[i - begin]);
+            }
+            ring->readIndex = end;
+        }
+    }
 
-        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+private:
+    struct ThreadRingHandle {
+        CpuProfileRing *ring = nullptr;
 
-        vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexBufferMemory, nullptr);
+        ~ThreadRingHandle() {
+            if (ring != nullptr) {
+                ring->retired.store(true, std::memory_order_release);
+            }
+        }
+    };
 
-        vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexBufferMemory, nullptr);
+    CpuProfileRing &threadRing() {
+        thread_local ThreadRingHandle handle;
+        if (handle.ring == nullptr) {
+            handle.ring = acquireRing();
+        }
+        return *handle.ring;
+    }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-            vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(device, inFlightFences[i], nullptr);
+    // Only taken once per thread; short-lived worker threads reuse retired, fully drained rings
+    CpuProfileRing *acquireRing() {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        uint32_t threadId = nextThreadId++;
+        for (auto &ring : rings) {
+            if (ring->retired.load(std::memory_order_acquire) && ring->readIndex == ring->writeIndex.load(std::memory_order_acquire)) {
+                ring->retired.store(false, std::memory_order_relaxed);
+                ring->threadId = threadId;
+                return ring.get();
+            }
         }
 
-        vkDestroyImage(device, shadowMapColorImage, nullptr);
-        vkDestroyImage(device, shadowMapDepthImage, nullptr);
-        vkFreeMemory(device, shadowMapColorImageMemory, nullptr);
-        vkFreeMemory(device, shadowMapDepthImageMemory, nullptr);
-        vkDestroyImageView(device, shadowMapColorImageView, nullptr);
-        vkDestroyImageView(device, shadowMapDepthImageView, nullptr);
-        vkDestroyFramebuffer(device, shadowMapFramebuffer, nullptr);
+        rings.push_back(std::make_unique<CpuProfileRing>());
+        rings.back()->threadId = threadId;
+        return rings.back().get();
+    }
 
-        vkDestroyBuffer(device, shadowMapUniformBuffer, nullptr);
-        vkFreeMemory(device, shadowMapUniformBufferMemory, nullptr);
+    std::mutex ringsMutex;
+    std::vector<std::unique_ptr<CpuProfileRing>> rings;
+    uint32_t nextThreadId = 0;
+    std::vector<CpuProfileEvent> drainedEvents;  // guarded by ringsMutex
+};
 
-        vkFreeCommandBuffers(device, commandPool, 1, &shadowMapCommandBuffer);
-        vkDestroyPipeline(device, shadowMapGraphicsPipeline, nullptr);
-        vkDestroyPipelineLayout(device, shadowMapPipelineLayout, nullptr);
-        vkDestroyRenderPass(device, shadowMapRenderPass, nullptr);
-        vkDestroyDescriptorSetLayout(device, shadowMapDescriptorSetLayout, nullptr);
-        vkDestroySemaphore(device, shadowMapFinishedSemaphore, nullptr);
+class CpuProfileScope {
+public:
+    explicit CpuProfileScope(const char *name)
+        : name(name), beginNs(CpuProfiler::now()) {
+    }
 
-        vkDestroyDescriptorPool(device, shadowMapDescriptorPool, nullptr);
+    ~CpuProfileScope() {
+        CpuProfiler::instance().record(name, beginNs, CpuProfiler::now());
+    }
 
-        vkDestroyCommandPool(device, commandPool, nullptr);
+private:
+    const char *name;
+    uint64_t beginNs;
+};
 
-        vkDestroyDevice(device, nullptr);
+// Collects drained CPU events into per-zone rolling histograms, and CPU plus GPU events
+// into a trace-event JSON file that chrome://tracing and Perfetto can load.
+class ProfileCollector {
+public:
+    static constexpr size_t MAX_TRACE_EVENTS = 1000000;
 
-        if (enableValidationLayers) {
-            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
-        }
+    void collect(bool keepHistograms, bool keepTrace) {
+        CpuProfiler::instance().drain([this, keepHistograms, keepTrace](uint32_t threadId, const CpuProfileEvent &event) {
+            if (keepHistograms) {
+                zoneTimes[event.name].push_back(static_cast<float>(event.endNs - event.beginNs) * 1.0e-6f);
+            }
+            if (keepTrace && traceEvents.size() < MAX_TRACE_EVENTS) {
+                traceEvents.push_back({ CPU_TRACK, threadId, event });
+            }
+        });
+    }
 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
-        vkDestroyInstance(instance, nullptr);
+    // GPU times must already be converted to the steady_clock domain
+    void addGpuEvent(const char *name, uint64_t beginNs, uint64_t endNs) {
+        if (traceEvents.size() < MAX_TRACE_EVENTS) {
+            traceEvents.push_back({ GPU_TRACK, 0, { name, beginNs, endNs } });
+        }
+    }
 
-        glfwDestroyWindow(window);
+    void report() {
+        for (auto &zone : zoneTimes) {
+            printDistribution("cpu zone " + zone.first, zone.second);
+        }
+        zoneTimes.clear();
+    }
 
-        glfwTerminate();
+    void clearTrace() {
+        traceEvents.clear();
     }
 
-    void createInstance() {
-        if (enableValidationLayers && !checkValidationLayerSupport()) {
-            throw std::runtime_error("validation layers requested, but not available!");
+    void writeChromeTrace(const std::string &filename) const {
+        std::ofstream file(filename);
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open trace file: " + filename);
         }
 
-        VkApplicationInfo appInfo = {};
-        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.pApplicationName = "Hello Triangle";
-        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.pEngineName = "No Engine";
-        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        uint64_t originNs = std::numeric_limits<uint64_t>::max();
+        for (const auto &traceEvent : traceEvents) {
+            originNs = std::min(originNs, traceEvent.event.beginNs);
+        }
 
-        VkInstanceCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.pApplicationInfo = &appInfo;
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+             << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << CPU_TRACK << ",\"args\":{\"name\":\"CPU\"}},\n"
+             << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << GPU_TRACK << ",\"args\":{\"name\":\"GPU\"}},\n"
+             << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << GPU_TRACK << ",\"tid\":0,\"args\":{\"name\":\"graphics queue\"}}";
+        for (const auto &traceEvent : traceEvents) {
+            file << ",\n{\"name\":\"" << traceEvent.event.name << "\",\"cat\":\"" << (traceEvent.track == CPU_TRACK ? "cpu" : "gpu") << "\",\"ph\":\"X\""
+                 << ",\"pid\":" << traceEvent.track << ",\"tid\":" << traceEvent.threadId
+                 << ",\"ts\":" << static_cast<int64_t>(traceEvent.event.beginNs - originNs) / 1000.0
+                 << ",\"dur\":" << (traceEvent.event.endNs - traceEvent.event.beginNs) / 1000.0 << "}";
+        }
+        file << "\n]}\n";
 
-        auto extensions = getRequiredExtensions();
-        createInfo.enabledExtensionCount = extensions.size();
-        createInfo.ppEnabledExtensionNames = extensions.data();
+        std::cout << "wrote " << traceEvents.size() << " trace events to " << filename << std::endl;
+    }
 
-        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
-        if (enableValidationLayers) {
-            createInfo.enabledLayerCount = validationLayers.size();
-            createInfo.ppEnabledLayerNames = validationLayers.data();
+private:
+    static constexpr uint32_t CPU_TRACK = 0;
+    static constexpr uint32_t GPU_TRACK = 1;
 
-            populateDebugMessengerCreateInfo(debugCreateInfo);
-            createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
-        } else {
-            createInfo.enabledLayerCount = 0;
-            createInfo.pNext = nullptr;
-        }
+    struct TraceEvent {
+        uint32_t track;
+        uint32_t threadId;
+        CpuProfileEvent event;
+    };
 
-        if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create instance!");
-        }
-    }
+    std::map<std::string, std::vector<float>> zoneTimes;
+    std::vector<TraceEvent> traceEvents;
+};
 
-    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
-        createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-        createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-        createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-        createInfo.pfnUserCallback = debugCallback;
-    }
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) CpuProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
 
-    void setupDebugMessenger() {
-        if (!enableValidationLayers) return;
+#else
 
-        VkDebugUtilsMessengerCreateInfoEXT createInfo;
-        populateDebugMessengerCreateInfo(createInfo);
+#define PROFILE_SCOPE(name) ((void)0)
 
-        if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS) {
-            throw std::runtime_error("failed to set up debug messenger!");
-        }
+#endif
+
+// Gribb-Hartmann plane extraction for a clip space with zero-to-one depth
+void extractFrustumPlanes(const glm::mat4 &m, glm::vec4 planes[6]) {
+    glm::vec4 row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row2;
+    planes[5] = row3 - row2;
+
+    for (int i = 0; i < 6; i++) {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
     }
+}
 
-    void createSurface() {
-        if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create window surface!");
+// World space AABBs stored as structure of arrays so the culling kernels can load whole vectors
+struct ObjectBounds {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    size_t size() const {
+        return centerX.size();
+    }
+
+    void resize(size_t count) {
+        for (auto *v : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ }) {
+            v->resize(count);
         }
     }
 
-    void pickPhysicalDevice() {
-        uint32_t deviceCount = 0;
-        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    void set(size_t i, const glm::vec3 &center, const glm::vec3 &extent) {
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        extentX[i] = extent.x;
+        extentY[i] = extent.y;
+        extentZ[i] = extent.z;
+    }
+};
 
-        if (deviceCount == 0) {
-            throw std::runtime_error("failed to find GPUs with Vulkan support!");
+// An AABB is outside when it lies entirely behind any of the planes. visible[i] is set to 0 or 1 for i in [begin, end).
+void cullObjectBoundsScalar(const glm::vec4 planes[6], const ObjectBounds &bounds, size_t begin, size_t end, uint8_t *visible) {
+    for (size_t i = begin; i < end; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            float d = planes[p].x * bounds.centerX[i] + planes[p].y * bounds.centerY[i] + planes[p].z * bounds.centerZ[i] + planes[p].w
+                    + std::abs(planes[p].x) * bounds.extentX[i] + std::abs(planes[p].y) * bounds.extentY[i] + std::abs(planes[p].z) * bounds.extentZ[i];
+            inside = d >= 0.0f;
         }
+        visible[i] = inside ? 1 : 0;
+    }
+}
 
-        std::vector<VkPhysicalDevice> devices(deviceCount);
-        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+#if defined(CULL_SIMD_AVX2)
+void cullObjectBoundsSimd(const glm::vec4 planes[6], const ObjectBounds &bounds, size_t begin, size_t end, uint8_t *visible) {
+    __m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; p++) {
+        nx[p] = _mm256_set1_ps(planes[p].x);
+        ny[p] = _mm256_set1_ps(planes[p].y);
+        nz[p] = _mm256_set1_ps(planes[p].z);
+        nw[p] = _mm256_set1_ps(planes[p].w);
+        ax[p] = _mm256_set1_ps(std::abs(planes[p].x));
+        ay[p] = _mm256_set1_ps(std::abs(planes[p].y));
+        az[p] = _mm256_set1_ps(std::abs(planes[p].z));
+    }
 
-        for (const auto& device : devices) {
-            if (isDeviceSuitable(device)) {
-                physicalDevice = device;
-                break;
-            }
+    const __m256 zero = _mm256_setzero_ps();
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+        __m256 outside = zero;
+        for (int p = 0; p < 6; p++) {
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy)), _mm256_add_ps(_mm256_mul_ps(nz[p], cz), nw[p]));
+            __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_LT_OQ));
         }
 
-        if (physicalDevice == VK_NULL_HANDLE) {
-            throw std::runtime_error("failed to find a suitable GPU!");
+        int mask = _mm256_movemask_ps(outside);
+        for (int k = 0; k < 8; k++) {
+            visible[i + k] = (mask >> k) & 1 ? 0 : 1;
         }
     }
 
-    void createLogicalDevice() {
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    cullObjectBoundsScalar(planes, bounds, i, end, visible);
+}
+#elif defined(CULL_SIMD_SSE)
+void cullObjectBoundsSimd(const glm::vec4 planes[6], const ObjectBounds &bounds, size_t begin, size_t end, uint8_t *visible) {
+    __m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; p++) {
+        nx[p] = _mm_set1_ps(planes[p].x);
+        ny[p] = _mm_set1_ps(planes[p].y);
+        nz[p] = _mm_set1_ps(planes[p].z);
+        nw[p] = _mm_set1_ps(planes[p].w);
+        ax[p] = _mm_set1_ps(std::abs(planes[p].x));
+        ay[p] = _mm_set1_ps(std::abs(planes[p].y));
+        az[p] = _mm_set1_ps(std::abs(planes[p].z));
+    }
 
-        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-        std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    const __m128 zero = _mm_setzero_ps();
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+        __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+        __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        __m128 outside = zero;
+        for (int p = 0; p < 6; p++) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), nw[p]));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+        }
 
-        float queuePriority = 1.0f;
-        for (int queueFamily : uniqueQueueFamilies) {
-            VkDeviceQueueCreateInfo queueCreateInfo = {};
-            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueCreateInfo.queueFamilyIndex = queueFamily;
-            queueCreateInfo.queueCount = 1;
-            queueCreateInfo.pQueuePriorities = &queuePriority;
-            queueCreateInfos.push_back(queueCreateInfo);
+        int mask = _mm_movemask_ps(outside);
+        for (int k = 0; k < 4; k++) {
+            visible[i + k] = (mask >> k) & 1 ? 0 : 1;
         }
+    }
 
-        VkPhysicalDeviceFeatures deviceFeatures = {};
-        deviceFeatures.samplerAnisotropy = VK_TRUE;
+    cullObjectBoundsScalar(planes, bounds, i, end, visible);
+}
+#endif
 
-        VkDeviceCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+const char *cullObjectBoundsPath() {
+#if defined(CULL_SIMD_AVX2)
+    return "avx2";
+#elif defined(CULL_SIMD_SSE)
+    return "sse";
+#else
+    return "scalar";
+#endif
+}
 
-        createInfo.pQueueCreateInfos = queueCreateInfos.data();
-        createInfo.queueCreateInfoCount = (uint32_t) queueCreateInfos.size();
+void cullObjectBounds(const glm::vec4 planes[6], const ObjectBounds &bounds, size_t begin, size_t end, uint8_t *visible) {
+#if defined(CULL_SIMD_AVX2) || defined(CULL_SIMD_SSE)
+    cullObjectBoundsSimd(planes, bounds, begin, end, visible);
+#else
+    cullObjectBoundsScalar(planes, bounds, begin, end, visible);
+#endif
+}
 
-        createInfo.pEnabledFeatures = &deviceFeatures;
+uint32_t workerThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
 
-        createInfo.enabledExtensionCount = deviceExtensions.size();
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+// Threads that parallelFor hands its ranges to. They are started once, so that a call costs a
+// wakeup and a join instead of creating and tearing down threads every time.
+class WorkerPool {
+public:
+    WorkerPool() = default;
 
-        if (enableValidationLayers) {
-            createInfo.enabledLayerCount = validationLayers.size();
-            createInfo.ppEnabledLayerNames = validationLayers.data();
-        } else {
-            createInfo.enabledLayerCount = 0;
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
-
-        if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create logical device!");
+        wakeup.notify_all();
+        for (auto &thread : threads) {
+            thread.join();
         }
-
-        vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-        vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
     }
 
-    void createSwapChain() {
-        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool &operator=(const WorkerPool&) = delete;
 
-        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-        VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
-        VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+    // Starts threads until there are at least threadCount of them
+    void reserve(uint32_t threadCount) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (threads.size() < threadCount) {
+            threads.emplace_back([this]() { run(); });
+        }
+    }
 
-        uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-        if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
-            imageCount = swapChainSupport.capabilities.maxImageCount;
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
         }
+        wakeup.notify_one();
+    }
 
-        VkSwapchainCreateInfoKHR createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-        createInfo.surface = surface;
+    static bool onWorkerThread() {
+        return isWorkerThread;
+    }
 
-        createInfo.minImageCount = imageCount;
-        createInfo.imageFormat = surfaceFormat.format;
-        createInfo.imageColorSpace = surfaceFormat.colorSpace;
-        createInfo.imageExtent = extent;
-        createInfo.imageArrayLayers = 1;
-        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+private:
+    void run() {
+        isWorkerThread = true;
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
 
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-        uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    static thread_local bool isWorkerThread;
+};
 
-        if (indices.graphicsFamily != indices.presentFamily) {
-            createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-            createInfo.queueFamilyIndexCount = 2;
-            createInfo.pQueueFamilyIndices = queueFamilyIndices;
-        } else {
-            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        }
+thread_local bool WorkerPool::isWorkerThread = false;
 
-        createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-        createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-        createInfo.presentMode = presentMode;
-        createInfo.clipped = VK_TRUE;
+WorkerPool &workerPool() {
+    static WorkerPool pool;
+    return pool;
+}
 
-        VkSwapchainKHR newSwapChain;
-        if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create swap chain!");
+// Splits [0, count) into contiguous ranges and calls func(worker, begin, end) for each of them concurrently.
+// Returns the number of workers actually used.
+template <typename Func>
+uint32_t parallelFor(size_t count, size_t minRangeSize, uint32_t workerCount, Func func) {
+    workerCount = static_cast<uint32_t>(std::min<size_t>(workerCount, std::max<size_t>(1, count / minRangeSize)));
+    const size_t rangeSize = (count + workerCount - 1) / workerCount;
+
+    // A nested call would wait for the pool from inside it, so it runs its ranges in order
+    if (WorkerPool::onWorkerThread()) {
+        for (uint32_t worker = 0; worker < workerCount; worker++) {
+            size_t begin = std::min(count, worker * rangeSize);
+            func(worker, begin, std::min(count, begin + rangeSize));
         }
+        return workerCount;
+    }
 
-        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-        swapChainImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+    // The calling thread takes the first range
+    workerPool().reserve(workerCount - 1);
+
+    std::mutex mutex;
+    std::condition_variable done;
+    uint32_t pending = workerCount - 1;
+    std::exception_ptr error;
+
+    for (uint32_t worker = 1; worker < workerCount; worker++) {
+        size_t begin = std::min(count, worker * rangeSize);
+        size_t end = std::min(count, begin + rangeSize);
+        workerPool().submit([&, worker, begin, end]() {
+            std::exception_ptr taskError;
+            try {
+                func(worker, begin, end);
+            } catch (...) {
+                taskError = std::current_exception();
+            }
 
-        swapChainImageFormat = surfaceFormat.format;
-        swapChainExtent = extent;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (taskError && !error) {
+                error = taskError;
+            }
+            if (--pending == 0) {
+                done.notify_one();
+            }
+        });
     }
 
-    void createImageViews() {
-        swapChainImageViews.resize(swapChainImages.size());
-
-        for (uint32_t i = 0; i < swapChainImages.size(); i++) {
-            swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    // The other ranges refer to this frame, so they are joined before anything is rethrown
+    try {
+        func(0u, size_t(0), std::min(count, rangeSize));
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = std::current_exception();
         }
     }
 
-    void createRenderPass() {
-        VkAttachmentDescription colorAttachment = {};
-        colorAttachment.format = swapChainImageFormat;
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&pending]() { return pending == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return workerCount;
+}
 
-        VkAttachmentDescription depthAttachment = {};
-        depthAttachment.format = findDepthFormat();
-        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+void runCpuCullingBenchmark() {
+    const size_t objectCount = 1 << 20;
+    const int iterations = 50;
 
-        VkAttachmentReference colorAttachmentRef = {};
-        colorAttachmentRef.attachment = 0;
-        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> size(0.25f, 2.0f);
 
-        VkAttachmentReference depthAttachmentRef = {};
-        depthAttachmentRef.attachment = 1;
-        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    ObjectBounds bounds;
+    bounds.resize(objectCount);
+    for (size_t i = 0; i < objectCount; i++) {
+        bounds.set(i, glm::vec3(position(random), position(random), position(random)), glm::vec3(size(random), size(random), size(random)));
+    }
 
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments = &colorAttachmentRef;
-        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+    glm::mat4 view = glm::lookAt(glm::vec3(5.0f, 5.0f, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), WIDTH / (float) HEIGHT, 1.0f, 50.0f);
+    glm::vec4 planes[6];
+    extractFrustumPlanes(proj * view, planes);
 
-        VkSubpassDependency dependency = {};
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.dstSubpass = 0;
-        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    std::vector<uint8_t> visible(objectCount);
+
+    // Start the pool threads before anything is timed
+    workerPool().reserve(workerThreadCount() - 1);
+
+    auto measure = [&](const char *label, uint32_t threadCount, auto kernel) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            parallelFor(objectCount, 4096, threadCount, [&](uint32_t, size_t begin, size_t end) {
+                kernel(planes, bounds, begin, end, visible.data());
+            });
+        }
+        auto currentTime = std::chrono::high_resolution_clock::now();
+
+        double seconds = std::chrono::duration<double>(currentTime - startTime).count();
+        double objectsPerSecond = objectCount * static_cast<double>(iterations) / seconds;
+        size_t visibleCount = std::count(visible.begin(), visible.end(), 1);
+        std::cout << label << ", threads: " << threadCount
+                  << ", objects/s: " << objectsPerSecond
+                  << ", objects/s/core: " << objectsPerSecond / threadCount
+                  << ", visible: " << visibleCount << "/" << objectCount << std::endl;
+    };
+
+    measure("scalar", 1, cullObjectBoundsScalar);
+#if defined(CULL_SIMD_AVX2) || defined(CULL_SIMD_SSE)
+    measure(cullObjectBoundsPath(), 1, cullObjectBoundsSimd);
+#endif
+    measure(cullObjectBoundsPath(), workerThreadCount(), cullObjectBounds);
+}
+
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    stbi_uc *pixels = nullptr;
+};
+
+struct UBORenderPass {
+    alignas(16) glm::mat4 mvpMat;
+    alignas(16) glm::mat4 mvMat;
+    alignas(16) glm::mat4 normMat;
+    alignas(16) glm::mat4 mvpMatLightSpace;
+    alignas(16) glm::vec3 lightPos;
+};
+
+struct UBOShadowMapPass {
+    alignas(16) glm::mat4 mvpMat;
+};
+
+// Read by all cube_shadow shaders; the range normalizes the stored distance to the light
+struct UBOCubeShadowPass {
+    alignas(16) glm::mat4 faceMats[6];
+    alignas(16) glm::vec4 lightPosRange;
+};
+
+struct InstanceData {
+    alignas(16) glm::mat4 modelMat;
+    alignas(16) glm::mat4 normMat;
+    alignas(16) uint32_t materialIndex;
+    uint32_t flags;
+};
+
+// Per-draw data of render.vert and shadow.vert with --push-constants. The normal matrix
+// is a mat3 in the shader, stored as three vec4 columns like in the std430 layout.
+struct DrawPushConstants {
+    glm::mat4 modelMat;
+    glm::vec4 normMat[3];
+    uint32_t materialIndex;
+};
+
+static_assert(sizeof(DrawPushConstants) <= 128, "push constants must fit into the 128 bytes every device supports");
+
+struct UBOCullPass {
+    alignas(16) glm::vec4 cameraPlanes[6];
+    alignas(16) glm::vec4 lightPlanes[MAX_SHADOW_LIGHTS][6];
+    alignas(16) glm::mat4 lightMat;
+    alignas(16) uint32_t objectCount;
+    uint32_t lightMask;
+};
+
+// cull.comp runs a receiver pass before the caster pass, like cullObjectsOnCpu
+enum CullPass : uint32_t {
+    CULL_PASS_RECEIVERS = 0,
+    CULL_PASS_CASTERS,
+};
+
+struct UBOClusterPass {
+    alignas(16) glm::mat4 invProjMat;
+    alignas(16) glm::uvec4 gridSize;
+    alignas(16) glm::vec4 screen;
+    alignas(16) glm::vec4 depthSlicing;
+    alignas(16) uint32_t lightCount;
+};
+
+// Camera-space position and radius, as read by cluster.comp and render.frag
+struct PointLight {
+    glm::vec4 posRadius;
+    glm::vec4 color;
+};
+
+// A point light circling around its center above the floor
+struct PointLightSource {
+    glm::vec3 center;
+    float orbitRadius;
+    float angularSpeed;
+    float phase;
+    float radius;
+    glm::vec3 color;
+};
+
+// A shadow casting light; light 0 is the key light at LIGHT_POS, the others are spot lights
+struct ShadowLight {
+    glm::mat4 mvpMat;
+    glm::vec3 position;
+    glm::vec3 target;
+    float coneRadius;   // of the lit disc around the target, for the tile size
+    glm::vec3 color;
+};
+
+// Per-light data of render.frag. The buffer starts with the light count, padded to 16 bytes.
+struct ShadowLightData {
+    alignas(16) glm::mat4 mvpMat;
+    alignas(16) glm::vec4 atlasRect;
+    alignas(16) glm::vec4 posCameraSpace;
+    alignas(16) glm::vec4 posWorldSpace;    // w: range of the cube shadow map, if any
+    alignas(16) glm::vec4 color;
+};
+
+const VkDeviceSize SHADOW_LIGHT_BUFFER_HEADER_SIZE = 16;
+
+struct CullObject {
+    alignas(16) glm::vec4 boundingSphere;
+    alignas(16) glm::vec4 aabbCenter;
+    alignas(16) glm::vec4 aabbExtent;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t flags;
+    uint32_t padding;
+};
+
+// Up to MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles of a mesh, with bounds
+// in the object space of the mesh. The meshlet faces away from every camera with
+// dot(normalize(coneApex - camera), coneAxis) >= coneCutoff, so a cutoff above 1 never culls.
+struct Meshlet {
+    glm::vec4 boundingSphere;
+    glm::vec4 coneApex;
+    glm::vec4 coneAxisCutoff;
+    uint32_t firstIndex;       // the triangles are contiguous in the index buffer
+    uint32_t triangleCount;
+    uint32_t firstVertex;      // into the meshlet vertex list of the mesh shader
+    uint32_t vertexCount;
+};
+
+// Read by meshlet_cull.comp and meshlet.task
+struct MeshletCullPushConstants {
+    glm::vec4 cameraPlanes[6];
+    glm::vec4 cameraPos;
+    uint32_t objectCount;
+};
+
+static_assert(sizeof(MeshletCullPushConstants) <= 128, "push constants must fit into the 128 bytes every device supports");
+
+// Visible meshlets and triangles, followed by the draws of meshlet_cull.comp
+const VkDeviceSize MESHLET_DRAW_BUFFER_HEADER_SIZE = 16;
+
+// Computes the bounding sphere and the normal cone of a meshlet, the latter as in meshoptimizer:
+// the cone apex is moved back along the axis until every triangle's plane is in front of it.
+void computeMeshletBounds(Meshlet &meshlet, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, const std::vector<uint32_t> &meshletVertices) {
+    glm::vec3 minPos(std::numeric_limits<float>::max());
+    glm::vec3 maxPos(std::numeric_limits<float>::lowest());
+    for (uint32_t v = meshlet.firstVertex; v < meshlet.firstVertex + meshlet.vertexCount; v++) {
+        minPos = glm::min(minPos, vertices[meshletVertices[v]].pos);
+        maxPos = glm::max(maxPos, vertices[meshletVertices[v]].pos);
+    }
+
+    glm::vec3 center = 0.5f * (minPos + maxPos);
+    float radius = 0.0f;
+    for (uint32_t v = meshlet.firstVertex; v < meshlet.firstVertex + meshlet.vertexCount; v++) {
+        radius = std::max(radius, glm::length(vertices[meshletVertices[v]].pos - center));
+    }
+    meshlet.boundingSphere = glm::vec4(center, radius);
+
+    // Degenerate triangles are never rasterized, so they do not widen the cone
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> corners;
+    glm::vec3 normalSum(0.0f);
+    for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + 3 * meshlet.triangleCount; i += 3) {
+        const glm::vec3 &p0 = vertices[indices[i]].pos;
+        glm::vec3 normal = glm::cross(vertices[indices[i + 1]].pos - p0, vertices[indices[i + 2]].pos - p0);
+        float area = glm::length(normal);
+        if (area > 0.0f) {
+            normals.push_back(normal / area);
+            corners.push_back(p0);
+            normalSum += normal / area;
+        }
+    }
+
+    meshlet.coneApex = glm::vec4(center, 0.0f);
+    meshlet.coneAxisCutoff = glm::vec4(0.0f, 0.0f, 1.0f, 2.0f);
+    if (normals.empty() || glm::length(normalSum) == 0.0f) {
+        return;
+    }
+
+    glm::vec3 axis = glm::normalize(normalSum);
+    float minDot = 1.0f;
+    for (const glm::vec3 &normal : normals) {
+        minDot = std::min(minDot, glm::dot(axis, normal));
+    }
+
+    // Normals spread over almost a hemisphere leave no direction that they all face away from
+    if (minDot <= 0.1f) {
+        return;
+    }
+
+    float maxDistance = 0.0f;
+    for (size_t t = 0; t < normals.size(); t++) {
+        maxDistance = std::max(maxDistance, glm::dot(center - corners[t], normals[t]) / glm::dot(axis, normals[t]));
+    }
+
+    meshlet.coneApex = glm::vec4(center - axis * maxDistance, 0.0f);
+    meshlet.coneAxisCutoff = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+}
+
+// Splits the triangles in indices[firstIndex, firstIndex + indexCount) into meshlets. Each meshlet
+// grows by the neighbouring triangle that adds the fewest vertices; without a neighbour that fits,
+// it continues with the next triangle in index order, which is usually close by in OBJ files.
+// The triangles are reordered in place so that every meshlet is a contiguous index range. The
+// meshlet vertex lists are appended to meshletVertices, and every triangle's three local vertex
+// indices are packed into meshletTriangles at the triangle's position in the index buffer / 3.
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, uint32_t firstIndex, uint32_t indexCount,
+                                   std::vector<uint32_t> &meshletVertices, std::vector<uint32_t> &meshletTriangles) {
+    const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+    const uint32_t triangleCount = indexCount / 3;
+    const std::vector<uint32_t> triangles(indices.begin() + firstIndex, indices.begin() + firstIndex + indexCount);
+
+    // Triangles around every vertex
+    std::vector<uint32_t> adjacencyOffsets(vertices.size() + 1, 0);
+    for (uint32_t index : triangles) {
+        adjacencyOffsets[index + 1]++;
+    }
+    for (size_t v = 0; v < vertices.size(); v++) {
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    }
+    std::vector<uint32_t> adjacency(triangles.size());
+    std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            adjacency[adjacencyFill[triangles[3 * t + corner]]++] = t;
+        }
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> localVertex(vertices.size(), NONE);
+    auto newVertexCount = [&](uint32_t t) {
+        uint32_t count = 0;
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            count += localVertex[triangles[3 * t + corner]] == NONE ? 1 : 0;
+        }
+        return count;
+    };
+
+    std::vector<Meshlet> meshlets;
+    uint32_t written = 0;
+    uint32_t seed = 0;
+    while (written < triangleCount) {
+        Meshlet meshlet = {};
+        meshlet.firstIndex = firstIndex + 3 * written;
+        meshlet.firstVertex = static_cast<uint32_t>(meshletVertices.size());
+
+        while (emitted[seed]) {
+            seed++;
+        }
+
+        uint32_t next = seed;
+        while (next != NONE) {
+            emitted[next] = true;
+            uint32_t packed = 0;
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                uint32_t vertex = triangles[3 * next + corner];
+                if (localVertex[vertex] == NONE) {
+                    localVertex[vertex] = meshlet.vertexCount++;
+                    meshletVertices.push_back(vertex);
+                }
+                packed |= localVertex[vertex] << (8 * corner);
+                indices[firstIndex + 3 * written + corner] = vertex;
+            }
+            meshletTriangles[firstIndex / 3 + written] = packed;
+            written++;
+
+            if (++meshlet.triangleCount == MESHLET_MAX_TRIANGLES) {
+                break;
+            }
+
+            next = NONE;
+            uint32_t bestNewVertices = 3;
+            for (uint32_t v = meshlet.firstVertex; v < meshlet.firstVertex + meshlet.vertexCount; v++) {
+                uint32_t vertex = meshletVertices[v];
+                for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+                    uint32_t t = adjacency[a];
+                    uint32_t newVertices = emitted[t] ? 3 : newVertexCount(t);
+                    if (newVertices < bestNewVertices && meshlet.vertexCount + newVertices <= MESHLET_MAX_VERTICES) {
+                        next = t;
+                        bestNewVertices = newVertices;
+                    }
+                }
+            }
+
+            if (next == NONE && meshlet.vertexCount + 3 <= MESHLET_MAX_VERTICES) {
+                while (seed < triangleCount && emitted[seed]) {
+                    seed++;
+                }
+                next = seed < triangleCount ? seed : NONE;
+            }
+        }
+
+        for (uint32_t v = meshlet.firstVertex; v < meshlet.firstVertex + meshlet.vertexCount; v++) {
+            localVertex[meshletVertices[v]] = NONE;
+        }
+
+        computeMeshletBounds(meshlet, vertices, indices, meshletVertices);
+        meshlets.push_back(meshlet);
+    }
+
+    return meshlets;
+}
+
+struct SimplifiedLod {
+    std::vector<uint32_t> indices;
+    float error;
+};
+
+// Builds up to levelCount - 1 coarser levels of a triangle list, each with about half the
+// triangles of the previous one. Edges are collapsed in the order of their quadric error
+// (Garland and Heckbert) onto one of their two vertices, so that every level indexes the original
+// vertex buffer. Vertices on open borders, on non-manifold edges and on attribute seams, where
+// several vertices share a position, are never moved. Stops early when the locked vertices keep
+// a level from getting much simpler.
+std::vector<SimplifiedLod> simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &meshIndices, uint32_t levelCount) {
+    std::vector<uint32_t> triangles = meshIndices;
+    const uint32_t triangleCount = static_cast<uint32_t>(triangles.size() / 3);
+
+    // Triangles around every vertex; collapses only ever add to the lists
+    std::vector<std::vector<uint32_t>> vertexTriangles(vertices.size());
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            vertexTriangles[triangles[3 * t + corner]].push_back(t);
+        }
+    }
+
+    std::vector<bool> locked(vertices.size(), false);
+    std::unordered_map<glm::vec3, uint32_t> positionVertices;
+    for (uint32_t index : meshIndices) {
+        auto inserted = positionVertices.emplace(vertices[index].pos, index);
+        if (!inserted.second && inserted.first->second != index) {
+            locked[index] = true;
+            locked[inserted.first->second] = true;
+        }
+    }
+
+    auto edgeKey = [](uint32_t a, uint32_t b) {
+        return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+    };
+    std::unordered_map<uint64_t, uint32_t> edgeTriangleCounts;
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            edgeTriangleCounts[edgeKey(triangles[3 * t + corner], triangles[3 * t + (corner + 1) % 3])]++;
+        }
+    }
+    for (const auto &edge : edgeTriangleCounts) {
+        if (edge.second != 2) {
+            locked[edge.first >> 32] = true;
+            locked[edge.first & 0xffffffffu] = true;
+        }
+    }
+
+    // The quadric of a vertex sums the squared distances to the planes of its triangles
+    std::vector<glm::dmat4> quadrics(vertices.size(), glm::dmat4(0.0));
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        glm::dvec3 p0(vertices[triangles[3 * t + 0]].pos);
+        glm::dvec3 p1(vertices[triangles[3 * t + 1]].pos);
+        glm::dvec3 p2(vertices[triangles[3 * t + 2]].pos);
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        if (length == 0.0) {
+            continue;
+        }
+
+        normal /= length;
+        glm::dvec4 plane(normal, -glm::dot(normal, p0));
+        glm::dmat4 quadric = glm::outerProduct(plane, plane);
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            quadrics[triangles[3 * t + corner]] += quadric;
+        }
+    }
+
+    auto collapseError = [&](uint32_t from, uint32_t to) {
+        glm::dvec4 p(glm::dvec3(vertices[to].pos), 1.0);
+        return std::max(0.0, glm::dot(p, (quadrics[from] + quadrics[to]) * p));
+    };
+
+    // Candidates are invalidated lazily: a collapse bumps the versions of both of its vertices
+    struct Collapse {
+        double error;
+        uint32_t from, to;
+        uint32_t fromVersion, toVersion;
+    };
+    auto greater = [](const Collapse &a, const Collapse &b) {
+        return a.error > b.error;
+    };
+    std::priority_queue<Collapse, std::vector<Collapse>, decltype(greater)> queue(greater);
+    std::vector<uint32_t> versions(vertices.size(), 0);
+    std::vector<bool> removed(triangleCount, false);
+
+    auto pushEdge = [&](uint32_t a, uint32_t b) {
+        if (!locked[a]) {
+            queue.push({ collapseError(a, b), a, b, versions[a], versions[b] });
+        }
+        if (!locked[b]) {
+            queue.push({ collapseError(b, a), b, a, versions[b], versions[a] });
+        }
+    };
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        for (uint32_t corner = 0; corner < 3; corner++) {
+            pushEdge(triangles[3 * t + corner], triangles[3 * t + (corner + 1) % 3]);
+        }
+    }
+
+    auto containsVertex = [&](uint32_t t, uint32_t vertex) {
+        return triangles[3 * t] == vertex || triangles[3 * t + 1] == vertex || triangles[3 * t + 2] == vertex;
+    };
+
+    // Moving the vertex must not flip any of its triangles that stay
+    auto flipsTriangle = [&](uint32_t from, uint32_t to) {
+        for (uint32_t t : vertexTriangles[from]) {
+            if (removed[t] || containsVertex(t, to)) {
+                continue;
+            }
+
+            glm::vec3 p[3], q[3];
+            for (uint32_t corner = 0; corner < 3; corner++) {
+                p[corner] = vertices[triangles[3 * t + corner]].pos;
+                q[corner] = triangles[3 * t + corner] == from ? vertices[to].pos : p[corner];
+            }
+            if (glm::dot(glm::cross(p[1] - p[0], p[2] - p[0]), glm::cross(q[1] - q[0], q[2] - q[0])) <= 0.0f) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // The vertices next to both ends must be the tips of the triangles on the edge, otherwise
+    // the collapse would fold two surfaces together
+    auto keepsManifold = [&](uint32_t from, uint32_t to) {
+        std::vector<uint32_t> fromNeighbours, toNeighbours;
+        uint32_t sharedTriangles = 0;
+        for (uint32_t t : vertexTriangles[from]) {
+            if (!removed[t]) {
+                fromNeighbours.insert(fromNeighbours.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+                sharedTriangles += containsVertex(t, to) ? 1 : 0;
+            }
+        }
+        for (uint32_t t : vertexTriangles[to]) {
+            if (!removed[t]) {
+                toNeighbours.insert(toNeighbours.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+            }
+        }
+        for (auto *neighbours : { &fromNeighbours, &toNeighbours }) {
+            std::sort(neighbours->begin(), neighbours->end());
+            neighbours->erase(std::unique(neighbours->begin(), neighbours->end()), neighbours->end());
+        }
+
+        std::vector<uint32_t> common;
+        std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(), toNeighbours.begin(), toNeighbours.end(), std::back_inserter(common));
+        // Both ends are in both lists
+        return common.size() == sharedTriangles + 2;
+    };
+
+    uint32_t liveTriangles = triangleCount;
+    double maxError = 0.0;
+
+    std::vector<SimplifiedLod> lods;
+    for (uint32_t level = 1; level < levelCount; level++) {
+        const uint32_t previousTriangles = liveTriangles;
+        while (liveTriangles > previousTriangles / 2 && !queue.empty()) {
+            Collapse collapse = queue.top();
+            queue.pop();
+            if (collapse.fromVersion != versions[collapse.from] || collapse.toVersion != versions[collapse.to]) {
+                continue;
+            }
+            if (flipsTriangle(collapse.from, collapse.to) || !keepsManifold(collapse.from, collapse.to)) {
+                continue;
+            }
+
+            for (uint32_t t : vertexTriangles[collapse.from]) {
+                if (removed[t]) {
+                    continue;
+                }
+                if (containsVertex(t, collapse.to)) {
+                    removed[t] = true;
+                    liveTriangles--;
+                    continue;
+                }
+                for (uint32_t corner = 0; corner < 3; corner++) {
+                    if (triangles[3 * t + corner] == collapse.from) {
+                        triangles[3 * t + corner] = collapse.to;
+                    }
+                }
+                vertexTriangles[collapse.to].push_back(t);
+            }
+            vertexTriangles[collapse.from].clear();
+
+            quadrics[collapse.to] += quadrics[collapse.from];
+            versions[collapse.from]++;
+            versions[collapse.to]++;
+            maxError = std::max(maxError, collapse.error);
+
+            for (uint32_t t : vertexTriangles[collapse.to]) {
+                if (!removed[t]) {
+                    for (uint32_t corner = 0; corner < 3; corner++) {
+                        if (triangles[3 * t + corner] != collapse.to) {
+                            pushEdge(collapse.to, triangles[3 * t + corner]);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (4 * static_cast<uint64_t>(liveTriangles) > 3 * static_cast<uint64_t>(previousTriangles)) {
+            break;
+        }
+
+        SimplifiedLod lod;
+        lod.error = static_cast<float>(std::sqrt(maxError));
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            if (!removed[t]) {
+                lod.indices.insert(lod.indices.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+            }
+        }
+        lods.push_back(std::move(lod));
+    }
+
+    return lods;
+}
+
+// Screen pixels covered by a unit length at the point of the sphere nearest to the camera, in the
+// clip space of mvpMat and a viewport of width x height. Infinite when the sphere reaches the camera,
+// and zero when it lies entirely behind it.
+float projectedPixelsPerUnit(const glm::mat4 &mvpMat, const glm::vec3 &center, float radius, float width, float height) {
+    // glm matrices are indexed [column][row]
+    glm::vec4 rowX(mvpMat[0][0], mvpMat[1][0], mvpMat[2][0], mvpMat[3][0]);
+    glm::vec4 rowY(mvpMat[0][1], mvpMat[1][1], mvpMat[2][1], mvpMat[3][1]);
+    glm::vec4 rowW(mvpMat[0][3], mvpMat[1][3], mvpMat[2][3], mvpMat[3][3]);
+
+    float centerW = glm::dot(rowW, glm::vec4(center, 1.0f));
+    float radiusW = radius * glm::length(glm::vec3(rowW));
+    if (centerW + radiusW <= 0.0f) {
+        return 0.0f;
+    }
+
+    float w = centerW - radiusW;
+    if (w <= std::numeric_limits<float>::epsilon()) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return 0.5f * std::max(width * glm::length(glm::vec3(rowX)), height * glm::length(glm::vec3(rowY))) / w;
+}
+
+// The coarsest level whose error covers at most maxErrorPixels
+uint32_t selectLod(const MeshRange &mesh, float pixelsPerUnit, float maxErrorPixels) {
+    uint32_t lod = 0;
+    while (lod + 1 < mesh.lodCount && mesh.lods[lod + 1].error * pixelsPerUnit <= maxErrorPixels) {
+        lod++;
+    }
+    return lod;
+}
+
+// Source data of vkUpdateDescriptorSetWithTemplate for the render pass descriptor set
+struct RenderDescriptorData {
+    VkDescriptorBufferInfo uniformBuffer;
+    VkDescriptorImageInfo texture;
+    VkDescriptorImageInfo shadowMap;
+    VkDescriptorBufferInfo instanceBuffer;
+    VkDescriptorBufferInfo clusterUniformBuffer;
+    VkDescriptorBufferInfo pointLightBuffer;
+    VkDescriptorBufferInfo clusterLightBuffer;
+    VkDescriptorBufferInfo shadowLightBuffer;
+    VkDescriptorImageInfo cubeShadowMap;
+};
+
+// Every binding of the render pass descriptor set and the RenderDescriptorData member that holds
+// it. The update template and the vkUpdateDescriptorSets benchmark are both built from this table.
+constexpr std::array<VkDescriptorUpdateTemplateEntry, 9> RENDER_DESCRIPTOR_ENTRIES = {{
+    { 0, 0, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, offsetof(RenderDescriptorData, uniformBuffer), 0 },
+    { 1, 0, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, offsetof(RenderDescriptorData, texture), 0 },
+    { 2, 0, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, offsetof(RenderDescriptorData, shadowMap), 0 },
+    { 3, 0, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, offsetof(RenderDescriptorData, instanceBuffer), 0 },
+    { 4, 0, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, offsetof(RenderDescriptorData, clusterUniformBuffer), 0 },
+    { 5, 0, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, offsetof(RenderDescriptorData, pointLightBuffer), 0 },
+    { 6, 0, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, offsetof(RenderDescriptorData, clusterLightBuffer), 0 },
+    { 7, 0, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, offsetof(RenderDescriptorData, shadowLightBuffer), 0 },
+    { 8, 0, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, offsetof(RenderDescriptorData, cubeShadowMap), 0 },
+}};
+
+constexpr bool isImageDescriptor(VkDescriptorType type) {
+    return type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+}
+
+constexpr size_t renderDescriptorEntriesSize() {
+    size_t size = 0;
+    for (const auto &entry : RENDER_DESCRIPTOR_ENTRIES) {
+        size += isImageDescriptor(entry.descriptorType) ? sizeof(VkDescriptorImageInfo) : sizeof(VkDescriptorBufferInfo);
+    }
+    return size;
+}
+
+static_assert(renderDescriptorEntriesSize() == sizeof(RenderDescriptorData), "every RenderDescriptorData member needs an entry in RENDER_DESCRIPTOR_ENTRIES");
+
+const VkQueryPipelineStatisticFlags PIPELINE_STATISTICS_FLAGS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+struct FrameCommands {
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    VkCommandBuffer shadowMapCommandBuffer;
+    VkCommandBuffer cullCommandBuffer;
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    std::array<bool, GPU_PASS_COUNT> passTimestampsWritten = {};
+    VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+    std::array<bool, GPU_PASS_COUNT> passStatisticsWritten = {};
+};
+
+struct RecordWorker {
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    VkCommandBuffer shadowMapCommandBuffer;
+};
+
+struct CullWorkerOutput {
+    std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+    std::array<std::vector<VkDrawIndexedIndirectCommand>, MAX_SHADOW_LIGHTS> shadowDrawCommands;
+    uint64_t shadowTriangleCount = 0;
+    glm::vec3 receiverMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 receiverMax = glm::vec3(std::numeric_limits<float>::lowest());
+};
+
+struct DeferredRelease {
+    uint64_t timelineValue;
+    std::function<void()> release;
+};
+
+// Reports GLSL files in a directory that were written or moved into place (editors often save by rename)
+class ShaderWatcher {
+public:
+    explicit ShaderWatcher(const std::string &directory) {
+#ifdef __linux__
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("failed to watch shader directory: " + directory);
+        }
+        if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(fd);
+            throw std::runtime_error("failed to watch shader directory: " + directory);
+        }
+#else
+        throw std::runtime_error("shader hot reload requires inotify (Linux)");
+#endif
+    }
+
+    ~ShaderWatcher() {
+#ifdef __linux__
+        close(fd);
+#endif
+    }
+
+    ShaderWatcher(const ShaderWatcher&) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher&) = delete;
+
+    // Non-blocking; returns the names of the shader sources changed since the last call
+    std::set<std::string> poll() {
+        std::set<std::string> changed;
+#ifdef __linux__
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char *ptr = buffer; ptr < buffer + length; ptr += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(ptr)->len) {
+                const inotify_event *event = reinterpret_cast<inotify_event*>(ptr);
+                std::string name = event->len > 0 ? event->name : "";
+                size_t extension = name.rfind('.');
+                if (extension == std::string::npos) {
+                    continue;
+                }
+
+                std::string suffix = name.substr(extension);
+                if (suffix == ".vert" || suffix == ".frag" || suffix == ".task" || suffix == ".mesh" || suffix == ".comp") {
+                    changed.insert(name);
+                }
+            }
+        }
+#endif
+        return changed;
+    }
+
+private:
+    int fd = -1;
+};
+
+// Runs a shell command and returns its exit status; what it prints to stdout and stderr is
+// appended to output (glslangValidator reports compile errors on stdout)
+int runCommand(const std::string &command, std::string &output) {
+#ifdef _WIN32
+    FILE *pipe = _popen((command + " 2>&1").c_str(), "r");
+#else
+    FILE *pipe = popen((command + " 2>&1").c_str(), "r");
+#endif
+    if (pipe == nullptr) {
+        return -1;
+    }
+
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+        output += buffer;
+    }
+#ifdef _WIN32
+    return _pclose(pipe);
+#else
+    return pclose(pipe);
+#endif
+}
+
+struct ShaderReloadResult {
+    std::map<std::string, std::vector<uint32_t>> shaderCode;
+    VkPipeline graphicsPipeline = VK_NULL_HANDLE;
+    VkPipeline shadowMapGraphicsPipeline = VK_NULL_HANDLE;
+    VkPipeline depthPrepassPipeline = VK_NULL_HANDLE;
+    VkPipeline meshShaderPipeline = VK_NULL_HANDLE;
+    VkPipeline cullPipeline = VK_NULL_HANDLE;
+    VkPipeline clusterPipeline = VK_NULL_HANDLE;
+    VkPipeline meshletCullPipeline = VK_NULL_HANDLE;
+    std::string error;
+};
+
+// Minimal SPIR-V reflection: only what is needed to derive descriptor set layouts
+struct ReflectedBinding {
+    uint32_t set;
+    VkDescriptorSetLayoutBinding binding;
+};
+
+std::vector<ReflectedBinding> reflectDescriptorBindings(const uint32_t *code, size_t size, VkShaderStageFlags stage) {
+    const size_t wordCount = size / sizeof(uint32_t);
+    if (wordCount < 5 || code[0] != 0x07230203u) {
+        throw std::runtime_error("invalid SPIR-V module");
+    }
+
+    enum : uint32_t {
+        OP_TYPE_IMAGE = 25, OP_TYPE_SAMPLER = 26, OP_TYPE_SAMPLED_IMAGE = 27, OP_TYPE_ARRAY = 28,
+        OP_TYPE_RUNTIME_ARRAY = 29, OP_TYPE_STRUCT = 30, OP_TYPE_POINTER = 32, OP_CONSTANT = 43,
+        OP_VARIABLE = 59, OP_DECORATE = 71,
+        DECORATION_BLOCK = 2, DECORATION_BUFFER_BLOCK = 3, DECORATION_BINDING = 33, DECORATION_DESCRIPTOR_SET = 34,
+        STORAGE_UNIFORM_CONSTANT = 0, STORAGE_UNIFORM = 2, STORAGE_STORAGE_BUFFER = 12,
+        DIM_BUFFER = 5, DIM_SUBPASS_DATA = 6
+    };
+
+    struct Id {
+        uint32_t opcode = 0;
+        uint32_t typeId = 0;        // pointee, element or result type
+        uint32_t storageClass = 0;
+        uint32_t value = 0;         // constant value, array length id, image dim
+        uint32_t sampled = 0;       // OpTypeImage "Sampled" operand
+        bool hasBinding = false;
+        uint32_t binding = 0;
+        uint32_t set = 0;
+        bool block = false;
+        bool bufferBlock = false;
+    };
+    std::vector<Id> ids(code[3]);
+
+    std::vector<uint32_t> variables;
+    for (size_t offset = 5; offset < wordCount;) {
+        const uint32_t opcode = code[offset] & 0xffffu;
+        const uint32_t length = code[offset] >> 16;
+        if (length == 0 || offset + length > wordCount) {
+            throw std::runtime_error("malformed SPIR-V instruction");
+        }
+        const uint32_t *operands = code + offset + 1;
+
+        switch (opcode) {
+        case OP_DECORATE:
+            if (operands[1] == DECORATION_BINDING) {
+                ids[operands[0]].hasBinding = true;
+                ids[operands[0]].binding = operands[2];
+            } else if (operands[1] == DECORATION_DESCRIPTOR_SET) {
+                ids[operands[0]].set = operands[2];
+            } else if (operands[1] == DECORATION_BLOCK) {
+                ids[operands[0]].block = true;
+            } else if (operands[1] == DECORATION_BUFFER_BLOCK) {
+                ids[operands[0]].bufferBlock = true;
+            }
+            break;
+        case OP_TYPE_IMAGE:
+            ids[operands[0]].opcode = opcode;
+            ids[operands[0]].value = operands[2];
+            ids[operands[0]].sampled = operands[6];
+            break;
+        case OP_TYPE_SAMPLER:
+        case OP_TYPE_SAMPLED_IMAGE:
+        case OP_TYPE_STRUCT:
+            ids[operands[0]].opcode = opcode;
+            break;
+        case OP_TYPE_ARRAY:
+            ids[operands[0]].opcode = opcode;
+            ids[operands[0]].typeId = operands[1];
+            ids[operands[0]].value = operands[2];
+            break;
+        case OP_TYPE_RUNTIME_ARRAY:
+            ids[operands[0]].opcode = opcode;
+            ids[operands[0]].typeId = operands[1];
+            break;
+        case OP_TYPE_POINTER:
+            ids[operands[0]].opcode = opcode;
+            ids[operands[0]].storageClass = operands[1];
+            ids[operands[0]].typeId = operands[2];
+            break;
+        case OP_CONSTANT:
+            ids[operands[1]].opcode = opcode;
+            ids[operands[1]].value = operands[2];
+            break;
+        case OP_VARIABLE:
+            ids[operands[1]].opcode = opcode;
+            ids[operands[1]].typeId = operands[0];
+            ids[operands[1]].storageClass = operands[2];
+            variables.push_back(operands[1]);
+            break;
+        }
+        offset += length;
+    }
+
+    std::vector<ReflectedBinding> bindings;
+    for (uint32_t variableId : variables) {
+        const Id &variable = ids[variableId];
+        if (!variable.hasBinding ||
+            (variable.storageClass != STORAGE_UNIFORM_CONSTANT && variable.storageClass != STORAGE_UNIFORM && variable.storageClass != STORAGE_STORAGE_BUFFER)) {
+            continue;
+        }
+
+        uint32_t typeId = ids[variable.typeId].typeId;
+        uint32_t descriptorCount = 1;
+        while (ids[typeId].opcode == OP_TYPE_ARRAY || ids[typeId].opcode == OP_TYPE_RUNTIME_ARRAY) {
+            // Runtime arrays of descriptors are not used here; reflect them as a single descriptor
+            if (ids[typeId].opcode == OP_TYPE_ARRAY) {
+                descriptorCount *= ids[ids[typeId].value].value;
+            }
+            typeId = ids[typeId].typeId;
+        }
+
+        const Id &type = ids[typeId];
+        VkDescriptorType descriptorType;
+        if (type.opcode == OP_TYPE_SAMPLED_IMAGE) {
+            descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        } else if (type.opcode == OP_TYPE_SAMPLER) {
+            descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+        } else if (type.opcode == OP_TYPE_IMAGE && type.value == DIM_SUBPASS_DATA) {
+            descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+        } else if (type.opcode == OP_TYPE_IMAGE && type.value == DIM_BUFFER) {
+            descriptorType = type.sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+        } else if (type.opcode == OP_TYPE_IMAGE) {
+            descriptorType = type.sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        } else if (type.opcode == OP_TYPE_STRUCT && (variable.storageClass == STORAGE_STORAGE_BUFFER || type.bufferBlock)) {
+            descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        } else if (type.opcode == OP_TYPE_STRUCT && type.block) {
+            descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        } else {
+            throw std::runtime_error("unsupported descriptor type in SPIR-V module");
+        }
+
+        ReflectedBinding reflected = {};
+        reflected.set = variable.set;
+        reflected.binding.binding = variable.binding;
+        reflected.binding.descriptorType = descriptorType;
+        reflected.binding.descriptorCount = descriptorCount;
+        reflected.binding.stageFlags = stage;
+        bindings.push_back(reflected);
+    }
+
+    return bindings;
+}
+
+// Merges the bindings of several stages into one set, sorted by binding number
+std::vector<VkDescriptorSetLayoutBinding> mergeDescriptorBindings(const std::vector<ReflectedBinding> &reflected, uint32_t set) {
+    std::map<uint32_t, VkDescriptorSetLayoutBinding> merged;
+    for (const auto &entry : reflected) {
+        if (entry.set != set) {
+            continue;
+        }
+
+        auto existing = merged.find(entry.binding.binding);
+        if (existing == merged.end()) {
+            merged[entry.binding.binding] = entry.binding;
+        } else if (existing->second.descriptorType != entry.binding.descriptorType || existing->second.descriptorCount != entry.binding.descriptorCount) {
+            throw std::runtime_error("shader stages disagree on binding " + std::to_string(entry.binding.binding));
+        } else {
+            existing->second.stageFlags |= entry.binding.stageFlags;
+        }
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    for (const auto &entry : merged) {
+        bindings.push_back(entry.second);
+    }
+    return bindings;
+}
+
+// Exact pool sizes for setCount sets of the given layout
+std::vector<VkDescriptorPoolSize> descriptorPoolSizes(const std::vector<VkDescriptorSetLayoutBinding> &bindings, uint32_t setCount) {
+    std::map<VkDescriptorType, uint32_t> counts;
+    for (const auto &binding : bindings) {
+        counts[binding.descriptorType] += binding.descriptorCount * setCount;
+    }
+
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (const auto &count : counts) {
+        poolSizes.push_back({ count.first, count.second });
+    }
+    return poolSizes;
+}
+
+// Deduplicates descriptor set layouts by their bindings, so identical layouts are shared between pipelines
+class DescriptorSetLayoutCache {
+public:
+    VkDescriptorSetLayout get(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding> &bindings) {
+        requestCount++;
+
+        size_t hash = bindings.size();
+        for (const auto &binding : bindings) {
+            hash = hash * 31 + binding.binding;
+            hash = hash * 31 + binding.descriptorType;
+            hash = hash * 31 + binding.descriptorCount;
+            hash = hash * 31 + binding.stageFlags;
+        }
+
+        auto range = layouts.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (sameBindings(it->second.bindings, bindings)) {
+                return it->second.layout;
+            }
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        VkDescriptorSetLayout layout;
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor set layout!");
+        }
+
+        layouts.insert({ hash, { bindings, layout } });
+        return layout;
+    }
+
+    void destroy(VkDevice device) {
+        for (const auto &entry : layouts) {
+            vkDestroyDescriptorSetLayout(device, entry.second.layout, nullptr);
+        }
+        layouts.clear();
+    }
+
+    size_t layoutCount() const {
+        return layouts.size();
+    }
+
+    size_t requests() const {
+        return requestCount;
+    }
+
+private:
+    struct Entry {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        VkDescriptorSetLayout layout;
+    };
+
+    static bool sameBindings(const std::vector<VkDescriptorSetLayoutBinding> &a, const std::vector<VkDescriptorSetLayoutBinding> &b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].binding != b[i].binding || a[i].descriptorType != b[i].descriptorType ||
+                a[i].descriptorCount != b[i].descriptorCount || a[i].stageFlags != b[i].stageFlags) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::unordered_multimap<size_t, Entry> layouts;
+    size_t requestCount = 0;
+};
+
+// Hands out descriptor sets from a chain of pools sized for one layout; sets of a layout whose
+// bindings are a subset fit as well. When the current pool is exhausted the next one is taken
+// from the free list, or created with twice as many sets.
+// Sets are never freed individually; reset() recycles every pool at once.
+class DescriptorAllocator {
+public:
+    void init(const std::vector<VkDescriptorSetLayoutBinding> &layoutBindings, uint32_t initialSetsPerPool) {
+        bindings = layoutBindings;
+        setsPerPool = initialSetsPerPool;
+    }
+
+    VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout) {
+        if (currentPool == VK_NULL_HANDLE) {
+            currentPool = takePool(device);
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = currentPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &layout;
+
+        VkDescriptorSet descriptorSet;
+        VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+        if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+            currentPool = takePool(device);
+            allocInfo.descriptorPool = currentPool;
+            result = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+        }
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor set!");
+        }
+        return descriptorSet;
+    }
+
+    // The GPU must be done with every set allocated since the last reset
+    void reset(VkDevice device) {
+        for (VkDescriptorPool pool : usedPools) {
+            vkResetDescriptorPool(device, pool, 0);
+            freePools.push_back(pool);
+        }
+        usedPools.clear();
+        currentPool = VK_NULL_HANDLE;
+    }
+
+    void destroy(VkDevice device) {
+        reset(device);
+        for (VkDescriptorPool pool : freePools) {
+            vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+        freePools.clear();
+    }
+
+    size_t poolCount() const {
+        return usedPools.size() + freePools.size();
+    }
+
+private:
+    VkDescriptorPool takePool(VkDevice device) {
+        VkDescriptorPool pool;
+        if (!freePools.empty()) {
+            pool = freePools.back();
+            freePools.pop_back();
+        } else {
+            auto poolSizes = descriptorPoolSizes(bindings, setsPerPool);
+
+            VkDescriptorPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+            poolInfo.pPoolSizes = poolSizes.data();
+            poolInfo.maxSets = setsPerPool;
+
+            if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create descriptor pool!");
+            }
+            setsPerPool = std::min(2 * setsPerPool, MAX_SETS_PER_POOL);
+        }
+
+        usedPools.push_back(pool);
+        return pool;
+    }
+
+    static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    uint32_t setsPerPool = 1;
+    VkDescriptorPool currentPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorPool> usedPools;
+    std::vector<VkDescriptorPool> freePools;
+};
+
+class HelloTriangleApplication {
+public:
+    explicit HelloTriangleApplication(const AppOptions &options)
+        : options(options) {
+    }
+
+    void run() {
+        startupTime = std::chrono::high_resolution_clock::now();
+
+#ifdef ENABLE_CPU_PROFILER
+        // Starting before initVulkan so that initialization and loading show up in the trace
+        if (!options.tracePath.empty()) {
+            activeTracePath = options.tracePath;
+            traceFramesRemaining = options.traceFrameCount;
+        }
+#endif
+
+        initWindow();
+        initVulkan();
+        if (options.benchmarkInstancing) {
+            runInstancingBenchmark();
+        } else if (options.benchmarkRecording) {
+            runRecordingBenchmark();
+        } else if (options.benchmarkDescriptors) {
+            runDescriptorBenchmark();
+        } else if (options.benchmarkDrawData) {
+            runDrawDataBenchmark();
+        } else if (options.benchmarkMsaa) {
+            runMsaaBenchmark();
+        } else if (options.benchmarkLights) {
+            runLightBenchmark();
+        } else if (options.benchmarkCubeShadows) {
+            runCubeShadowBenchmark();
+        } else if (options.benchmarkMeshlets) {
+            runMeshletBenchmark();
+        } else if (options.benchmarkLods) {
+            runLodBenchmark();
+        } else {
+            mainLoop();
+        }
+        cleanup();
+    }
+
+private:
+    AppOptions options;
+
+    GLFWwindow* window;
+
+    VkInstance instance;
+    VkDebugUtilsMessengerEXT debugMessenger;
+    VkSurfaceKHR surface;
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device;
+
+    VkQueue graphicsQueue;
+    VkQueue presentQueue;
+
+    VkSwapchainKHR swapChain;
+    std::vector<VkImage> swapChainImages;
+    VkFormat swapChainImageFormat;
+    VkExtent2D swapChainExtent;
+    std::vector<VkImageView> swapChainImageViews;
+    std::vector<VkFramebuffer> swapChainFramebuffers;
+
+    VkRenderPass renderPass;
+    DescriptorSetLayoutCache descriptorSetLayoutCache;
+    std::vector<VkDescriptorSetLayoutBinding> descriptorBindings;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorUpdateTemplate descriptorUpdateTemplate;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline graphicsPipeline;
+
+    VkFormat shadowMapColorFormat;
+    VkFormat shadowMapDepthFormat;
+    VkImage shadowMapColorImage;
+    VkImage shadowMapDepthImage;
+    VkDeviceMemory shadowMapColorImageMemory;
+    VkDeviceMemory shadowMapDepthImageMemory;
+    VkImageView shadowMapColorImageView;
+    VkImageView shadowMapDepthImageView;
+    VkFramebuffer shadowMapFramebuffer;
+
+    VkRenderPass shadowMapRenderPass;
+    std::vector<VkDescriptorSetLayoutBinding> shadowMapDescriptorBindings;
+    VkDescriptorSetLayout shadowMapDescriptorSetLayout;
+    VkPipelineLayout shadowMapPipelineLayout;
+    VkPipeline shadowMapGraphicsPipeline;
+
+    // Camera depth written by shadow.vert with the shadow map pipeline layout
+    VkPipeline depthPrepassPipeline = VK_NULL_HANDLE;
+
+    VkCommandPool commandPool;
+
+    VkImage depthImage;
+    VkDeviceMemory depthImageMemory;
+    VkImageView depthImageView;
+
+    // Multisampled color target resolved into the swap chain image; unused without MSAA
+    VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+    VkImage colorImage = VK_NULL_HANDLE;
+    VkDeviceMemory colorImageMemory = VK_NULL_HANDLE;
+    VkImageView colorImageView = VK_NULL_HANDLE;
+
+    // With dynamic resolution the camera view is rendered into the top-left renderExtent()
+    // of sceneColorImage, which the upscale pass then stretches over the swap chain image
+    ResolutionScaleController resolutionScaleController;
+    VkImage sceneColorImage = VK_NULL_HANDLE;
+    VkDeviceMemory sceneColorImageMemory = VK_NULL_HANDLE;
+    VkImageView sceneColorImageView = VK_NULL_HANDLE;
+    VkSampler sceneColorSampler = VK_NULL_HANDLE;
+    VkRenderPass upscaleRenderPass = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSetLayoutBinding> upscaleDescriptorBindings;
+    VkDescriptorSetLayout upscaleDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout upscalePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline upscalePipeline = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> upscaleFramebuffers;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> frameUpscaleDescriptorSets = {};
+
+    uint32_t mipLevels;
+    VkImage textureImage = VK_NULL_HANDLE;
+    VkDeviceMemory textureImageMemory = VK_NULL_HANDLE;
+    VkImageView textureImageView = VK_NULL_HANDLE;
+    VkSampler textureSampler;
+
+    VkImage placeholderTextureImage;
+    VkDeviceMemory placeholderTextureImageMemory;
+    VkImageView placeholderTextureImageView;
+
+    std::future<DecodedImage> textureDecodeTask;
+    uint64_t textureUploadTimelineValue = 0;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    VkBuffer vertexBuffer;
+    VkDeviceMemory vertexBufferMemory;
+    VkBuffer indexBuffer;
+    VkDeviceMemory indexBufferMemory;
+
+    MeshRange teapotMesh;
+    MeshRange floorMesh;
+    std::vector<InstanceData> instances;
+    std::vector<DrawBatch> drawBatches;
+    std::vector<DrawBatch> shadowDrawBatches;
+    VkBuffer instanceBuffer;
+
+    // Detail level of every object in the camera and the shadow pass with --lods, and the draw
+    // batches split where the level changes
+    float lodErrorPixels = options.lodErrorPixels;
+    uint32_t shadowLodBias = options.shadowLodBias;
+    std::vector<uint8_t> cameraLods;
+    std::vector<uint8_t> shadowLods;
+    std::vector<DrawBatch> lodDrawBatches;
+    std::vector<DrawBatch> lodShadowDrawBatches;
+    VkDeviceMemory instanceBufferMemory;
+
+    std::vector<VkDescriptorSetLayoutBinding> cullDescriptorBindings;
+    VkDescriptorSetLayout cullDescriptorSetLayout;
+    VkPipelineLayout cullPipelineLayout;
+    VkPipeline cullPipeline;
+    VkBuffer cullObjectBuffer;
+    VkDeviceMemory cullObjectBufferMemory;
+    std::vector<VkBuffer> cameraDrawBuffers;
+    std::vector<VkDeviceMemory> cameraDrawBuffersMemory;
+    std::vector<VkBuffer> lightDrawBuffers;
+    std::vector<VkDeviceMemory> lightDrawBuffersMemory;
+    std::vector<VkBuffer> drawCountBuffers;
+    std::vector<VkDeviceMemory> drawCountBuffersMemory;
+    std::vector<VkBuffer> cullUniformBuffers;
+    std::vector<VkDeviceMemory> cullUniformBuffersMemory;
+    std::vector<VkBuffer> cullStatsBuffers;
+    std::vector<VkDeviceMemory> cullStatsBuffersMemory;
+    VkDescriptorPool cullDescriptorPool;
+    std::vector<VkDescriptorSet> cullDescriptorSets;
+    float timestampPeriod;
+
+    ObjectBounds objectBounds;
+    ObjectBounds lightSpaceBounds;
+    glm::mat4 lightSpaceBoundsMatrix;
+    bool lightSpaceBoundsValid = false;
+    std::vector<uint8_t> objectVisibility;
+    std::vector<uint8_t> lightVisibility;
+    std::vector<CullWorkerOutput> cullWorkerOutputs;
+    std::vector<VkBuffer> cpuDrawBuffers;
+    std::vector<VkDeviceMemory> cpuDrawBuffersMemory;
+
+    std::vector<VkBuffer> uniformBuffers;
+    std::vector<VkDeviceMemory> uniformBuffersMemory;
+
+    // Clustered lighting: point lights are binned into froxels by cluster.comp every frame
+    std::vector<PointLightSource> pointLightSources;
+    uint32_t activePointLightCount = 0;
+    std::vector<VkBuffer> clusterUniformBuffers;
+    std::vector<VkDeviceMemory> clusterUniformBuffersMemory;
+    std::vector<VkBuffer> pointLightBuffers;
+    std::vector<VkDeviceMemory> pointLightBuffersMemory;
+    std::vector<VkBuffer> clusterLightBuffers;
+    std::vector<VkDeviceMemory> clusterLightBuffersMemory;
+    std::vector<VkDescriptorSetLayoutBinding> clusterDescriptorBindings;
+    VkDescriptorSetLayout clusterDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout clusterPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline clusterPipeline = VK_NULL_HANDLE;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> frameClusterDescriptorSets = {};
+
+    // The render pass descriptor set is allocated and written anew every frame
+    std::array<DescriptorAllocator, MAX_FRAMES_IN_FLIGHT> frameDescriptorAllocators;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> frameDescriptorSets = {};
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> frameDepthPrepassDescriptorSets = {};
+    std::vector<FrameCommands> frameCommands;
+    std::vector<std::vector<RecordWorker>> recordWorkers;
+
+    VkBuffer shadowMapUniformBuffer;
+    VkDeviceMemory shadowMapUniformBufferMemory;
+    VkDescriptorPool shadowMapDescriptorPool;
+    VkDeviceSize shadowMapUniformStride = 0;
+    std::vector<VkDescriptorSet> shadowMapDescriptorSets;
+
+    // Shadow atlas: every light renders into its own tile of the shadow map image. Tiles are
+    // sized and packed every frame; with --shadow-budget the ones not re-rendered are kept.
+    ShadowAtlasAllocator shadowAtlasAllocator;
+    std::vector<ShadowLight> shadowLights;
+    std::vector<ShadowAtlasTile> shadowAtlasTiles;
+    std::vector<bool> shadowTilesValid;
+    std::vector<uint32_t> shadowTileAges;
+    std::vector<uint32_t> shadowTileUpdates;
+    std::vector<VkBuffer> shadowLightBuffers;
+    std::vector<VkDeviceMemory> shadowLightBuffersMemory;
+
+    // Cube shadow map of the key light. Only cubeShadowColorImage and its cube view exist
+    // without --cube-shadows, as a placeholder for the binding of render.frag.
+    CubeShadowMode cubeShadowMode = CUBE_SHADOW_SIX_PASSES;
+    std::array<bool, CUBE_SHADOW_MODE_COUNT> cubeShadowModeSupported = {};
+    VkImage cubeShadowColorImage = VK_NULL_HANDLE;
+    VkDeviceMemory cubeShadowColorImageMemory = VK_NULL_HANDLE;
+    VkImageView cubeShadowCubeView = VK_NULL_HANDLE;
+    VkImage cubeShadowDepthImage = VK_NULL_HANDLE;
+    VkDeviceMemory cubeShadowDepthImageMemory = VK_NULL_HANDLE;
+    VkImageView cubeShadowColorArrayView = VK_NULL_HANDLE;
+    VkImageView cubeShadowDepthArrayView = VK_NULL_HANDLE;
+    std::array<VkImageView, 6> cubeShadowColorFaceViews = {};
+    std::array<VkImageView, 6> cubeShadowDepthFaceViews = {};
+    VkRenderPass cubeShadowRenderPass = VK_NULL_HANDLE;
+    VkRenderPass cubeShadowMultiviewRenderPass = VK_NULL_HANDLE;
+    VkFramebuffer cubeShadowMultiviewFramebuffer = VK_NULL_HANDLE;
+    VkFramebuffer cubeShadowLayeredFramebuffer = VK_NULL_HANDLE;
+    std::array<VkFramebuffer, 6> cubeShadowFaceFramebuffers = {};
+    std::vector<VkDescriptorSetLayoutBinding> cubeShadowDescriptorBindings;
+    VkDescriptorSetLayout cubeShadowDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout cubeShadowPipelineLayout = VK_NULL_HANDLE;
+    std::array<VkPipeline, CUBE_SHADOW_MODE_COUNT> cubeShadowPipelines = {};
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> frameCubeShadowDescriptorSets = {};
+    std::array<glm::mat4, 6> cubeShadowFaceMatrices;
+    VkBuffer cubeShadowUniformBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory cubeShadowUniformBufferMemory = VK_NULL_HANDLE;
+
+    // Indirect draws of the casters in each face, rebuilt when the instances change
+    bool cubeShadowDrawsValid = false;
+    VkBuffer cubeShadowDrawBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory cubeShadowDrawBufferMemory = VK_NULL_HANDLE;
+    IndirectDrawRange cubeShadowMultiviewDraws;
+    IndirectDrawRange cubeShadowLayeredDraws;
+    std::array<IndirectDrawRange, 6> cubeShadowFaceDraws;
+    uint32_t cubeShadowCasterCount = 0;
+    uint32_t cubeShadowMultiviewObjectCount = 0;
+    uint32_t cubeShadowObjectFaceCount = 0;
+
+    // Meshlets of all meshes with --meshlets. The draw buffers are per swap chain image and start
+    // with the counters of the cull, which are copied into the host-visible stats buffers.
+    MeshletPath meshletPath = MESHLET_PATH_OBJECTS;
+    std::array<bool, MESHLET_PATH_COUNT> meshletPathSupported = {};
+    PFN_vkCmdDrawMeshTasksEXT vkCmdDrawMeshTasksEXT = nullptr;
+    uint32_t maxTaskWorkGroupTotalCount = 0;
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint32_t> meshletTriangles;
+    uint32_t maxMeshletsPerMesh = 0;
+    VkBuffer meshletBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory meshletBufferMemory = VK_NULL_HANDLE;
+    VkBuffer meshletVertexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory meshletVertexBufferMemory = VK_NULL_HANDLE;
+    VkBuffer meshletTriangleBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory meshletTriangleBufferMemory = VK_NULL_HANDLE;
+    VkBuffer meshletObjectBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory meshletObjectBufferMemory = VK_NULL_HANDLE;
+    uint32_t meshletDrawCapacity = 0;
+    uint64_t meshletTriangleTotal = 0;
+    std::vector<VkBuffer> meshletDrawBuffers;
+    std::vector<VkDeviceMemory> meshletDrawBuffersMemory;
+    std::vector<VkBuffer> meshletStatsBuffers;
+    std::vector<VkDeviceMemory> meshletStatsBuffersMemory;
+    std::vector<bool> meshletStatsPending;
+    MeshletCullPushConstants meshletCullConstants = {};
+    std::vector<VkDescriptorSetLayoutBinding> meshletCullDescriptorBindings;
+    VkDescriptorSetLayout meshletCullDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout meshletCullPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline meshletCullPipeline = VK_NULL_HANDLE;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> frameMeshletCullDescriptorSets = {};
+    std::vector<VkDescriptorSetLayoutBinding> meshletDescriptorBindings;
+    VkDescriptorSetLayout meshletDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout meshShaderPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline meshShaderPipeline = VK_NULL_HANDLE;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> frameMeshletDescriptorSets = {};
+
+    // Binary semaphores are only used where the swapchain requires them.
+    // All other GPU progress is tracked by a single timeline semaphore.
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    VkSemaphore timelineSemaphore;
+    uint64_t timelineValue = 0;
+    std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> frameTimelineValues = {};
+    std::vector<uint64_t> imageTimelineValues;
+    std::deque<DeferredRelease> deferredReleases;
+
+    std::unique_ptr<ShaderWatcher> shaderWatcher;
+    std::set<std::string> pendingShaderChanges;
+    std::future<ShaderReloadResult> shaderReloadTask;
+    // Hot-reloaded SPIR-V by .spv name; takes precedence over embedded and on-disk shaders
+    std::map<std::string, std::vector<uint32_t>> shaderOverrides;
+    size_t currentFrame = 0;
+
+    VkPresentModeKHR swapChainPresentMode;
+    bool displayTimingEnabled = false;
+    PFN_vkGetPastPresentationTimingGOOGLE vkGetPastPresentationTimingGOOGLE = nullptr;
+    uint32_t nextPresentId = 1;
+
+    bool gpuTimestampsSupported = false;
+    bool pipelineStatisticsEnabled = false;
+    bool calibratedTimestampsEnabled = false;
+    PFN_vkGetCalibratedTimestampsEXT vkGetCalibratedTimestampsEXT = nullptr;
+    VkQueryPool calibrationQueryPool = VK_NULL_HANDLE;
+    uint64_t gpuCalibrationTicks = 0;
+    uint64_t cpuCalibrationNs = 0;
+
+#ifdef ENABLE_CPU_PROFILER
+    ProfileCollector profileCollector;
+    std::string activeTracePath;
+    uint32_t traceFramesRemaining = 0;
+#endif
+    // Acquire timestamps (steady clock, ns) indexed by present ID, matched against past presentation timings
+    std::array<uint64_t, 256> presentAcquireTimes = {};
+
+    bool framebufferResized = false;
+
+    std::chrono::high_resolution_clock::time_point startupTime;
+    bool firstFrameReported = false;
+    bool fullQualityReported = false;
+
+    FrameStats frameStats;
+    std::chrono::high_resolution_clock::time_point lastFrameTime;
+    std::chrono::high_resolution_clock::time_point lastStatsReportTime;
+
+    void initWindow() {
+        glfwInit();
+
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+        window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+        glfwSetKeyCallback(window, keyCallback);
+    }
+
+    static void framebufferResizeCallback(GLFWwindow *window, int width, int height) {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        app->framebufferResized = true;
+    }
+
+    static void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+            app->startTraceCapture();
+        }
+    }
+
+    // Captures the next traceFrameCount frames into the --trace file, or trace.json when none was given
+    void startTraceCapture() {
+#ifdef ENABLE_CPU_PROFILER
+        if (traceFramesRemaining > 0) {
+            return;
+        }
+
+        profileCollector.clearTrace();
+        activeTracePath = options.tracePath.empty() ? "trace.json" : options.tracePath;
+        traceFramesRemaining = options.traceFrameCount;
+        calibrateGpuClock();
+        std::cout << "capturing " << traceFramesRemaining << " frames to " << activeTracePath << std::endl;
+#else
+        std::cerr << "trace capture requires a build with ENABLE_CPU_PROFILER" << std::endl;
+#endif
+    }
+
+    bool traceCaptureActive() const {
+#ifdef ENABLE_CPU_PROFILER
+        return traceFramesRemaining > 0;
+#else
+        return false;
+#endif
+    }
+
+    void finishTraceCapture() {
+#ifdef ENABLE_CPU_PROFILER
+        profileCollector.collect(false, true);
+        profileCollector.writeChromeTrace(activeTracePath);
+        profileCollector.clearTrace();
+        traceFramesRemaining = 0;
+#endif
+    }
+
+    void initVulkan() {
+        PROFILE_SCOPE("initVulkan");
+
+        // Decoding runs on a worker thread while the rest of Vulkan is initialized
+        textureDecodeTask = std::async(std::launch::async, decodeImage, TEX_PATH);
+
+        createInstance();
+        setupDebugMessenger();
+        createSurface();
+        pickPhysicalDevice();
+        createLogicalDevice();
+
+        createSwapChain();
+        createCommandPool();
+        createTimelineSemaphore();
+        createImageViews();
+        createRenderPass();
+
+        createShadowMapResources();
+
+        createDescriptorSetLayout();
+        createDescriptorUpdateTemplate();
+        createGraphicsPipeline();
+        createColorResources();
+        createDepthResources();
+        createSceneColorResources();
+        createFramebuffers();
+        createPlaceholderTexture();
+        createTextureSampler();
+
+        if (options.dynamicResolution) {
+            createResolutionScaleController();
+            createSceneColorSampler();
+            createUpscaleDescriptorSetLayout();
+            createUpscaleRenderPass();
+            createUpscalePipeline();
+            createUpscaleFramebuffers();
+        }
+
+        createShadowMapRenderPass();
+        createShadowMapFramebuffer();
+        createShadowMapDescriptorSetLayout();
+        createShadowMapGraphicsPipeline();
+        createDepthPrepassPipeline();
+
+        createCubeShadowResources();
+        if (options.cubeShadows) {
+            createCubeShadowRenderPasses();
+            createCubeShadowFramebuffers();
+            createCubeShadowDescriptorSetLayout();
+            createCubeShadowPipelines();
+            createCubeShadowUniformBuffer();
+        }
+
+        loadModel();
+        createVertexBuffer();
+        createIndexBuffer();
+        createInstances(options.instanceCount);
+        createInstanceBuffer();
+        createObjectBounds();
+
+        if (options.meshlets) {
+            createMeshletBuffers();
+            createMeshletObjectBuffer();
+            createMeshletDrawBuffers();
+            createMeshletCullPipeline();
+            if (meshletPathSupported[MESHLET_PATH_MESH_SHADER]) {
+                createMeshletDescriptorSetLayout();
+                createMeshShaderPipeline();
+            }
+        }
+
+        if (options.gpuCulling) {
+            createCullDescriptorSetLayout();
+            createCullPipeline();
+            createCullBuffers();
+            createCullDrawBuffers();
+            createCullUniformBuffers();
+            createCullDescriptorPool();
+            createCullDescriptorSets();
+        }
+
+        if (options.cpuCulling) {
+            createCpuDrawBuffers();
+        }
+
+        createUniformBuffers();
+        createClusterBuffers();
+        createShadowLightBuffers();
+
+        if (options.clusteredLighting) {
+            createPointLightSources();
+            createClusterDescriptorSetLayout();
+            createClusterPipeline();
+        }
+
+        createShadowLights();
+        createShadowMapUniformBuffer();
+        createShadowMapDescriptorPool();
+        createShadowMapDescriptorSets();
+
+        createFrameCommands();
+        createRecordWorkers();
+
+        createSyncObjects();
+
+        if (options.printStats) {
+            std::cout << "descriptor set layouts: " << descriptorSetLayoutCache.layoutCount() << " unique of "
+                      << descriptorSetLayoutCache.requests() << " requested" << std::endl;
+        }
+
+        if (traceCaptureActive()) {
+            calibrateGpuClock();
+        }
+
+        if (options.hotReload) {
+#if defined(SHADER_SOURCE_DIR) && defined(SHADER_BINARY_DIR)
+            shaderWatcher = std::make_unique<ShaderWatcher>(SHADER_SOURCE_DIR);
+            std::cout << "watching " << SHADER_SOURCE_DIR << " for shader changes" << std::endl;
+#else
+            throw std::runtime_error("--hot-reload requires SHADER_SOURCE_DIR and SHADER_BINARY_DIR to be defined at build time");
+#endif
+        }
+    }
+
+    void mainLoop() {
+        // --frames bounds the run, e.g. for CI on a software implementation
+        for (uint32_t frame = 0; !glfwWindowShouldClose(window) && (options.frameLimit == 0 || frame < options.frameLimit); frame++) {
+            {
+                PROFILE_SCOPE("glfwPollEvents");
+                glfwPollEvents();
+            }
+            drawFrame();
+        }
+
+        vkDeviceWaitIdle(device);
+
+        // Short runs would otherwise end before the first report
+        if (options.printStats && frameStats.frameCount > 0) {
+            reportFrameStats();
+        }
+
+        if (shaderReloadTask.valid()) {
+            ShaderReloadResult result = shaderReloadTask.get();
+            destroyReloadedPipelines(result);
+        }
+
+        if (traceCaptureActive()) {
+            finishTraceCapture();
+        }
+    }
+
+    // One step of a benchmark: configure() sets it up, then BENCHMARK_WARMUP_FRAMES are drawn and
+    // BENCHMARK_MEASURED_FRAMES are measured with fresh frameStats. Prints "<label>, frame time"
+    // and leaves the line open for the step's own results. Returns the average frame time in ms,
+    // or nothing once the window is closed.
+    std::optional<float> measureFrames(const std::string &label, const std::function<void()> &configure) {
+        if (glfwWindowShouldClose(window)) {
+            return std::nullopt;
+        }
+
+        configure();
+
+        for (uint32_t frame = 0; frame < BENCHMARK_WARMUP_FRAMES; frame++) {
+            glfwPollEvents();
+            drawFrame();
+        }
+        vkDeviceWaitIdle(device);
+        frameStats = FrameStats();
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (uint32_t frame = 0; frame < BENCHMARK_MEASURED_FRAMES; frame++) {
+            glfwPollEvents();
+            drawFrame();
+        }
+        vkDeviceWaitIdle(device);
+        auto currentTime = std::chrono::high_resolution_clock::now();
+
+        float frameTime = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - startTime).count() / BENCHMARK_MEASURED_FRAMES;
+        std::cout << label << ", frame time: " << frameTime << " ms";
+        return frameTime;
+    }
+
+    // Appends the average GPU time of each pass that was timed during the measured frames
+    void printGpuPassTimes(std::initializer_list<GpuPass> passes) const {
+        for (GpuPass pass : passes) {
+            if (frameStats.gpuPassTimeCount[pass] > 0) {
+                std::cout << ", gpu " << GPU_PASS_NAMES[pass] << ": " << frameStats.gpuPassTimeSum[pass] / frameStats.gpuPassTimeCount[pass] << " ms";
+            }
+        }
+    }
+
+    void runInstancingBenchmark() {
+        const std::vector<uint32_t> instanceCounts = { 1, 10, 100, 1000, 10000, 100000 };
+
+        for (uint32_t instanceCount : instanceCounts) {
+            std::optional<float> frameTime = measureFrames("instances: " + std::to_string(instanceCount), [&]() {
+                vkDeviceWaitIdle(device);
+
+                vkDestroyBuffer(device, instanceBuffer, nullptr);
+                vkFreeMemory(device, instanceBufferMemory, nullptr);
+                createInstances(instanceCount);
+                createInstanceBuffer();
+                createObjectBounds();
+                updateInstanceDescriptors();
+
+                if (options.cpuCulling) {
+                    destroyCpuDrawBuffers();
+                    createCpuDrawBuffers();
+                }
+
+                if (options.gpuCulling) {
+                    destroyCullBuffers();
+                    createCullBuffers();
+                    destroyCullDrawBuffers();
+                    createCullDrawBuffers();
+                    updateCullDescriptorSets();
+                }
+
+                if (options.meshlets) {
+                    destroyMeshletObjectBuffer();
+                    createMeshletObjectBuffer();
+                    destroyMeshletDrawBuffers();
+                    createMeshletDrawBuffers();
+                }
+            });
+            if (!frameTime) {
+                break;
+            }
+
+            uint64_t triangles = static_cast<uint64_t>(teapotMesh.indexCount / 3) * instanceCount + floorMesh.indexCount / 3;
+            std::cout << ", triangles/frame: " << triangles
+                      << ", instances/ms: " << instanceCount / *frameTime << std::endl;
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    void runRecordingBenchmark() {
+        const uint32_t objectCount = 10000;
+        const int iterations = 50;
+
+        vkDeviceWaitIdle(device);
+
+        // One draw per object so that there is a long draw list to split
+        options.drawPerObject = true;
+        vkDestroyBuffer(device, instanceBuffer, nullptr);
+        vkFreeMemory(device, instanceBufferMemory, nullptr);
+        createInstances(objectCount);
+        createInstanceBuffer();
+        createObjectBounds();
+        updateInstanceDescriptors();
+
+        std::vector<uint32_t> threadCounts = { 0 };
+        for (uint32_t threadCount = 1; threadCount < workerThreadCount(); threadCount *= 2) {
+            threadCounts.push_back(threadCount);
+        }
+        threadCounts.push_back(workerThreadCount());
+
+        const size_t drawCount = drawBatches.size() + shadowDrawBatches.size();
+        for (uint32_t threadCount : threadCounts) {
+            options.recordThreadCount = threadCount;
+
+            auto startTime = std::chrono::high_resolution_clock::now();
+            for (int iteration = 0; iteration < iterations; iteration++) {
+                recordFrameCommands(0);
+            }
+            auto currentTime = std::chrono::high_resolution_clock::now();
+
+            float recordTime = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - startTime).count() / iterations;
+            std::cout << "record threads: " << (threadCount == 0 ? std::string("inline") : std::to_string(threadCount))
+                      << ", draws: " << drawCount
+                      << ", record time: " << recordTime << " ms"
+                      << ", draws/ms: " << drawCount / recordTime
+                      << ", draws/ms/thread: " << drawCount / recordTime / std::max(1u, threadCount) << std::endl;
+        }
+    }
+
+    // Allocates and writes one render pass descriptor set per draw, as a per-draw binding
+    // scheme would, once with VkWriteDescriptorSet arrays and once with the update template.
+    void runDescriptorBenchmark() {
+        const uint32_t setCount = 10000;
+        const int iterations = 20;
+        const uint32_t writesPerSet = static_cast<uint32_t>(RENDER_DESCRIPTOR_ENTRIES.size());
+
+        vkDeviceWaitIdle(device);
+
+        DescriptorAllocator allocator;
+        allocator.init(descriptorBindings, 64);
+
+        RenderDescriptorData data = renderDescriptorData(0);
+        std::array<VkWriteDescriptorSet, RENDER_DESCRIPTOR_ENTRIES.size()> descriptorWrites = {};
+        for (size_t i = 0; i < descriptorWrites.size(); i++) {
+            const VkDescriptorUpdateTemplateEntry &entry = RENDER_DESCRIPTOR_ENTRIES[i];
+            const char *info = reinterpret_cast<const char*>(&data) + entry.offset;
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstBinding = entry.dstBinding;
+            descriptorWrites[i].dstArrayElement = entry.dstArrayElement;
+            descriptorWrites[i].descriptorCount = entry.descriptorCount;
+            descriptorWrites[i].descriptorType = entry.descriptorType;
+            if (isImageDescriptor(entry.descriptorType)) {
+                descriptorWrites[i].pImageInfo = reinterpret_cast<const VkDescriptorImageInfo*>(info);
+            } else {
+                descriptorWrites[i].pBufferInfo = reinterpret_cast<const VkDescriptorBufferInfo*>(info);
+            }
+        }
+
+        for (bool useTemplate : { false, true }) {
+            float allocateTime = 0.0f;
+            float updateTime = 0.0f;
+            std::vector<VkDescriptorSet> sets(setCount);
+            for (int iteration = 0; iteration < iterations; iteration++) {
+                allocator.reset(device);
+
+                auto startTime = std::chrono::high_resolution_clock::now();
+                for (uint32_t i = 0; i < setCount; i++) {
+                    sets[i] = allocator.allocate(device, descriptorSetLayout);
+                }
+                auto allocatedTime = std::chrono::high_resolution_clock::now();
+
+                for (uint32_t i = 0; i < setCount; i++) {
+                    if (useTemplate) {
+                        vkUpdateDescriptorSetWithTemplate(device, sets[i], descriptorUpdateTemplate, &data);
+                    } else {
+                        for (auto &descriptorWrite : descriptorWrites) {
+                            descriptorWrite.dstSet = sets[i];
+                        }
+                        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+                    }
+                }
+                auto currentTime = std::chrono::high_resolution_clock::now();
+
+                allocateTime += std::chrono::duration<float, std::chrono::milliseconds::period>(allocatedTime - startTime).count();
+                updateTime += std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - allocatedTime).count();
+            }
+            allocateTime /= iterations;
+            updateTime /= iterations;
+
+            std::cout << "descriptor updates: " << (useTemplate ? "vkUpdateDescriptorSetWithTemplate" : "vkUpdateDescriptorSets")
+                      << ", sets: " << setCount
+                      << ", allocate time: " << allocateTime << " ms"
+                      << ", update time: " << updateTime << " ms"
+                      << ", writes/ms: " << setCount * writesPerSet / updateTime
+                      << ", pools: " << allocator.poolCount() << std::endl;
+        }
+
+        allocator.destroy(device);
+    }
+
+    // Records one draw per object into the main pass, delivering each object's data either
+    // with vkCmdPushConstants or by writing it to a mapped buffer bound with a dynamic offset.
+    // Only CPU time is measured; the command buffer is never submitted.
+    void runDrawDataBenchmark() {
+        const uint32_t objectCount = 10000;
+        const int iterations = 50;
+
+        vkDeviceWaitIdle(device);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+        VkDeviceSize stride = (sizeof(DrawPushConstants) + alignment - 1) / alignment * alignment;
+
+        VkBuffer drawDataBuffer;
+        VkDeviceMemory drawDataBufferMemory;
+        createBuffer(stride * objectCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, drawDataBuffer, drawDataBufferMemory);
+
+        char *mapped;
+        vkMapMemory(device, drawDataBufferMemory, 0, stride * objectCount, 0, reinterpret_cast<void**>(&mapped));
+
+        std::vector<VkDescriptorSetLayoutBinding> drawDataBindings(1);
+        drawDataBindings[0].binding = 0;
+        drawDataBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        drawDataBindings[0].descriptorCount = 1;
+        drawDataBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        VkDescriptorSetLayout drawDataSetLayout = descriptorSetLayoutCache.get(device, drawDataBindings);
+
+        DescriptorAllocator drawDataAllocator;
+        drawDataAllocator.init(drawDataBindings, 1);
+        VkDescriptorSet drawDataSet = drawDataAllocator.allocate(device, drawDataSetLayout);
+
+        VkDescriptorBufferInfo drawDataBufferInfo = { drawDataBuffer, 0, sizeof(DrawPushConstants) };
+        VkWriteDescriptorSet descriptorWrite = {};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = drawDataSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &drawDataBufferInfo;
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+        // Set 0 and the push constant range match pipelineLayout, so set 0 stays compatible
+        VkDescriptorSetLayout setLayouts[] = { descriptorSetLayout, drawDataSetLayout };
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 2;
+        pipelineLayoutInfo.pSetLayouts = setLayouts;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        VkPipelineLayout drawDataPipelineLayout;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &drawDataPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+
+        vkDestroyBuffer(device, instanceBuffer, nullptr);
+        vkFreeMemory(device, instanceBufferMemory, nullptr);
+        createInstances(objectCount);
+        createInstanceBuffer();
+        createObjectBounds();
+        updateInstanceDescriptors();
+
+        FrameCommands &frame = frameCommands[currentFrame];
+        for (bool usePushConstants : { true, false }) {
+            float recordTime = 0.0f;
+            for (int iteration = 0; iteration < iterations; iteration++) {
+                vkResetCommandPool(device, frame.commandPool, 0);
+                allocateFrameDescriptorSet(0);
+
+                VkCommandBufferBeginInfo beginInfo = {};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
+
+                VkRenderPassBeginInfo renderPassInfo = {};
+                renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                renderPassInfo.renderPass = renderPass;
+                renderPassInfo.framebuffer = swapChainFramebuffers[0];
+                renderPassInfo.renderArea.extent = swapChainExtent;
+                vkCmdBeginRenderPass(frame.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+                if (options.depthPrepass) {
+                    vkCmdNextSubpass(frame.commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+                }
+
+                bindDrawState(frame.commandBuffer, graphicsPipeline, pipelineLayout, frameDescriptorSets[currentFrame]);
+                setRenderViewport(frame.commandBuffer);
+
+                auto startTime = std::chrono::high_resolution_clock::now();
+                for (uint32_t i = 0; i < objectCount; i++) {
+                    const MeshRange &mesh = i == 0 ? floorMesh : teapotMesh;
+                    DrawPushConstants constants = drawPushConstants(instances[i]);
+                    if (usePushConstants) {
+                        vkCmdPushConstants(frame.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &constants);
+                    } else {
+                        uint32_t offset = static_cast<uint32_t>(stride * i);
+                        memcpy(mapped + offset, &constants, sizeof(DrawPushConstants));
+                        vkCmdBindDescriptorSets(frame.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawDataPipelineLayout, 1, 1, &drawDataSet, 1, &offset);
+                    }
+                    vkCmdDrawIndexed(frame.commandBuffer, mesh.indexCount, 1, mesh.firstIndex, 0, i);
+                }
+                auto currentTime = std::chrono::high_resolution_clock::now();
+                recordTime += std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - startTime).count();
+
+                vkCmdEndRenderPass(frame.commandBuffer);
+                vkEndCommandBuffer(frame.commandBuffer);
+            }
+            recordTime /= iterations;
+
+            std::cout << "draw data: " << (usePushConstants ? "push constants" : "dynamic uniform offsets")
+                      << ", draws: " << objectCount
+                      << ", record time: " << recordTime << " ms"
+                      << ", ns/draw: " << recordTime * 1.0e6f / objectCount
+                      << ", draws/ms: " << objectCount / recordTime << std::endl;
+        }
+
+        vkDestroyPipelineLayout(device, drawDataPipelineLayout, nullptr);
+        drawDataAllocator.destroy(device);
+        vkUnmapMemory(device, drawDataBufferMemory);
+        vkDestroyBuffer(device, drawDataBuffer, nullptr);
+        vkFreeMemory(device, drawDataBufferMemory, nullptr);
+    }
+
+    // Renders the same scene with every sample count the device supports. The GPU time of
+    // the main pass includes the resolve, which is where MSAA costs bandwidth.
+    void runMsaaBenchmark() {
+        VkSampleCountFlags supported = supportedSampleCounts();
+        for (uint32_t sampleCount : { 1u, 2u, 4u, 8u }) {
+            std::string label = "msaa: " + std::to_string(sampleCount) + "x";
+            if (!(supported & sampleCount)) {
+                std::cout << label << ", not supported" << std::endl;
+                continue;
+            }
+
+            bool measured = measureFrames(label, [&]() {
+                msaaSamples = static_cast<VkSampleCountFlagBits>(sampleCount);
+                recreateSwapChain();
+            }).has_value();
+            if (!measured) {
+                break;
+            }
+
+            printGpuPassTimes({ GPU_PASS_MAIN });
+            std::cout << std::endl;
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    // Light counts grow by 4x; with clustering the shading cost should follow the lights
+    // per cluster rather than the total count
+    void runLightBenchmark() {
+        const std::vector<uint32_t> lightCounts = { 1, 4, 16, 64, 256, 1024, 4096 };
+
+        for (uint32_t lightCount : lightCounts) {
+            if (!measureFrames("lights: " + std::to_string(lightCount), [&]() { activePointLightCount = lightCount; })) {
+                break;
+            }
+
+            printGpuPassTimes({ GPU_PASS_LIGHT_BINNING, GPU_PASS_MAIN });
+            std::cout << std::endl;
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    // Renders the same cube map with every supported mode. Multiview and layered rendering
+    // submit the casters once instead of once per face.
+    void runCubeShadowBenchmark() {
+        for (uint32_t mode = 0; mode < CUBE_SHADOW_MODE_COUNT; mode++) {
+            std::string label = std::string("cube shadows: ") + CUBE_SHADOW_MODE_NAMES[mode];
+            if (!cubeShadowModeSupported[mode]) {
+                std::cout << label << ", not supported" << std::endl;
+                continue;
+            }
+
+            if (!measureFrames(label, [&]() { cubeShadowMode = static_cast<CubeShadowMode>(mode); })) {
+                break;
+            }
+
+            printGpuPassTimes({ GPU_PASS_CUBE_SHADOW });
+            if (frameStats.pipelineStatisticCount[GPU_PASS_CUBE_SHADOW] > 0) {
+                std::cout << ", " << frameStats.pipelineStatisticSum[GPU_PASS_CUBE_SHADOW][PIPELINE_STATISTIC_VERTEX_INVOCATIONS] / frameStats.pipelineStatisticCount[GPU_PASS_CUBE_SHADOW]
+                          << " " << PIPELINE_STATISTIC_NAMES[PIPELINE_STATISTIC_VERTEX_INVOCATIONS];
+            }
+            std::cout << std::endl;
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    // Whole objects draw every triangle; the meshlet paths only the ones of visible, front-facing meshlets
+    void runMeshletBenchmark() {
+        for (uint32_t path = 0; path < MESHLET_PATH_COUNT; path++) {
+            std::string label = std::string("meshlets: ") + MESHLET_PATH_NAMES[path];
+            if (!meshletPathSupported[path]) {
+                std::cout << label << ", not supported" << std::endl;
+                continue;
+            }
+
+            if (!measureFrames(label, [&]() { meshletPath = static_cast<MeshletPath>(path); })) {
+                break;
+            }
+
+            printGpuPassTimes({ GPU_PASS_MESHLET_CULL, GPU_PASS_MAIN });
+            uint64_t triangles = meshletTriangleTotal;
+            if (frameStats.meshletStatsCount > 0) {
+                triangles = frameStats.meshletTriangleSum / frameStats.meshletStatsCount;
+            }
+            std::cout << ", triangles: " << triangles << " of " << meshletTriangleTotal
+                      << " (culled " << 100.0 * (1.0 - static_cast<double>(triangles) / meshletTriangleTotal) << "%)" << std::endl;
+        }
+
+        vkDeviceWaitIdle(device);
+    }
+
+    // Full detail in both passes first, then coarser levels as the allowed screen-space error grows
+    void runLodBenchmark() {
+        const float errorThresholds[] = { 0.0f, 0.5f, 1.0f, 2.0f, 4.0f };
+
+        for (float threshold : errorThresholds) {
+            uint32_t bias = threshold > 0.0f ? options.shadowLodBias : 0;
+            std::ostringstream label;
+            label << "lods: error <= " << threshold << " px, shadow bias " << bias;
+            bool measured = measureFrames(label.str(), [&]() {
+                lodErrorPixels = threshold;
+                shadowLodBias = bias;
+            }).has_value();
+            if (!measured) {
+                break;
+            }
+
+            printGpuPassTimes({ GPU_PASS_SHADOW, GPU_PASS_MAIN });
+            const char *passNames[] = { "camera", "shadow" };
+            for (int pass = 0; pass < 2; pass++) {
+                double triangles = static_cast<double>(frameStats.lodTriangleSum[pass]) / std::max(frameStats.lodSelectCount, 1u);
+                double fullTriangles = static_cast<double>(frameStats.lodFullTriangleSum[pass]) / std::max(frameStats.lodSelectCount, 1u);
+                std::cout << ", " << passNames[pass] << " triangles: " << triangles << " of " << fullTriangles
+                          << " (saved " << (fullTriangles > 0.0 ? 100.0 * (1.0 - triangles / fullTriangles) : 0.0) << "%)";
+            }
+            std::cout << std::endl;
+        }
+
+        lodErrorPixels = options.lodErrorPixels;
+        shadowLodBias = options.shadowLodBias;
+        vkDeviceWaitIdle(device);
+    }
+
+    void recreateSwapChain() {
+        int width = 0, height = 0;
+        while (width == 0 || height == 0) {
+            glfwGetFramebufferSize(window, &width, &height);
+            glfwWaitEvents();
+        }
+
+        vkDeviceWaitIdle(device);
+
+        // Pipelines built against the old render pass cannot be used, but their SPIR-V is
+        // kept so that the pipelines below are created from the new shaders. The shadow map
+        // render pass and the compute pipelines outlive the swap chain, so those are swapped in.
+        if (shaderReloadTask.valid()) {
+            ShaderReloadResult result = shaderReloadTask.get();
+            vkDestroyPipeline(device, result.graphicsPipeline, nullptr);
+            vkDestroyPipeline(device, result.depthPrepassPipeline, nullptr);
+            vkDestroyPipeline(device, result.meshShaderPipeline, nullptr);
+            if (result.error.empty()) {
+                adoptShaderCode(result);
+                swapPipeline(shadowMapGraphicsPipeline, result.shadowMapGraphicsPipeline);
+                swapPipeline(cullPipeline, result.cullPipeline);
+                swapPipeline(clusterPipeline, result.clusterPipeline);
+                swapPipeline(meshletCullPipeline, result.meshletCullPipeline);
+            }
+        }
+
+        cleanupSwapChain();
+
+        createSwapChain();
+        createImageViews();
+        createRenderPass();
+        createGraphicsPipeline();
+        createDepthPrepassPipeline();
+        if (meshletPathSupported[MESHLET_PATH_MESH_SHADER]) {
+            createMeshShaderPipeline();
+        }
+        createColorResources();
+        createDepthResources();
+        createSceneColorResources();
+        createFramebuffers();
+        if (options.dynamicResolution) {
+            createUpscaleRenderPass();
+            createUpscalePipeline();
+            createUpscaleFramebuffers();
+        }
+        if (options.cpuCulling) {
+            createCpuDrawBuffers();
+        }
+        createUniformBuffers();
+        createClusterBuffers();
+        createShadowLightBuffers();
+
+        if (options.meshlets) {
+            createMeshletDrawBuffers();
+        }
+
+        if (options.gpuCulling) {
+            createCullDrawBuffers();
+            createCullUniformBuffers();
+            createCullDescriptorPool();
+            createCullDescriptorSets();
+        }
+
+        imageTimelineValues.assign(swapChainImages.size(), 0);
+    }
+
+    void cleanupSwapChain() {
+        vkDestroyImageView(device, depthImageView, nullptr);
+        vkDestroyImage(device, depthImage, nullptr);
+        vkFreeMemory(device, depthImageMemory, nullptr);
+
+        vkDestroyImageView(device, colorImageView, nullptr);
+        vkDestroyImage(device, colorImage, nullptr);
+        vkFreeMemory(device, colorImageMemory, nullptr);
+        colorImageView = VK_NULL_HANDLE;
+        colorImage = VK_NULL_HANDLE;
+        colorImageMemory = VK_NULL_HANDLE;
+
+        if (options.dynamicResolution) {
+            vkDestroyImageView(device, sceneColorImageView, nullptr);
+            vkDestroyImage(device, sceneColorImage, nullptr);
+            vkFreeMemory(device, sceneColorImageMemory, nullptr);
+
+            for (auto framebuffer : upscaleFramebuffers) {
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+            }
+
+            vkDestroyPipeline(device, upscalePipeline, nullptr);
+            vkDestroyPipelineLayout(device, upscalePipelineLayout, nullptr);
+            vkDestroyRenderPass(device, upscaleRenderPass, nullptr);
+        }
+
+        for (auto framebuffer : swapChainFramebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+
+        vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        vkDestroyPipeline(device, depthPrepassPipeline, nullptr);
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        vkDestroyPipeline(device, meshShaderPipeline, nullptr);
+        vkDestroyPipelineLayout(device, meshShaderPipelineLayout, nullptr);
+        vkDestroyRenderPass(device, renderPass, nullptr);
+
+        for (auto imageView : swapChainImageViews) {
+            vkDestroyImageView(device, imageView, nullptr);
+        }
+
+        vkDestroySwapchainKHR(device, swapChain, nullptr);
+
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
+            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, clusterUniformBuffers[i], nullptr);
+            vkFreeMemory(device, clusterUniformBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, pointLightBuffers[i], nullptr);
+            vkFreeMemory(device, pointLightBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, clusterLightBuffers[i], nullptr);
+            vkFreeMemory(device, clusterLightBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, shadowLightBuffers[i], nullptr);
+            vkFreeMemory(device, shadowLightBuffersMemory[i], nullptr);
+        }
+
+        if (options.cpuCulling) {
+            destroyCpuDrawBuffers();
+        }
+
+        if (options.meshlets) {
+            destroyMeshletDrawBuffers();
+        }
+
+        if (options.gpuCulling) {
+            destroyCullDrawBuffers();
+            for (size_t i = 0; i < cullUniformBuffers.size(); i++) {
+                vkDestroyBuffer(device, cullUniformBuffers[i], nullptr);
+                vkFreeMemory(device, cullUniformBuffersMemory[i], nullptr);
+                vkDestroyBuffer(device, cullStatsBuffers[i], nullptr);
+                vkFreeMemory(device, cullStatsBuffersMemory[i], nullptr);
+            }
+
+            vkDestroyDescriptorPool(device, cullDescriptorPool, nullptr);
+        }
+    }
+
+    void cleanup() {
+        cleanupSwapChain();
+
+        for (const auto &frame : frameCommands) {
+            vkDestroyCommandPool(device, frame.commandPool, nullptr);
+            vkDestroyQueryPool(device, frame.timestampQueryPool, nullptr);
+            vkDestroyQueryPool(device, frame.statisticsQueryPool, nullptr);
+        }
+        for (auto &allocator : frameDescriptorAllocators) {
+            allocator.destroy(device);
+        }
+        vkDestroyQueryPool(device, calibrationQueryPool, nullptr);
+
+        for (const auto &workers : recordWorkers) {
+            for (const auto &worker : workers) {
+                vkDestroyCommandPool(device, worker.commandPool, nullptr);
+            }
+        }
+
+        if (textureDecodeTask.valid()) {
+            try {
+                stbi_image_free(textureDecodeTask.get().pixels);
+            } catch (const std::runtime_error&) {
+            }
+        }
+
+        // The device is idle here, so everything still queued can be released
+        collectDeferredReleases(std::numeric_limits<uint64_t>::max());
+
+        vkDestroySampler(device, textureSampler, nullptr);
+        vkDestroySampler(device, sceneColorSampler, nullptr);
+        vkDestroyImageView(device, textureImageView, nullptr);
+
+        vkDestroyImage(device, textureImage, nullptr);
+        vkFreeMemory(device, textureImageMemory, nullptr);
+
+        vkDestroyImageView(device, placeholderTextureImageView, nullptr);
+        vkDestroyImage(device, placeholderTextureImage, nullptr);
+        vkFreeMemory(device, placeholderTextureImageMemory, nullptr);
+
+        vkDestroyDescriptorUpdateTemplate(device, descriptorUpdateTemplate, nullptr);
+        descriptorSetLayoutCache.destroy(device);
+
+        vkDestroyBuffer(device, indexBuffer, nullptr);
+        vkFreeMemory(device, indexBufferMemory, nullptr);
+
+        vkDestroyBuffer(device, vertexBuffer, nullptr);
+        vkFreeMemory(device, vertexBufferMemory, nullptr);
+
+        vkDestroyBuffer(device, instanceBuffer, nullptr);
+        vkFreeMemory(device, instanceBufferMemory, nullptr);
+
+        if (options.gpuCulling) {
+            destroyCullBuffers();
+            vkDestroyPipeline(device, cullPipeline, nullptr);
+            vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+        }
+
+        if (options.meshlets) {
+            destroyMeshletObjectBuffer();
+            vkDestroyBuffer(device, meshletBuffer, nullptr);
+            vkFreeMemory(device, meshletBufferMemory, nullptr);
+            vkDestroyBuffer(device, meshletVertexBuffer, nullptr);
+            vkFreeMemory(device, meshletVertexBufferMemory, nullptr);
+            vkDestroyBuffer(device, meshletTriangleBuffer, nullptr);
+            vkFreeMemory(device, meshletTriangleBufferMemory, nullptr);
+            vkDestroyPipeline(device, meshletCullPipeline, nullptr);
+            vkDestroyPipelineLayout(device, meshletCullPipelineLayout, nullptr);
+        }
+
+        vkDestroyPipeline(device, clusterPipeline, nullptr);
+        vkDestroyPipelineLayout(device, clusterPipelineLayout, nullptr);
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+            vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+        }
+        vkDestroySemaphore(device, timelineSemaphore, nullptr);
+
+        vkDestroyImage(device, shadowMapColorImage, nullptr);
+        vkDestroyImage(device, shadowMapDepthImage, nullptr);
+        vkFreeMemory(device, shadowMapColorImageMemory, nullptr);
+        vkFreeMemory(device, shadowMapDepthImageMemory, nullptr);
+        vkDestroyImageView(device, shadowMapColorImageView, nullptr);
+        vkDestroyImageView(device, shadowMapDepthImageView, nullptr);
+        vkDestroyFramebuffer(device, shadowMapFramebuffer, nullptr);
+
+        vkDestroyBuffer(device, shadowMapUniformBuffer, nullptr);
+        vkFreeMemory(device, shadowMapUniformBufferMemory, nullptr);
+
+        vkDestroyPipeline(device, shadowMapGraphicsPipeline, nullptr);
+        vkDestroyPipelineLayout(device, shadowMapPipelineLayout, nullptr);
+        vkDestroyRenderPass(device, shadowMapRenderPass, nullptr);
+
+        vkDestroyDescriptorPool(device, shadowMapDescriptorPool, nullptr);
+
+        destroyCubeShadowResources();
+
+        vkDestroyCommandPool(device, commandPool, nullptr);
+
+        vkDestroyDevice(device, nullptr);
+
+        if (enableValidationLayers) {
+            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+        }
+
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+        vkDestroyInstance(instance, nullptr);
+
+        glfwDestroyWindow(window);
+
+        glfwTerminate();
+    }
+
+    void createInstance() {
+        if (enableValidationLayers && !checkValidationLayerSupport()) {
+            throw std::runtime_error("validation layers requested, but not available!");
+        }
+
+        VkApplicationInfo appInfo = {};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.pApplicationName = "Hello Triangle";
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName = "No Engine";
+        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.apiVersion = VK_API_VERSION_1_2;
+
+        VkInstanceCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        createInfo.pApplicationInfo = &appInfo;
+
+        auto extensions = getRequiredExtensions();
+        createInfo.enabledExtensionCount = extensions.size();
+        createInfo.ppEnabledExtensionNames = extensions.data();
+
+        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
+        if (enableValidationLayers) {
+            createInfo.enabledLayerCount = validationLayers.size();
+            createInfo.ppEnabledLayerNames = validationLayers.data();
+
+            populateDebugMessengerCreateInfo(debugCreateInfo);
+            createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &debugCreateInfo;
+        } else {
+            createInfo.enabledLayerCount = 0;
+            createInfo.pNext = nullptr;
+        }
+
+        if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create instance!");
+        }
+    }
+
+    void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
+        createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+        createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+        createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+        createInfo.pfnUserCallback = debugCallback;
+    }
+
+    void setupDebugMessenger() {
+        if (!enableValidationLayers) return;
+
+        VkDebugUtilsMessengerCreateInfoEXT createInfo;
+        populateDebugMessengerCreateInfo(createInfo);
+
+        if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS) {
+            throw std::runtime_error("failed to set up debug messenger!");
+        }
+    }
+
+    void createSurface() {
+        if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create window surface!");
+        }
+    }
+
+    void pickPhysicalDevice() {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+        if (deviceCount == 0) {
+            throw std::runtime_error("failed to find GPUs with Vulkan support!");
+        }
+
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+        for (const auto& device : devices) {
+            if (isDeviceSuitable(device)) {
+                physicalDevice = device;
+                break;
+            }
+        }
+
+        if (physicalDevice == VK_NULL_HANDLE) {
+            throw std::runtime_error("failed to find a suitable GPU!");
+        }
+
+        msaaSamples = chooseSampleCount(options.sampleCount);
+    }
+
+    // Both the color and the depth attachment are multisampled, so the count must suit both
+    VkSampleCountFlags supportedSampleCounts() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        return properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+    }
+
+    // Falls back to the highest supported count below the requested one
+    VkSampleCountFlagBits chooseSampleCount(uint32_t requested) {
+        VkSampleCountFlags supported = supportedSampleCounts();
+        uint32_t sampleCount = requested;
+        while (sampleCount > 1 && !(supported & sampleCount)) {
+            sampleCount /= 2;
+        }
+
+        if (sampleCount != requested) {
+            std::cout << requested << "x MSAA is not supported, using " << sampleCount << "x" << std::endl;
+        }
+        return static_cast<VkSampleCountFlagBits>(sampleCount);
+    }
+
+    void createLogicalDevice() {
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+        std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+
+        float queuePriority = 1.0f;
+        for (int queueFamily : uniqueQueueFamilies) {
+            VkDeviceQueueCreateInfo queueCreateInfo = {};
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.queueFamilyIndex = queueFamily;
+            queueCreateInfo.queueCount = 1;
+            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+
+        VkPhysicalDeviceFeatures deviceFeatures = {};
+        deviceFeatures.samplerAnisotropy = VK_TRUE;
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        vulkan12Features.timelineSemaphore = VK_TRUE;
+
+        VkDeviceCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = &vulkan12Features;
+
+        // Pipeline statistics are optional. While a query is active, secondary command
+        // buffers can only be executed with inherited queries.
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        bool needsInheritedQueries = options.recordThreadCount > 0 || options.benchmarkRecording;
+        pipelineStatisticsEnabled = supportedFeatures.pipelineStatisticsQuery && (!needsInheritedQueries || supportedFeatures.inheritedQueries);
+        deviceFeatures.pipelineStatisticsQuery = pipelineStatisticsEnabled;
+        deviceFeatures.inheritedQueries = pipelineStatisticsEnabled && needsInheritedQueries;
+        if (options.printStats && !pipelineStatisticsEnabled) {
+            std::cout << "pipeline statistics queries are not supported, work counts are not reported" << std::endl;
+        }
+
+        if (options.gpuCulling || options.cpuCulling || options.meshlets) {
+            deviceFeatures.multiDrawIndirect = VK_TRUE;
+            deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+            vulkan12Features.drawIndirectCount = VK_TRUE;
+        }
+
+        // The compute path only needs indirect count draws, which isDeviceSuitable() checked. The
+        // mesh shader path needs VK_EXT_mesh_shader with task shaders, and is not combined with the
+        // depth pre-pass, whose EQUAL test relies on the vertex pipeline producing the same depth.
+        VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures = {};
+        meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+        if (options.meshlets) {
+            meshletPathSupported[MESHLET_PATH_OBJECTS] = true;
+            meshletPathSupported[MESHLET_PATH_COMPUTE] = true;
+            meshletPathSupported[MESHLET_PATH_MESH_SHADER] = !options.depthPrepass && checkMeshShaderSupport(physicalDevice);
+            meshletPath = chooseMeshletPath(options.meshletPath);
+
+            if (meshletPathSupported[MESHLET_PATH_MESH_SHADER]) {
+                meshShaderFeatures.taskShader = VK_TRUE;
+                meshShaderFeatures.meshShader = VK_TRUE;
+                meshShaderFeatures.pNext = const_cast<void*>(createInfo.pNext);
+                createInfo.pNext = &meshShaderFeatures;
+            }
+        }
+
+        // Multiview is core since Vulkan 1.1 but still optional, and gl_Layer in a vertex shader
+        // needs VK_EXT_shader_viewport_index_layer. Six render passes work everywhere.
+        VkPhysicalDeviceVulkan11Features vulkan11Features = {};
+        vulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+        if (options.cubeShadows) {
+            VkPhysicalDeviceVulkan11Features supportedVulkan11Features = {};
+            supportedVulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+            VkPhysicalDeviceFeatures2 features = {};
+            features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features.pNext = &supportedVulkan11Features;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+            cubeShadowModeSupported[CUBE_SHADOW_MULTIVIEW] = supportedVulkan11Features.multiview;
+            cubeShadowModeSupported[CUBE_SHADOW_LAYERED] = checkDeviceExtensionSupport(physicalDevice, VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME);
+            cubeShadowModeSupported[CUBE_SHADOW_SIX_PASSES] = true;
+            cubeShadowMode = chooseCubeShadowMode(options.cubeShadowMode);
+
+            vulkan11Features.multiview = cubeShadowModeSupported[CUBE_SHADOW_MULTIVIEW];
+            vulkan12Features.pNext = &vulkan11Features;
+            deviceFeatures.multiDrawIndirect = VK_TRUE;
+            deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+        }
+
+        createInfo.pQueueCreateInfos = queueCreateInfos.data();
+        createInfo.queueCreateInfoCount = (uint32_t) queueCreateInfos.size();
+
+        createInfo.pEnabledFeatures = &deviceFeatures;
+
+        // VK_GOOGLE_display_timing is optional and only used to measure present latency
+        std::vector<const char*> enabledExtensions = deviceExtensions;
+        displayTimingEnabled = checkDeviceExtensionSupport(physicalDevice, VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+        if (displayTimingEnabled) {
+            enabledExtensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+        }
+
+        // VK_EXT_calibrated_timestamps maps GPU timestamps to the CPU clock for traces
+        calibratedTimestampsEnabled = checkCalibratedTimestampSupport(physicalDevice);
+        if (calibratedTimestampsEnabled) {
+            enabledExtensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+        }
+
+        if (cubeShadowModeSupported[CUBE_SHADOW_LAYERED]) {
+            enabledExtensions.push_back(VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME);
+        }
+
+        if (meshletPathSupported[MESHLET_PATH_MESH_SHADER]) {
+            enabledExtensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+        }
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
+        if (enableValidationLayers) {
+            createInfo.enabledLayerCount = validationLayers.size();
+            createInfo.ppEnabledLayerNames = validationLayers.data();
+        } else {
+            createInfo.enabledLayerCount = 0;
+        }
+
+        if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create logical device!");
+        }
+
+        vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+        vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+        if (displayTimingEnabled) {
+            vkGetPastPresentationTimingGOOGLE = (PFN_vkGetPastPresentationTimingGOOGLE)vkGetDeviceProcAddr(device, "vkGetPastPresentationTimingGOOGLE");
+            displayTimingEnabled = vkGetPastPresentationTimingGOOGLE != nullptr;
+        }
+
+        if (calibratedTimestampsEnabled) {
+            vkGetCalibratedTimestampsEXT = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT");
+            calibratedTimestampsEnabled = vkGetCalibratedTimestampsEXT != nullptr;
+        }
+
+        if (meshletPathSupported[MESHLET_PATH_MESH_SHADER]) {
+            vkCmdDrawMeshTasksEXT = (PFN_vkCmdDrawMeshTasksEXT)vkGetDeviceProcAddr(device, "vkCmdDrawMeshTasksEXT");
+            if (vkCmdDrawMeshTasksEXT == nullptr) {
+                throw std::runtime_error("failed to load vkCmdDrawMeshTasksEXT!");
+            }
+
+            VkPhysicalDeviceMeshShaderPropertiesEXT meshShaderProperties = {};
+            meshShaderProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT;
+            VkPhysicalDeviceProperties2 properties2 = {};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties2.pNext = &meshShaderProperties;
+            vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+            maxTaskWorkGroupTotalCount = meshShaderProperties.maxTaskWorkGroupTotalCount;
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        gpuTimestampsSupported = queueFamilies[indices.graphicsFamily.value()].timestampValidBits > 0;
+    }
+
+    // A requested mode must be supported; otherwise the first supported one is used
+    CubeShadowMode chooseCubeShadowMode(std::optional<CubeShadowMode> requested) {
+        if (requested) {
+            if (!cubeShadowModeSupported[*requested]) {
+                throw std::runtime_error(std::string("cube shadow mode ") + CUBE_SHADOW_MODE_NAMES[*requested] + " is not supported by the device");
+            }
+            return *requested;
+        }
+
+        uint32_t mode = 0;
+        while (!cubeShadowModeSupported[mode]) {
+            mode++;
+        }
+        return static_cast<CubeShadowMode>(mode);
+    }
+
+    // A requested path must be supported; otherwise mesh shaders are preferred over the compute pass
+    MeshletPath chooseMeshletPath(std::optional<MeshletPath> requested) {
+        if (requested) {
+            if (!meshletPathSupported[*requested]) {
+                throw std::runtime_error(std::string("meshlet path ") + MESHLET_PATH_NAMES[*requested] + " is not supported by the device");
+            }
+            return *requested;
+        }
+        return meshletPathSupported[MESHLET_PATH_MESH_SHADER] ? MESHLET_PATH_MESH_SHADER : MESHLET_PATH_COMPUTE;
+    }
+
+    void createSwapChain() {
+        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+
+        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
+        VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+        VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+
+        uint32_t imageCount = options.swapChainImageCount > 0 ? options.swapChainImageCount : swapChainSupport.capabilities.minImageCount + 1;
+        imageCount = std::max(imageCount, swapChainSupport.capabilities.minImageCount);
+        if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
+            imageCount = swapChainSupport.capabilities.maxImageCount;
+        }
+        if (options.swapChainImageCount > 0 && imageCount != options.swapChainImageCount) {
+            std::cerr << "requested " << options.swapChainImageCount << " swap chain images, using " << imageCount << std::endl;
+        }
+
+        VkSwapchainCreateInfoKHR createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        createInfo.surface = surface;
+
+        createInfo.minImageCount = imageCount;
+        createInfo.imageFormat = surfaceFormat.format;
+        createInfo.imageColorSpace = surfaceFormat.colorSpace;
+        createInfo.imageExtent = extent;
+        createInfo.imageArrayLayers = 1;
+        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+
+        if (indices.graphicsFamily != indices.presentFamily) {
+            createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+            createInfo.queueFamilyIndexCount = 2;
+            createInfo.pQueueFamilyIndices = queueFamilyIndices;
+        } else {
+            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+
+        createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+        createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        createInfo.presentMode = presentMode;
+        createInfo.clipped = VK_TRUE;
+
+        VkSwapchainKHR newSwapChain;
+        if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create swap chain!");
+        }
+
+        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+        swapChainImages.resize(imageCount);
+        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+
+        swapChainImageFormat = surfaceFormat.format;
+        swapChainExtent = extent;
+        swapChainPresentMode = presentMode;
+
+        // Present IDs of the old swap chain never report timings
+        presentAcquireTimes.fill(0);
+
+        if (options.printStats) {
+            std::cout << "swap chain: " << presentModeName(presentMode) << ", " << imageCount << " images"
+                      << (displayTimingEnabled ? ", display timing available" : "") << std::endl;
+        }
+    }
+
+    void createImageViews() {
+        swapChainImageViews.resize(swapChainImages.size());
+
+        for (uint32_t i = 0; i < swapChainImages.size(); i++) {
+            swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        }
+    }
+
+    // With MSAA the samples never leave the render pass: the color attachment is resolved
+    // into the swap chain image (attachment 2) at the end of the shading subpass. With dynamic
+    // resolution sceneColorImage takes the place of the swap chain image.
+    void createRenderPass() {
+        bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+        VkImageLayout outputLayout = options.dynamicResolution ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = swapChainImageFormat;
+        colorAttachment.samples = msaaSamples;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : outputLayout;
+
+        VkAttachmentDescription depthAttachment = {};
+        depthAttachment.format = findDepthFormat();
+        depthAttachment.samples = msaaSamples;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentDescription colorAttachmentResolve = {};
+        colorAttachmentResolve.format = swapChainImageFormat;
+        colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachmentResolve.finalLayout = outputLayout;
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentRef = {};
+        depthAttachmentRef.attachment = 1;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference colorAttachmentResolveRef = {};
+        colorAttachmentResolveRef.attachment = 2;
+        colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+        subpass.pResolveAttachments = multisampled ? &colorAttachmentResolveRef : nullptr;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+        VkSubpassDependency dependency = {};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = mainSubpass();
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = 0;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        // The depth attachment is cleared and written from subpass 0 on, which is the pre-pass when
+        // there is one; the previous frame's depth tests must have finished by then
+        VkSubpassDependency depthDependency = {};
+        depthDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        depthDependency.dstSubpass = 0;
+        depthDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        depthDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        depthDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+        std::vector<VkSubpassDescription> subpasses = {subpass};
+        std::vector<VkSubpassDependency> dependencies = {dependency, depthDependency};
+
+        // The previous frame's upscale pass may still be reading sceneColorImage, and this
+        // frame's upscale pass reads it once the render pass has written it
+        if (options.dynamicResolution) {
+            dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+            VkSubpassDependency outputDependency = {};
+            outputDependency.srcSubpass = mainSubpass();
+            outputDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+            outputDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            outputDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            outputDependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            outputDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            dependencies.push_back(outputDependency);
+        }
+
+        // The depth pre-pass only writes depth, which the shading subpass then tests for equality
+        if (options.depthPrepass) {
+            VkSubpassDescription prepassSubpass = {};
+            prepassSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            prepassSubpass.pDepthStencilAttachment = &depthAttachmentRef;
+            subpasses.insert(subpasses.begin(), prepassSubpass);
+
+            VkSubpassDependency prepassDependency = {};
+            prepassDependency.srcSubpass = 0;
+            prepassDependency.dstSubpass = 1;
+            prepassDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            prepassDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            prepassDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            prepassDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+            prepassDependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+            dependencies.push_back(prepassDependency);
+        }
+
+        std::vector<VkAttachmentDescription> attachments = {colorAttachment, depthAttachment};
+        if (multisampled) {
+            attachments.push_back(colorAttachmentResolve);
+        }
+
+        VkRenderPassCreateInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+        renderPassInfo.pSubpasses = subpasses.data();
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create render pass!");
+        }
+    }
+
+    // Every pixel is written by the full-screen triangle, so the previous contents are not loaded
+    void createUpscaleRenderPass() {
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = swapChainImageFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+
+        VkSubpassDependency dependency = {};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = 0;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &colorAttachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = 1;
+        renderPassInfo.pDependencies = &dependency;
+
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &upscaleRenderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upscale render pass!");
+        }
+    }
+
+    // With an update budget the atlas is loaded and only the re-rendered tiles are cleared
+    void createShadowMapRenderPass() {
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = shadowMapColorFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = cachesShadowTiles() ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = cachesShadowTiles() ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkAttachmentDescription depthAttachment = {};
+        depthAttachment.format = shadowMapDepthFormat;
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentRef = {};
+        depthAttachmentRef.attachment = 1;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+        VkSubpassDependency dependency = {};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = 0;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        if (cachesShadowTiles()) {
+            // The kept tiles were sampled by the previous main pass
+            dependency.srcStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        }
+
+        std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
+        VkRenderPassCreateInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = attachments.size();
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = 1;
+        renderPassInfo.pDependencies = &dependency;
+
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &shadowMapRenderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shadow map render pass!");
+        }
+    }
+
+    // The bindings are reflected from the SPIR-V, so the layouts follow the shaders
+    // and identical layouts are shared through descriptorSetLayoutCache
+    void createDescriptorSetLayout() {
+        descriptorBindings = reflectDescriptorSetBindings({"render.vert.spv", "render.frag.spv"});
+        descriptorSetLayout = descriptorSetLayoutCache.get(device, descriptorBindings);
+    }
+
+    void createShadowMapDescriptorSetLayout() {
+        shadowMapDescriptorBindings = reflectDescriptorSetBindings({"shadow.vert.spv", "shadow.frag.spv"});
+        shadowMapDescriptorSetLayout = descriptorSetLayoutCache.get(device, shadowMapDescriptorBindings);
+    }
+
+    void createUpscaleDescriptorSetLayout() {
+        upscaleDescriptorBindings = reflectDescriptorSetBindings({"upscale.vert.spv", "upscale.frag.spv"});
+        upscaleDescriptorSetLayout = descriptorSetLayoutCache.get(device, upscaleDescriptorBindings);
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> reflectDescriptorSetBindings(const std::vector<std::string> &names, uint32_t set = 0) {
+        std::vector<ReflectedBinding> reflected;
+        for (const auto &name : names) {
+            std::vector<char> storage;
+            size_t size;
+            const uint32_t *code = findShaderCode(name, size, storage);
+
+            auto bindings = reflectDescriptorBindings(code, size, shaderStageFromName(name));
+            reflected.insert(reflected.end(), bindings.begin(), bindings.end());
+        }
+
+        return mergeDescriptorBindings(reflected, set);
+    }
+
+    void createGraphicsPipeline() {
+        VkDescriptorSetLayout setLayouts[] = {descriptorSetLayout};
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = setLayouts;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+
+        graphicsPipeline = buildGraphicsPipeline(loadShaderModule("render.vert.spv"), loadShaderModule("render.frag.spv"));
+    }
+
+    // Takes ownership of the shader modules. Only reads state that is stable while the swap chain
+    // is alive, so it may also run on the shader reload thread.
+    VkPipeline buildGraphicsPipeline(VkShaderModule vertShaderModule, VkShaderModule fragShaderModule) {
+        // USE_PUSH_CONSTANTS selects where the vertex shader reads the per-object data from
+        VkBool32 usePushConstants = options.pushConstants ? VK_TRUE : VK_FALSE;
+        VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(VkBool32) };
+        VkSpecializationInfo specializationInfo = { 1, &specializationEntry, sizeof(VkBool32), &usePushConstants };
+
+        // USE_CLUSTERED_LIGHTS adds the binned point lights in render.frag, USE_CUBE_SHADOW
+        // shadows the key light from the cube map
+        std::array<VkBool32, 2> fragConstants = {
+            options.clusteredLighting ? VK_TRUE : VK_FALSE,
+            options.cubeShadows ? VK_TRUE : VK_FALSE
+        };
+        std::array<VkSpecializationMapEntry, 2> fragSpecializationEntries = {{
+            { 1, 0, sizeof(VkBool32) },
+            { 2, sizeof(VkBool32), sizeof(VkBool32) }
+        }};
+        VkSpecializationInfo fragSpecializationInfo = { static_cast<uint32_t>(fragSpecializationEntries.size()), fragSpecializationEntries.data(), sizeof(fragConstants), fragConstants.data() };
+
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+        vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+        fragShaderStageInfo.pSpecializationInfo = &fragSpecializationInfo;
+
+        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        auto bindingDescription = Vertex::getBindingDescription();
+        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        VkViewport viewport = {};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) swapChainExtent.width;
+        viewport.height = (float) swapChainExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor = {};
+        scissor.offset = {0, 0};
+        scissor.extent = swapChainExtent;
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports = &viewport;
+        viewportState.scissorCount = 1;
+        viewportState.pScissors = &scissor;
+
+        // renderExtent() changes every frame with dynamic resolution
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState = {};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = msaaSamples;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = options.depthPrepass ? VK_FALSE : VK_TRUE;
+        depthStencil.depthCompareOp = options.depthPrepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+        colorBlending.blendConstants[0] = 0.0f;
+        colorBlending.blendConstants[1] = 0.0f;
+        colorBlending.blendConstants[2] = 0.0f;
+        colorBlending.blendConstants[3] = 0.0f;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = pipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = mainSubpass();
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+
+        return pipeline;
+    }
+
+    void createShadowMapGraphicsPipeline() {
+        VkDescriptorSetLayout setLayouts[] = {shadowMapDescriptorSetLayout};
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = setLayouts;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &shadowMapPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+
+        shadowMapGraphicsPipeline = buildShadowMapGraphicsPipeline(loadShaderModule("shadow.vert.spv"), loadShaderModule("shadow.frag.spv"));
+    }
+
+    // Takes ownership of the shader modules, like buildGraphicsPipeline()
+    VkPipeline buildShadowMapGraphicsPipeline(VkShaderModule vertShaderModule, VkShaderModule fragShaderModule) {
+        VkBool32 usePushConstants = options.pushConstants ? VK_TRUE : VK_FALSE;
+        VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(VkBool32) };
+        VkSpecializationInfo specializationInfo = { 1, &specializationEntry, sizeof(VkBool32), &usePushConstants };
+
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+        vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        auto bindingDescription = Vertex::getBindingDescription();
+        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        // Every light renders into its own tile of the atlas, set by recordShadowTile()
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState = {};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+        colorBlending.blendConstants[0] = 0.0f;
+        colorBlending.blendConstants[1] = 0.0f;
+        colorBlending.blendConstants[2] = 0.0f;
+        colorBlending.blendConstants[3] = 0.0f;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = shadowMapPipelineLayout;
+        pipelineInfo.renderPass = shadowMapRenderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+
+        return pipeline;
+    }
+
+    void createDepthPrepassPipeline() {
+        if (options.depthPrepass) {
+            depthPrepassPipeline = buildDepthPrepassPipeline(loadShaderModule("shadow.vert.spv"));
+        }
+    }
+
+    // Position-only pipeline of shadow.vert, rendering the camera view into subpass 0 of renderPass.
+    // Takes ownership of the shader module.
+    VkPipeline buildDepthPrepassPipeline(VkShaderModule vertShaderModule) {
+        VkBool32 usePushConstants = options.pushConstants ? VK_TRUE : VK_FALSE;
+        VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(VkBool32) };
+        VkSpecializationInfo specializationInfo = { 1, &specializationEntry, sizeof(VkBool32), &usePushConstants };
+
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+        vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        auto bindingDescription = Vertex::getBindingDescription();
+        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        VkViewport viewport = {};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) swapChainExtent.width;
+        viewport.height = (float) swapChainExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor = {};
+        scissor.offset = {0, 0};
+        scissor.extent = swapChainExtent;
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports = &viewport;
+        viewportState.scissorCount = 1;
+        viewportState.pScissors = &scissor;
+
+        // renderExtent() changes every frame with dynamic resolution
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState = {};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        // Must rasterize exactly like the main pipeline for the EQUAL depth test to pass
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = msaaSamples;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.attachmentCount = 0;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 1;
+        pipelineInfo.pStages = &vertShaderStageInfo;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = shadowMapPipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create depth pre-pass pipeline!");
+        }
+
+        return pipeline;
+    }
+
+    void createUpscalePipeline() {
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(UpscalePushConstants) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &upscaleDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &upscalePipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upscale pipeline layout!");
+        }
+
+        VkShaderModule vertShaderModule = loadShaderModule("upscale.vert.spv");
+        VkShaderModule fragShaderModule = loadShaderModule("upscale.frag.spv");
+
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+        // The triangle is generated from gl_VertexIndex
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        VkViewport viewport = {};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) swapChainExtent.width;
+        viewport.height = (float) swapChainExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor = {};
+        scissor.offset = {0, 0};
+        scissor.extent = swapChainExtent;
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports = &viewport;
+        viewportState.scissorCount = 1;
+        viewportState.pScissors = &scissor;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_NONE;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.layout = upscalePipelineLayout;
+        pipelineInfo.renderPass = upscaleRenderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &upscalePipeline);
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upscale pipeline!");
+        }
+    }
+
+    void createUpscaleFramebuffers() {
+        upscaleFramebuffers.resize(swapChainImageViews.size());
+
+        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+            VkFramebufferCreateInfo framebufferInfo = {};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = upscaleRenderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = &swapChainImageViews[i];
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &upscaleFramebuffers[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create upscale framebuffer!");
+            }
+        }
+    }
+
+    // Subpass of renderPass that shades the camera view
+    uint32_t mainSubpass() const {
+        return options.depthPrepass ? 1 : 0;
+    }
+
+    void createFramebuffers() {
+        swapChainFramebuffers.resize(swapChainImageViews.size());
+
+        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+            // Every framebuffer renders to sceneColorImage with dynamic resolution; they only differ
+            // in the swap chain image otherwise
+            VkImageView outputView = options.dynamicResolution ? sceneColorImageView : swapChainImageViews[i];
+            std::vector<VkImageView> attachments = {
+                outputView,
+                depthImageView
+            };
+            if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+                attachments = { colorImageView, depthImageView, outputView };
+            }
+
+            VkFramebufferCreateInfo framebufferInfo = {};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+            framebufferInfo.pAttachments = attachments.data();
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
+        }
+    }
+
+    void createCommandPool() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics command pool!");
+        }
+    }
+
+    // The multisampled color image is only ever touched inside the render pass, so on
+    // tile-based GPUs it can live in lazily allocated memory and never be backed at all
+    void createColorResources() {
+        if (msaaSamples == VK_SAMPLE_COUNT_1_BIT) {
+            return;
+        }
+
+        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, colorImage, colorImageMemory);
+        colorImageView = createImageView(colorImage, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+
+    // Depth is cleared on load and discarded on store, so it is transient like the MSAA color image
+    void createDepthResources() {
+        VkFormat depthFormat = findDepthFormat();
+
+        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, depthImage, depthImageMemory);
+        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+        transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+    }
+
+    void createSceneColorResources() {
+        if (!options.dynamicResolution) {
+            return;
+        }
+
+        createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sceneColorImage, sceneColorImageMemory);
+        sceneColorImageView = createImageView(sceneColorImage, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+
+    void createResolutionScaleController() {
+        resolutionScaleController = ResolutionScaleController(options.resolutionTargetMs, options.minResolutionScale, options.maxResolutionScale);
+
+        if (!gpuTimestampsSupported) {
+            std::cout << "GPU timestamps are not supported, the resolution scale stays at " << options.maxResolutionScale << std::endl;
+        }
+    }
+
+    void createSceneColorSampler() {
+        VkSamplerCreateInfo samplerInfo = {};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.anisotropyEnable = VK_FALSE;
+        samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+        samplerInfo.unnormalizedCoordinates = VK_FALSE;
+        samplerInfo.compareEnable = VK_FALSE;
+        samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &sceneColorSampler) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create scene color sampler!");
+        }
+    }
+
+    void createShadowMapResources() {
+        shadowMapColorFormat = findSupportedFormat({VK_FORMAT_R32G32_SFLOAT}, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+        shadowMapDepthFormat = findSupportedFormat({VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT}, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        createImage(shadowAtlasSize(), shadowAtlasSize(), 1, VK_SAMPLE_COUNT_1_BIT, shadowMapColorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapColorImage, shadowMapColorImageMemory);
+        createImage(shadowAtlasSize(), shadowAtlasSize(), 1, VK_SAMPLE_COUNT_1_BIT, shadowMapDepthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapDepthImage, shadowMapDepthImageMemory);
+        shadowMapColorImageView = createImageView(shadowMapColorImage, shadowMapColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        shadowMapDepthImageView = createImageView(shadowMapDepthImage, shadowMapDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+        //transitionImageLayout(shadowMapColorImage, shadowMapColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1);
+        //transitionImageLayout(shadowMapDepthImage, shadowMapDepthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+
+        // The render pass loads the atlas when tiles are kept, so it starts in its final layout.
+        // Without a tile for the key light the atlas may not be rendered at all.
+        if (cachesShadowTiles() || options.cubeShadows) {
+            transitionImageLayout(shadowMapColorImage, shadowMapColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+        }
+    }
+
+    uint32_t shadowAtlasSize() const {
+        return options.shadowLightCount > 1 ? SHADOW_ATLAS_SIZE : SHADOW_MAP_SIZE;
+    }
+
+    bool cachesShadowTiles() const {
+        return options.shadowBudgetMtexels > 0.0f;
+    }
+
+    void createShadowMapFramebuffer() {
+        std::array<VkImageView, 2> attachments = {
+            shadowMapColorImageView,
+            shadowMapDepthImageView
+        };
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = shadowMapRenderPass;
+        framebufferInfo.attachmentCount = attachments.size();
+        framebufferInfo.pAttachments = attachments.data();
+        framebufferInfo.width = shadowAtlasSize();
+        framebufferInfo.height = shadowAtlasSize();
+        framebufferInfo.layers = 1;
+
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &shadowMapFramebuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to crate shadow map framebuffer!");
+        }
+    }
+
+    // Moments and depth like the shadow map, with one layer per face. render.frag declares the
+    // cube map in any case, so without --cube-shadows a 1x1 placeholder is created instead.
+    void createCubeShadowResources() {
+        uint32_t size = options.cubeShadows ? CUBE_SHADOW_SIZE : 1;
+        createImage(size, size, 1, VK_SAMPLE_COUNT_1_BIT, shadowMapColorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cubeShadowColorImage, cubeShadowColorImageMemory, 6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+        cubeShadowCubeView = createImageView(cubeShadowColorImage, shadowMapColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_CUBE, 0, 6);
+
+        if (!options.cubeShadows) {
+            transitionImageLayout(cubeShadowColorImage, shadowMapColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, 6);
+            return;
+        }
+
+        createImage(size, size, 1, VK_SAMPLE_COUNT_1_BIT, shadowMapDepthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cubeShadowDepthImage, cubeShadowDepthImageMemory, 6);
+
+        // Multiview and layered rendering target all six layers, the other mode one at a time
+        cubeShadowColorArrayView = createImageView(cubeShadowColorImage, shadowMapColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, 6);
+        cubeShadowDepthArrayView = createImageView(cubeShadowDepthImage, shadowMapDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, 6);
+        for (uint32_t face = 0; face < 6; face++) {
+            cubeShadowColorFaceViews[face] = createImageView(cubeShadowColorImage, shadowMapColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_2D, face, 1);
+            cubeShadowDepthFaceViews[face] = createImageView(cubeShadowDepthImage, shadowMapDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1, VK_IMAGE_VIEW_TYPE_2D, face, 1);
+        }
+    }
+
+    void createCubeShadowRenderPasses() {
+        cubeShadowRenderPass = createCubeShadowRenderPass(0);
+        if (cubeShadowModeSupported[CUBE_SHADOW_MULTIVIEW]) {
+            cubeShadowMultiviewRenderPass = createCubeShadowRenderPass(0x3f);
+        }
+    }
+
+    // Same attachments as the shadow map render pass. A nonzero view mask makes it a multiview
+    // render pass, which broadcasts every draw to the layers in the mask.
+    VkRenderPass createCubeShadowRenderPass(uint32_t viewMask) {
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = shadowMapColorFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkAttachmentDescription depthAttachment = {};
+        depthAttachment.format = shadowMapDepthFormat;
+        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference depthAttachmentRef = {};
+        depthAttachmentRef.attachment = 1;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+        VkSubpassDependency dependency = {};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = 0;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
         std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
         VkRenderPassCreateInfo renderPassInfo = {};
@@ -660,1319 +5058,3773 @@ private:
         renderPassInfo.dependencyCount = 1;
         renderPassInfo.pDependencies = &dependency;
 
-        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create render pass!");
+        // The faces see disjoint parts of the scene, so they are not marked as correlated
+        VkRenderPassMultiviewCreateInfo multiviewInfo = {};
+        multiviewInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+        multiviewInfo.subpassCount = 1;
+        multiviewInfo.pViewMasks = &viewMask;
+        if (viewMask != 0) {
+            renderPassInfo.pNext = &multiviewInfo;
+        }
+
+        VkRenderPass cubeRenderPass;
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &cubeRenderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create cube shadow render pass!");
+        }
+        return cubeRenderPass;
+    }
+
+    void createCubeShadowFramebuffers() {
+        if (cubeShadowModeSupported[CUBE_SHADOW_MULTIVIEW]) {
+            cubeShadowMultiviewFramebuffer = createCubeShadowFramebuffer(cubeShadowMultiviewRenderPass, cubeShadowColorArrayView, cubeShadowDepthArrayView, 1);
+        }
+        if (cubeShadowModeSupported[CUBE_SHADOW_LAYERED]) {
+            cubeShadowLayeredFramebuffer = createCubeShadowFramebuffer(cubeShadowRenderPass, cubeShadowColorArrayView, cubeShadowDepthArrayView, 6);
+        }
+        for (uint32_t face = 0; face < 6; face++) {
+            cubeShadowFaceFramebuffers[face] = createCubeShadowFramebuffer(cubeShadowRenderPass, cubeShadowColorFaceViews[face], cubeShadowDepthFaceViews[face], 1);
+        }
+    }
+
+    // A multiview framebuffer has a single layer; the views select the layers of the attachments
+    VkFramebuffer createCubeShadowFramebuffer(VkRenderPass cubeRenderPass, VkImageView colorView, VkImageView depthView, uint32_t layers) {
+        std::array<VkImageView, 2> attachments = { colorView, depthView };
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = cubeRenderPass;
+        framebufferInfo.attachmentCount = attachments.size();
+        framebufferInfo.pAttachments = attachments.data();
+        framebufferInfo.width = CUBE_SHADOW_SIZE;
+        framebufferInfo.height = CUBE_SHADOW_SIZE;
+        framebufferInfo.layers = layers;
+
+        VkFramebuffer framebuffer;
+        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create cube shadow framebuffer!");
+        }
+        return framebuffer;
+    }
+
+    // All vertex shader variants declare the same bindings
+    void createCubeShadowDescriptorSetLayout() {
+        cubeShadowDescriptorBindings = reflectDescriptorSetBindings({"cube_shadow_face.vert.spv", "cube_shadow.frag.spv"});
+        cubeShadowDescriptorSetLayout = descriptorSetLayoutCache.get(device, cubeShadowDescriptorBindings);
+    }
+
+    // Every supported mode gets its pipeline, so that the benchmark can switch between them
+    void createCubeShadowPipelines() {
+        VkDescriptorSetLayout setLayouts[] = {cubeShadowDescriptorSetLayout};
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = setLayouts;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cubeShadowPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+
+        const char *const vertexShaders[CUBE_SHADOW_MODE_COUNT] = { "cube_shadow.vert.spv", "cube_shadow_layered.vert.spv", "cube_shadow_face.vert.spv" };
+        for (uint32_t mode = 0; mode < CUBE_SHADOW_MODE_COUNT; mode++) {
+            if (cubeShadowModeSupported[mode]) {
+                VkRenderPass cubeRenderPass = mode == CUBE_SHADOW_MULTIVIEW ? cubeShadowMultiviewRenderPass : cubeShadowRenderPass;
+                cubeShadowPipelines[mode] = buildCubeShadowPipeline(loadShaderModule(vertexShaders[mode]), loadShaderModule("cube_shadow.frag.spv"), cubeRenderPass);
+            }
+        }
+    }
+
+    // Takes ownership of the shader modules, like buildGraphicsPipeline()
+    VkPipeline buildCubeShadowPipeline(VkShaderModule vertShaderModule, VkShaderModule fragShaderModule, VkRenderPass cubeRenderPass) {
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        auto bindingDescription = Vertex::getBindingDescription();
+        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        VkViewport viewport = {};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) CUBE_SHADOW_SIZE;
+        viewport.height = (float) CUBE_SHADOW_SIZE;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor = {};
+        scissor.offset = {0, 0};
+        scissor.extent = { CUBE_SHADOW_SIZE, CUBE_SHADOW_SIZE };
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports = &viewport;
+        viewportState.scissorCount = 1;
+        viewportState.pScissors = &scissor;
+
+        // The cube map faces are mirrored images, which flips the winding of every triangle
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_NONE;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.layout = cubeShadowPipelineLayout;
+        pipelineInfo.renderPass = cubeRenderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create cube shadow pipeline!");
+        }
+
+        return pipeline;
+    }
+
+    // The key light does not move, so the face matrices are written once. Cube map lookups pick
+    // the face and its (s, t) the same way in Vulkan and OpenGL, so the usual OpenGL face
+    // orientations apply, without the y flip of the camera projection.
+    void createCubeShadowUniformBuffer() {
+        const glm::vec3 directions[6] = {
+            glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+        };
+        const glm::vec3 ups[6] = {
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+        };
+
+        glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, CUBE_SHADOW_NEAR, CUBE_SHADOW_RANGE);
+        UBOCubeShadowPass ubo = {};
+        for (uint32_t face = 0; face < 6; face++) {
+            cubeShadowFaceMatrices[face] = proj * glm::lookAt(LIGHT_POS, LIGHT_POS + directions[face], ups[face]);
+            ubo.faceMats[face] = cubeShadowFaceMatrices[face];
+        }
+        ubo.lightPosRange = glm::vec4(LIGHT_POS, CUBE_SHADOW_RANGE);
+
+        createBuffer(sizeof(ubo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cubeShadowUniformBuffer, cubeShadowUniformBufferMemory);
+
+        void* data;
+        vkMapMemory(device, cubeShadowUniformBufferMemory, 0, sizeof(ubo), 0, &data);
+            memcpy(data, &ubo, sizeof(ubo));
+        vkUnmapMemory(device, cubeShadowUniformBufferMemory);
+    }
+
+    // Culls the shadow casters against the six face frusta and builds the draw lists of all
+    // modes in one indirect buffer: the casters touching any face for multiview, which cannot
+    // skip single faces, the casters of each face for six passes, and one instance per touched
+    // face (object * 6 + face) for layered rendering
+    void createCubeShadowDraws() {
+        std::array<std::vector<uint8_t>, 6> faceVisibility;
+        for (uint32_t face = 0; face < 6; face++) {
+            glm::vec4 planes[6];
+            extractFrustumPlanes(cubeShadowFaceMatrices[face], planes);
+            faceVisibility[face].resize(instances.size());
+            cullObjectBounds(planes, objectBounds, 0, instances.size(), faceVisibility[face].data());
+        }
+
+        // Consecutive instances of the same mesh are merged into one instanced draw
+        std::vector<VkDrawIndexedIndirectCommand> commands;
+        auto beginRange = [&commands](IndirectDrawRange &range) {
+            range.firstCommand = static_cast<uint32_t>(commands.size());
+            range.commandCount = 0;
+        };
+        auto appendDraw = [&commands](IndirectDrawRange &range, const MeshRange &mesh, uint32_t instance) {
+            if (range.commandCount > 0) {
+                VkDrawIndexedIndirectCommand &last = commands.back();
+                if (last.firstIndex == mesh.firstIndex && last.firstInstance + last.instanceCount == instance) {
+                    last.instanceCount++;
+                    return;
+                }
+            }
+            commands.push_back({ mesh.indexCount, 1, mesh.firstIndex, 0, instance });
+            range.commandCount++;
+        };
+        auto castsShadow = [this](size_t i) {
+            return (instances[i].flags & INSTANCE_FLAG_CAST_SHADOW) != 0;
+        };
+
+        cubeShadowCasterCount = 0;
+        cubeShadowMultiviewObjectCount = 0;
+        cubeShadowObjectFaceCount = 0;
+
+        beginRange(cubeShadowMultiviewDraws);
+        for (uint32_t i = 0; i < instances.size(); i++) {
+            if (!castsShadow(i)) {
+                continue;
+            }
+            cubeShadowCasterCount++;
+
+            bool visible = false;
+            for (uint32_t face = 0; face < 6; face++) {
+                visible = visible || faceVisibility[face][i];
+            }
+            if (visible) {
+                appendDraw(cubeShadowMultiviewDraws, instanceMesh(i), i);
+                cubeShadowMultiviewObjectCount++;
+            }
+        }
+
+        for (uint32_t face = 0; face < 6; face++) {
+            beginRange(cubeShadowFaceDraws[face]);
+            for (uint32_t i = 0; i < instances.size(); i++) {
+                if (castsShadow(i) && faceVisibility[face][i]) {
+                    appendDraw(cubeShadowFaceDraws[face], instanceMesh(i), i);
+                    cubeShadowObjectFaceCount++;
+                }
+            }
+        }
+
+        beginRange(cubeShadowLayeredDraws);
+        for (uint32_t i = 0; i < instances.size(); i++) {
+            for (uint32_t face = 0; face < 6; face++) {
+                if (castsShadow(i) && faceVisibility[face][i]) {
+                    appendDraw(cubeShadowLayeredDraws, instanceMesh(i), 6 * i + face);
+                }
+            }
+        }
+
+        // Frames in flight may still draw from the previous lists
+        if (cubeShadowDrawBuffer != VK_NULL_HANDLE) {
+            VkBuffer buffer = cubeShadowDrawBuffer;
+            VkDeviceMemory bufferMemory = cubeShadowDrawBufferMemory;
+            releaseAfter(timelineValue, [this, buffer, bufferMemory]() {
+                vkDestroyBuffer(device, buffer, nullptr);
+                vkFreeMemory(device, bufferMemory, nullptr);
+            });
+            cubeShadowDrawBuffer = VK_NULL_HANDLE;
+            cubeShadowDrawBufferMemory = VK_NULL_HANDLE;
+        }
+
+        if (!commands.empty()) {
+            VkDeviceSize bufferSize = commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+            createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cubeShadowDrawBuffer, cubeShadowDrawBufferMemory);
+
+            void* data;
+            vkMapMemory(device, cubeShadowDrawBufferMemory, 0, bufferSize, 0, &data);
+                memcpy(data, commands.data(), bufferSize);
+            vkUnmapMemory(device, cubeShadowDrawBufferMemory);
+        }
+
+        cubeShadowDrawsValid = true;
+    }
+
+    void destroyCubeShadowResources() {
+        vkDestroyImageView(device, cubeShadowCubeView, nullptr);
+        vkDestroyImage(device, cubeShadowColorImage, nullptr);
+        vkFreeMemory(device, cubeShadowColorImageMemory, nullptr);
+
+        if (!options.cubeShadows) {
+            return;
+        }
+
+        for (uint32_t face = 0; face < 6; face++) {
+            vkDestroyFramebuffer(device, cubeShadowFaceFramebuffers[face], nullptr);
+            vkDestroyImageView(device, cubeShadowColorFaceViews[face], nullptr);
+            vkDestroyImageView(device, cubeShadowDepthFaceViews[face], nullptr);
+        }
+        vkDestroyFramebuffer(device, cubeShadowMultiviewFramebuffer, nullptr);
+        vkDestroyFramebuffer(device, cubeShadowLayeredFramebuffer, nullptr);
+        vkDestroyImageView(device, cubeShadowColorArrayView, nullptr);
+        vkDestroyImageView(device, cubeShadowDepthArrayView, nullptr);
+        vkDestroyImage(device, cubeShadowDepthImage, nullptr);
+        vkFreeMemory(device, cubeShadowDepthImageMemory, nullptr);
+
+        for (VkPipeline pipeline : cubeShadowPipelines) {
+            vkDestroyPipeline(device, pipeline, nullptr);
+        }
+        vkDestroyPipelineLayout(device, cubeShadowPipelineLayout, nullptr);
+        vkDestroyRenderPass(device, cubeShadowRenderPass, nullptr);
+        vkDestroyRenderPass(device, cubeShadowMultiviewRenderPass, nullptr);
+
+        vkDestroyBuffer(device, cubeShadowUniformBuffer, nullptr);
+        vkFreeMemory(device, cubeShadowUniformBufferMemory, nullptr);
+        vkDestroyBuffer(device, cubeShadowDrawBuffer, nullptr);
+        vkFreeMemory(device, cubeShadowDrawBufferMemory, nullptr);
+    }
+
+    VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
+        for (VkFormat format : candidates) {
+            VkFormatProperties props;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+            if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features) {
+                return format;
+            } else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
+                return format;
+            }
+        }
+
+        throw std::runtime_error("failed to find supported format!");
+    }
+
+    VkFormat findDepthFormat() {
+        return findSupportedFormat(
+            {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+        );
+    }
+
+    bool hasStencilComponent(VkFormat format) {
+        return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+    }
+
+    static DecodedImage decodeImage(const std::string &filename) {
+        PROFILE_SCOPE("decodeImage");
+
+        DecodedImage image;
+        int texChannels;
+        image.pixels = stbi_load(filename.c_str(), &image.width, &image.height, &texChannels, STBI_rgb_alpha);
+
+        if (!image.pixels) {
+            throw std::runtime_error("failed to load texture image!");
+        }
+
+        return image;
+    }
+
+    void createPlaceholderTexture() {
+        const uint32_t pixel = 0xff808080;
+        VkDeviceSize imageSize = sizeof(pixel);
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void *data;
+        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+        memcpy(data, &pixel, static_cast<size_t>(imageSize));
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        createImage(1, 1, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, placeholderTextureImage, placeholderTextureImageMemory);
+
+        transitionImageLayout(placeholderTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
+        copyBufferToImage(stagingBuffer, placeholderTextureImage, 1, 1);
+        transitionImageLayout(placeholderTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+        placeholderTextureImageView = createImageView(placeholderTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+
+    VkImageView currentTextureImageView() const {
+        return textureImageView != VK_NULL_HANDLE ? textureImageView : placeholderTextureImageView;
+    }
+
+    void beginTextureUpload(const DecodedImage &image) {
+        PROFILE_SCOPE("beginTextureUpload");
+
+        VkDeviceSize imageSize = image.width * image.height * 4;
+        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(image.width, image.height)))) + 1;
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void *data;
+        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
+        memcpy(data, image.pixels, static_cast<size_t>(imageSize));
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        stbi_image_free(image.pixels);
+
+        createImage(image.width, image.height, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer uploadCommandBuffer;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &uploadCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate texture upload command buffer!");
+        }
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(uploadCommandBuffer, &beginInfo);
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = textureImage;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(uploadCommandBuffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr,
+                             0, nullptr,
+                             1, &barrier);
+
+        recordCopyBufferToImage(uploadCommandBuffer, stagingBuffer, textureImage, static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height));
+        generateMipMaps(uploadCommandBuffer, textureImage, VK_FORMAT_R8G8B8A8_UNORM, image.width, image.height, mipLevels);
+
+        if (vkEndCommandBuffer(uploadCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record texture upload command buffer!");
+        }
+
+        textureUploadTimelineValue = ++timelineValue;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &textureUploadTimelineValue;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &uploadCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timelineSemaphore;
+
+        // Not waited on here; completion is polled once per frame in updateTextureStreaming()
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit texture upload command buffer!");
+        }
+
+        releaseAfter(textureUploadTimelineValue, [this, uploadCommandBuffer, stagingBuffer, stagingBufferMemory]() mutable {
+            vkFreeCommandBuffers(device, commandPool, 1, &uploadCommandBuffer);
+            vkDestroyBuffer(device, stagingBuffer, nullptr);
+            vkFreeMemory(device, stagingBufferMemory, nullptr);
+        });
+    }
+
+    void finishTextureUpload() {
+        textureUploadTimelineValue = 0;
+
+        textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+    }
+
+    void updateTextureStreaming() {
+        if (textureDecodeTask.valid() && textureDecodeTask.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            beginTextureUpload(textureDecodeTask.get());
+        }
+
+        if (textureUploadTimelineValue != 0 && completedTimelineValue() >= textureUploadTimelineValue) {
+            finishTextureUpload();
+        }
+
+        // Descriptor sets are written per frame, so the real texture is used from the next
+        // recorded frame on without touching sets that the GPU may still read.
+        if (!fullQualityReported && textureImageView != VK_NULL_HANDLE) {
+            reportStartupTime("time to full quality");
+            fullQualityReported = true;
+        }
+    }
+
+    void reportStartupTime(const std::string &label) {
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        float elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - startupTime).count();
+        std::cout << label << ": " << elapsed << " ms" << std::endl;
+    }
+
+    void generateMipMaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
+
+        if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+            throw std::runtime_error("texture image format does not support linear blitting!");
+        }
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.image = image;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.subresourceRange.levelCount = 1;
+
+        int32_t mipWidth = texWidth;
+        int32_t mipHeight = texHeight;
+
+        for (uint32_t i = 1; i < mipLevels; i++) {
+            barrier.subresourceRange.baseMipLevel = i - 1;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr,
+                                 0, nullptr,
+                                 1, &barrier);
+
+            VkImageBlit blit = {};
+            blit.srcOffsets[0] = {0, 0, 0};
+            blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+            blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.srcSubresource.mipLevel = i - 1;
+            blit.srcSubresource.baseArrayLayer = 0;
+            blit.srcSubresource.layerCount = 1;
+            blit.dstOffsets[0] = {0, 0, 0};
+            blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
+            blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.dstSubresource.mipLevel = i;
+            blit.dstSubresource.baseArrayLayer = 0;
+            blit.dstSubresource.layerCount = 1;
+
+            vkCmdBlitImage(commandBuffer,
+                           image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1, &blit,
+                           VK_FILTER_LINEAR);
+
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                                 0, nullptr,
+                                 0, nullptr,
+                                 1, &barrier);
+
+            if (mipWidth > 1) mipWidth /= 2;
+            if (mipHeight > 1) mipHeight /= 2;
+        }
+
+        barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             0, nullptr,
+                             0, nullptr,
+                             1, &barrier);
+    }
+
+    void createTextureSampler() {
+        VkSamplerCreateInfo samplerInfo = {};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.anisotropyEnable = VK_TRUE;
+        samplerInfo.maxAnisotropy = 16;
+        samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+        samplerInfo.unnormalizedCoordinates = VK_FALSE;
+        samplerInfo.compareEnable = VK_FALSE;
+        samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.minLod = 0;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+        samplerInfo.mipLodBias = 0;
+
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture sampler!");
+        }
+    }
+
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D, uint32_t baseArrayLayer = 0, uint32_t layerCount = 1) {
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = viewType;
+        viewInfo.format = format;
+        viewInfo.subresourceRange.aspectMask = aspectFlags;
+        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.levelCount = mipLevels;
+        viewInfo.subresourceRange.baseArrayLayer = baseArrayLayer;
+        viewInfo.subresourceRange.layerCount = layerCount;
+
+        VkImageView imageView;
+        if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture image view!");
+        }
+
+        return imageView;
+    }
+
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t arrayLayers = 1, VkImageCreateFlags flags = 0) {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.flags = flags;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = width;
+        imageInfo.extent.height = height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = arrayLayers;
+        imageInfo.format = format;
+        imageInfo.tiling = tiling;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = usage;
+        imageInfo.samples = numSamples;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+        // Lazily allocated memory is only offered by tile-based GPUs
+        if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !hasMemoryType(memRequirements.memoryTypeBits, properties)) {
+            properties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        }
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate image memory!");
+        }
+
+        vkBindImageMemory(device, image, imageMemory, 0);
+    }
+
+    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels, uint32_t layerCount = 1) {
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+
+        if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+            if (hasStencilComponent(format)) {
+                barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+            }
+        } else {
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = layerCount;
+
+        VkPipelineStageFlags sourceStage;
+        VkPipelineStageFlags destinationStage;
+
+        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        } else {
+            throw std::invalid_argument("unsupported layout transition!");
+        }
+
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            sourceStage, destinationStage,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier
+        );
+
+        endSingleTimeCommands(commandBuffer);
+    }
+
+    void copyImage(VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height) {
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+        VkImageSubresourceLayers subResource = {};
+        subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        subResource.baseArrayLayer = 0;
+        subResource.mipLevel = 0;
+        subResource.layerCount = 1;
+
+        VkImageCopy region = {};
+        region.srcSubresource = subResource;
+        region.dstSubresource = subResource;
+        region.srcOffset = {0, 0, 0};
+        region.dstOffset = {0, 0, 0};
+        region.extent.width = width;
+        region.extent.height = height;
+        region.extent.depth = 1;
+
+        vkCmdCopyImage(
+            commandBuffer,
+            srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &region
+        );
+
+        endSingleTimeCommands(commandBuffer);
+    }
+
+    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        recordCopyBufferToImage(commandBuffer, buffer, image, width, height);
+        endSingleTimeCommands(commandBuffer);
+    }
+
+    void recordCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {
+                width,
+                height,
+                1
+        };
+
+        vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    void loadModel() {
+        PROFILE_SCOPE("loadModel");
+
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err, warn;
+
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
+            throw std::runtime_error(err);
+        }
+
+        std::unordered_map<Vertex, int> uniqueVertices = {};
+
+        for (const auto& shape : shapes) {
+            for (const auto& index : shape.mesh.indices) {
+                Vertex vertex = {};
+
+                if (index.vertex_index >= 0) {
+                    vertex.pos = {
+                        attrib.vertices[3 * index.vertex_index + 0],
+                        attrib.vertices[3 * index.vertex_index + 1],
+                        attrib.vertices[3 * index.vertex_index + 2]
+                    };
+                }
+
+                if (index.normal_index >= 0) {
+                    vertex.normal = {
+                        attrib.normals[3 * index.normal_index + 0],
+                        attrib.normals[3 * index.normal_index + 1],
+                        attrib.normals[3 * index.normal_index + 2]
+                    };
+                }
+
+                if (index.texcoord_index >= 0) {
+                    vertex.texCoord = {
+                        attrib.texcoords[2 * index.texcoord_index + 0],
+                        1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+                    };
+                }
+
+                if (uniqueVertices.count(vertex) == 0) {
+                    uniqueVertices[vertex] = vertices.size();
+                    vertices.push_back(vertex);
+                }
+
+                indices.push_back(uniqueVertices[vertex]);
+            }
+        }
+
+        teapotMesh.firstIndex = 0;
+        teapotMesh.indexCount = static_cast<uint32_t>(indices.size());
+
+        std::vector<Vertex> floorVertices = {
+            Vertex{ glm::vec3{-20.0f, -2.0f, -20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{0.0f, 0.0f} },
+            Vertex{ glm::vec3{ 20.0f, -2.0f, -20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{0.0f, 1.0f} },
+            Vertex{ glm::vec3{-20.0f, -2.0f,  20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{1.0f, 0.0f} },
+            Vertex{ glm::vec3{ 20.0f, -2.0f,  20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{1.0f, 1.0f} }
+        };
+
+        const uint32_t baseIndex = static_cast<uint32_t>(vertices.size());
+        std::vector<uint32_t> floorIndices = {
+            baseIndex + 0, baseIndex + 3, baseIndex + 1,
+            baseIndex + 0, baseIndex + 2, baseIndex + 3
+        };
+
+        floorMesh.firstIndex = static_cast<uint32_t>(indices.size());
+        floorMesh.indexCount = static_cast<uint32_t>(floorIndices.size());
+
+        vertices.insert(vertices.end(), floorVertices.begin(), floorVertices.end());
+        indices.insert(indices.end(), floorIndices.begin(), floorIndices.end());
+
+        computeMeshBounds(teapotMesh);
+        computeMeshBounds(floorMesh);
+        createLods(teapotMesh);
+        createLods(floorMesh);
+
+        if (options.meshlets) {
+            createMeshlets(teapotMesh);
+            createMeshlets(floorMesh);
+        }
+    }
+
+    // Reorders the mesh's indices meshlet by meshlet, so that a meshlet is also a contiguous index range
+    void createMeshlets(MeshRange &mesh) {
+        mesh.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+
+        if (meshletTriangles.size() < indices.size() / 3) {
+            meshletTriangles.resize(indices.size() / 3);
+        }
+        std::vector<Meshlet> built = buildMeshlets(vertices, indices, mesh.firstIndex, mesh.indexCount, meshletVertices, meshletTriangles);
+        meshlets.insert(meshlets.end(), built.begin(), built.end());
+
+        mesh.meshletCount = static_cast<uint32_t>(built.size());
+        maxMeshletsPerMesh = std::max(maxMeshletsPerMesh, mesh.meshletCount);
+    }
+
+    // Appends the coarser levels to the index buffer; they use the vertices of the full mesh
+    void createLods(MeshRange &mesh) {
+        mesh.lods[0] = { mesh.firstIndex, mesh.indexCount, 0.0f };
+        mesh.lodCount = 1;
+        if (options.lodCount < 2) {
+            return;
+        }
+
+        std::vector<uint32_t> meshIndices(indices.begin() + mesh.firstIndex, indices.begin() + mesh.firstIndex + mesh.indexCount);
+        for (const SimplifiedLod &lod : simplifyMesh(vertices, meshIndices, options.lodCount)) {
+            mesh.lods[mesh.lodCount++] = { static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(lod.indices.size()), lod.error };
+            indices.insert(indices.end(), lod.indices.begin(), lod.indices.end());
+        }
+    }
+
+    void computeMeshBounds(MeshRange &mesh) {
+        mesh.aabbMin = glm::vec3(std::numeric_limits<float>::max());
+        mesh.aabbMax = glm::vec3(std::numeric_limits<float>::lowest());
+        for (uint32_t i = mesh.firstIndex; i < mesh.firstIndex + mesh.indexCount; i++) {
+            mesh.aabbMin = glm::min(mesh.aabbMin, vertices[indices[i]].pos);
+            mesh.aabbMax = glm::max(mesh.aabbMax, vertices[indices[i]].pos);
+        }
+
+        glm::vec3 center = 0.5f * (mesh.aabbMin + mesh.aabbMax);
+        float radius = 0.0f;
+        for (uint32_t i = mesh.firstIndex; i < mesh.firstIndex + mesh.indexCount; i++) {
+            radius = std::max(radius, glm::length(vertices[indices[i]].pos - center));
+        }
+
+        mesh.boundingSphere = glm::vec4(center, radius);
+    }
+
+    const MeshRange &instanceMesh(size_t instanceIndex) const {
+        // Batches are sorted by their first instance, and there is one per object with --draw-per-object
+        auto it = std::upper_bound(drawBatches.begin(), drawBatches.end(), instanceIndex, [](size_t index, const DrawBatch &batch) {
+            return index < batch.firstInstance;
+        });
+        if (it == drawBatches.begin() || instanceIndex >= (it - 1)->firstInstance + (it - 1)->instanceCount) {
+            throw std::runtime_error("instance is not part of any draw batch!");
+        }
+        return (it - 1)->mesh;
+    }
+
+    bool usesLods() const {
+        return options.lodCount > 1;
+    }
+
+    static MeshRange lodMesh(const MeshRange &mesh, uint32_t lod) {
+        MeshRange result = mesh;
+        result.firstIndex = mesh.lods[lod].firstIndex;
+        result.indexCount = mesh.lods[lod].indexCount;
+        return result;
+    }
+
+    const std::vector<DrawBatch> &cameraDrawBatches() const {
+        return usesLods() ? lodDrawBatches : drawBatches;
+    }
+
+    const std::vector<DrawBatch> &shadowPassDrawBatches() const {
+        return usesLods() ? lodShadowDrawBatches : shadowDrawBatches;
+    }
+
+    static uint64_t batchTriangleCount(const std::vector<DrawBatch> &batches) {
+        uint64_t triangles = 0;
+        for (const auto &batch : batches) {
+            triangles += static_cast<uint64_t>(batch.mesh.indexCount / 3) * batch.instanceCount;
+        }
+        return triangles;
+    }
+
+    // Picks the level of every object from the size of its bounding sphere on screen, and in the
+    // sharpest shadow atlas tile shifted by the shadow bias, since all tiles draw the same batches.
+    // Only tiles with a size are rendered: with --cube-shadows the key light has none, and its
+    // cube map draws stay at full detail.
+    void selectLods(const glm::mat4 &mvpMat) {
+        VkExtent2D extent = renderExtent();
+        std::vector<std::pair<glm::mat4, float>> shadowTiles;
+        for (size_t light = 0; light < shadowLights.size(); light++) {
+            if (shadowAtlasTiles[light].size > 0) {
+                shadowTiles.push_back({ shadowLights[light].mvpMat, static_cast<float>(shadowAtlasTiles[light].size) });
+            }
+        }
+        cameraLods.resize(instances.size());
+        shadowLods.resize(instances.size());
+
+        parallelFor(instances.size(), 1024, workerThreadCount(), [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const MeshRange &mesh = instanceMesh(i);
+                glm::vec3 center(objectBounds.centerX[i], objectBounds.centerY[i], objectBounds.centerZ[i]);
+                float radius = glm::length(glm::vec3(objectBounds.extentX[i], objectBounds.extentY[i], objectBounds.extentZ[i]));
+
+                // The level errors are in object space
+                const glm::mat4 &modelMat = instances[i].modelMat;
+                float scale = std::max(glm::length(glm::vec3(modelMat[0])), std::max(glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))));
+
+                float cameraPixels = scale * projectedPixelsPerUnit(mvpMat, center, radius, static_cast<float>(extent.width), static_cast<float>(extent.height));
+                float shadowPixels = 0.0f;
+                for (const auto &tile : shadowTiles) {
+                    shadowPixels = std::max(shadowPixels, scale * projectedPixelsPerUnit(tile.first, center, radius, tile.second, tile.second));
+                }
+                cameraLods[i] = static_cast<uint8_t>(selectLod(mesh, cameraPixels, lodErrorPixels));
+                shadowLods[i] = static_cast<uint8_t>(std::min(selectLod(mesh, shadowPixels, lodErrorPixels) + shadowLodBias, mesh.lodCount - 1));
+            }
+        });
+
+        lodDrawBatches.clear();
+        for (const auto &batch : drawBatches) {
+            appendLodDrawBatches(lodDrawBatches, batch, cameraLods);
+        }
+        lodShadowDrawBatches.clear();
+        for (const auto &batch : shadowDrawBatches) {
+            appendLodDrawBatches(lodShadowDrawBatches, batch, shadowLods);
+        }
+
+        // Counted before culling
+        frameStats.lodTriangleSum[0] += batchTriangleCount(lodDrawBatches);
+        frameStats.lodTriangleSum[1] += batchTriangleCount(lodShadowDrawBatches);
+        frameStats.lodFullTriangleSum[0] += batchTriangleCount(drawBatches);
+        frameStats.lodFullTriangleSum[1] += batchTriangleCount(shadowDrawBatches);
+        for (uint8_t lod : cameraLods) {
+            frameStats.lodObjectSum[lod]++;
+        }
+        frameStats.lodSelectCount++;
+    }
+
+    // Splits the batch into runs of consecutive instances at the same level
+    static void appendLodDrawBatches(std::vector<DrawBatch> &batches, const DrawBatch &batch, const std::vector<uint8_t> &lods) {
+        const uint32_t batchEnd = batch.firstInstance + batch.instanceCount;
+        uint32_t runBegin = batch.firstInstance;
+        for (uint32_t i = batch.firstInstance + 1; i <= batchEnd; i++) {
+            if (i == batchEnd || lods[i] != lods[runBegin]) {
+                batches.push_back({ lodMesh(batch.mesh, lods[runBegin]), runBegin, i - runBegin });
+                runBegin = i;
+            }
+        }
+    }
+
+    void createObjectBounds() {
+        objectBounds.resize(instances.size());
+        for (size_t i = 0; i < instances.size(); i++) {
+            const MeshRange &mesh = instanceMesh(i);
+            const glm::mat4 &modelMat = instances[i].modelMat;
+
+            // Transformed AABB: the extent is projected on the absolute values of the rotation-scale part
+            glm::vec3 center = 0.5f * (mesh.aabbMin + mesh.aabbMax);
+            glm::vec3 extent = 0.5f * (mesh.aabbMax - mesh.aabbMin);
+            glm::vec3 worldCenter = glm::vec3(modelMat * glm::vec4(center, 1.0f));
+            glm::vec3 worldExtent = glm::abs(glm::vec3(modelMat[0])) * extent.x
+                                  + glm::abs(glm::vec3(modelMat[1])) * extent.y
+                                  + glm::abs(glm::vec3(modelMat[2])) * extent.z;
+            objectBounds.set(i, worldCenter, worldExtent);
+        }
+        objectVisibility.resize(instances.size());
+        lightVisibility.resize(instances.size() * options.shadowLightCount);
+        lightSpaceBounds.resize(instances.size());
+        lightSpaceBoundsValid = false;
+        cubeShadowDrawsValid = false;
+    }
+
+    // Projects the object bounds into the light's clip space. The result only changes with the light or the instances.
+    void updateLightSpaceBounds(const glm::mat4 &mvpMatLightSpace) {
+        if (lightSpaceBoundsValid && lightSpaceBoundsMatrix == mvpMatLightSpace) {
+            return;
+        }
+
+        parallelFor(instances.size(), 1024, workerThreadCount(), [&](uint32_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                glm::vec3 center(objectBounds.centerX[i], objectBounds.centerY[i], objectBounds.centerZ[i]);
+                glm::vec3 extent(objectBounds.extentX[i], objectBounds.extentY[i], objectBounds.extentZ[i]);
+
+                glm::vec3 minPos(std::numeric_limits<float>::max());
+                glm::vec3 maxPos(std::numeric_limits<float>::lowest());
+                bool behindLight = false;
+                for (int corner = 0; corner < 8; corner++) {
+                    glm::vec3 sign((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+                    glm::vec4 p = mvpMatLightSpace * glm::vec4(center + sign * extent, 1.0f);
+                    if (p.w <= 0.0f) {
+                        behindLight = true;
+                        break;
+                    }
+                    minPos = glm::min(minPos, glm::vec3(p) / p.w);
+                    maxPos = glm::max(maxPos, glm::vec3(p) / p.w);
+                }
+
+                if (behindLight) {
+                    // Crossing the light's plane, keep it conservative
+                    lightSpaceBounds.set(i, glm::vec3(0.0f), glm::vec3(std::numeric_limits<float>::max()));
+                } else {
+                    lightSpaceBounds.set(i, 0.5f * (minPos + maxPos), 0.5f * (maxPos - minPos));
+                }
+            }
+        });
+
+        lightSpaceBoundsMatrix = mvpMatLightSpace;
+        lightSpaceBoundsValid = true;
+    }
+
+    void createInstances(uint32_t teapotCount) {
+        instances.clear();
+        drawBatches.clear();
+
+        const uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(teapotCount))));
+        const float gridExtent = gridSize * INSTANCE_SPACING;
+        const float floorScale = std::max(1.0f, gridExtent / FLOOR_SIZE);
+
+        InstanceData floorInstance = {};
+        floorInstance.modelMat = glm::scale(glm::mat4(1.0f), glm::vec3(floorScale, 1.0f, floorScale));
+        floorInstance.normMat = glm::transpose(glm::inverse(floorInstance.modelMat));
+        floorInstance.materialIndex = 0;
+        floorInstance.flags = 0;
+        instances.push_back(floorInstance);
+        drawBatches.push_back({ floorMesh, 0, 1 });
+
+        for (uint32_t i = 0; i < teapotCount; i++) {
+            float x = (static_cast<float>(i % gridSize) - 0.5f * (gridSize - 1)) * INSTANCE_SPACING;
+            float z = (static_cast<float>(i / gridSize) - 0.5f * (gridSize - 1)) * INSTANCE_SPACING;
+
+            InstanceData instance = {};
+            instance.modelMat = glm::translate(glm::mat4(1.0f), glm::vec3(x, 0.0f, z));
+            instance.normMat = glm::transpose(glm::inverse(instance.modelMat));
+            instance.materialIndex = 1 + i % NUM_TEAPOT_MATERIALS;
+            instance.flags = INSTANCE_FLAG_CAST_SHADOW;
+            instances.push_back(instance);
+        }
+        drawBatches.push_back({ teapotMesh, 1, teapotCount });
+
+        if (options.drawPerObject) {
+            std::vector<DrawBatch> objectBatches;
+            for (const auto &batch : drawBatches) {
+                for (uint32_t i = 0; i < batch.instanceCount; i++) {
+                    objectBatches.push_back({ batch.mesh, batch.firstInstance + i, 1 });
+                }
+            }
+            drawBatches.swap(objectBatches);
+        }
+
+        createShadowDrawBatches();
+    }
+
+    // Splits the draw batches into runs of consecutive instances that cast shadows
+    void createShadowDrawBatches() {
+        shadowDrawBatches.clear();
+        for (const auto &batch : drawBatches) {
+            uint32_t runBegin = batch.firstInstance;
+            for (uint32_t i = batch.firstInstance; i <= batch.firstInstance + batch.instanceCount; i++) {
+                bool castsShadow = i < batch.firstInstance + batch.instanceCount && (instances[i].flags & INSTANCE_FLAG_CAST_SHADOW);
+                if (!castsShadow) {
+                    if (i > runBegin) {
+                        shadowDrawBatches.push_back({ batch.mesh, runBegin, i - runBegin });
+                    }
+                    runBegin = i + 1;
+                }
+            }
+        }
+    }
+
+    void createInstanceBuffer() {
+        VkDeviceSize bufferSize = sizeof(instances[0]) * instances.size();
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* data;
+        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+            memcpy(data, instances.data(), (size_t) bufferSize);
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer, instanceBufferMemory);
+
+        copyBuffer(stagingBuffer, instanceBuffer, bufferSize);
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
+
+    void createVertexBuffer() {
+        VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* data;
+        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+            memcpy(data, vertices.data(), (size_t) bufferSize);
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        // The mesh shader fetches the vertices itself
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        if (meshletPathSupported[MESHLET_PATH_MESH_SHADER]) {
+            usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        }
+        createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+
+        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
+
+    void createIndexBuffer() {
+        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* data;
+        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+            memcpy(data, indices.data(), (size_t) bufferSize);
+        vkUnmapMemory(device, stagingBufferMemory);
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+
+        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
+
+    void createUniformBuffers() {
+        VkDeviceSize bufferSize = sizeof(UBORenderPass);
+
+        uniformBuffers.resize(swapChainImages.size());
+        uniformBuffersMemory.resize(swapChainImages.size());
+
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+        }
+    }
+
+    // render.frag binds these buffers even when clustered lighting is off, so minimal
+    // ones are created then
+    void createClusterBuffers() {
+        VkDeviceSize pointLightBufferSize = (options.clusteredLighting ? MAX_POINT_LIGHTS : 1) * sizeof(PointLight);
+        VkDeviceSize clusterLightBufferSize = (options.clusteredLighting ? CLUSTER_COUNT * (CLUSTER_LIGHT_CAPACITY + 1) : 1) * sizeof(uint32_t);
+
+        clusterUniformBuffers.resize(swapChainImages.size());
+        clusterUniformBuffersMemory.resize(swapChainImages.size());
+        pointLightBuffers.resize(swapChainImages.size());
+        pointLightBuffersMemory.resize(swapChainImages.size());
+        clusterLightBuffers.resize(swapChainImages.size());
+        clusterLightBuffersMemory.resize(swapChainImages.size());
+
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(sizeof(UBOClusterPass), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, clusterUniformBuffers[i], clusterUniformBuffersMemory[i]);
+            createBuffer(pointLightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, pointLightBuffers[i], pointLightBuffersMemory[i]);
+            createBuffer(clusterLightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterLightBuffers[i], clusterLightBuffersMemory[i]);
+        }
+    }
+
+    // Scattered over the floor with a fixed seed, so that runs are comparable
+    void createPointLightSources() {
+        const float floorExtent = 0.5f * FLOOR_SIZE * instances[0].modelMat[0][0];
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        pointLightSources.resize(MAX_POINT_LIGHTS);
+        for (auto &source : pointLightSources) {
+            source.center = glm::vec3((2.0f * unit(rng) - 1.0f) * floorExtent, 0.5f + 2.5f * unit(rng), (2.0f * unit(rng) - 1.0f) * floorExtent);
+            source.orbitRadius = 0.5f + 1.5f * unit(rng);
+            source.angularSpeed = 0.5f + unit(rng);
+            source.phase = glm::radians(360.0f) * unit(rng);
+            source.radius = 3.0f + 3.0f * unit(rng);
+            source.color = 3.0f * glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 0.1f);
+        }
+
+        activePointLightCount = options.pointLightCount;
+    }
+
+    // Key light first, then spot lights on a ring around the scene, aimed at the floor
+    void createShadowLights() {
+        shadowLights.resize(options.shadowLightCount);
+
+        glm::mat4 view = glm::lookAt(LIGHT_POS, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.0f, 1.0f, 50.0f);
+        shadowLights[0].mvpMat = proj * view;
+        shadowLights[0].position = LIGHT_POS;
+        shadowLights[0].target = glm::vec3(0.0f);
+        shadowLights[0].coneRadius = glm::length(LIGHT_POS) * std::tan(glm::radians(22.5f));
+        shadowLights[0].color = glm::vec3(1.0f);
+
+        const float spotFovy = glm::radians(40.0f);
+        for (uint32_t k = 1; k < options.shadowLightCount; k++) {
+            float angle = glm::radians(360.0f) * (k - 1) / (options.shadowLightCount - 1);
+            glm::vec3 direction = glm::vec3(std::cos(angle), 0.0f, std::sin(angle));
+
+            ShadowLight &light = shadowLights[k];
+            light.position = 12.0f * direction + glm::vec3(0.0f, 8.0f, 0.0f);
+            light.target = 4.0f * direction;
+            light.coneRadius = glm::distance(light.position, light.target) * std::tan(0.5f * spotFovy);
+            light.color = 0.5f * glm::vec3(0.5f + 0.5f * std::cos(angle), 0.5f + 0.5f * std::cos(angle + 2.1f), 0.5f + 0.5f * std::cos(angle + 4.2f));
+
+            glm::mat4 spotView = glm::lookAt(light.position, light.target, glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 spotProj = glm::perspective(spotFovy, 1.0f, 1.0f, 50.0f);
+            light.mvpMat = spotProj * spotView;
+        }
+
+        shadowAtlasAllocator = ShadowAtlasAllocator(shadowAtlasSize(), SHADOW_TILE_MIN_SIZE);
+        shadowAtlasTiles.assign(shadowLights.size(), ShadowAtlasTile());
+        shadowTilesValid.assign(shadowLights.size(), false);
+        shadowTileAges.assign(shadowLights.size(), 0);
+    }
+
+    void createShadowLightBuffers() {
+        VkDeviceSize bufferSize = SHADOW_LIGHT_BUFFER_HEADER_SIZE + options.shadowLightCount * sizeof(ShadowLightData);
+
+        shadowLightBuffers.resize(swapChainImages.size());
+        shadowLightBuffersMemory.resize(swapChainImages.size());
+
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shadowLightBuffers[i], shadowLightBuffersMemory[i]);
+        }
+    }
+
+    // One slice per light, each bound by the light's own descriptor set
+    void createShadowMapUniformBuffer() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+        shadowMapUniformStride = (sizeof(UBOShadowMapPass) + alignment - 1) / alignment * alignment;
+
+        VkDeviceSize bufferSize = shadowMapUniformStride * shadowLights.size();
+        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shadowMapUniformBuffer, shadowMapUniformBufferMemory); 
+    }
+
+    void createShadowMapDescriptorPool() {
+        auto poolSizes = descriptorPoolSizes(shadowMapDescriptorBindings, static_cast<uint32_t>(shadowLights.size()));
+
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = static_cast<uint32_t>(shadowLights.size());
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &shadowMapDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shadow map descriptor pool!");
+        }
+    }
+
+    void createDescriptorUpdateTemplate() {
+        // The shaders are reflected at runtime, so a binding missing from the table only shows here
+        if (descriptorBindings.size() != RENDER_DESCRIPTOR_ENTRIES.size()) {
+            throw std::runtime_error("render pass descriptor bindings do not match RENDER_DESCRIPTOR_ENTRIES!");
+        }
+
+        VkDescriptorUpdateTemplateCreateInfo templateInfo = {};
+        templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+        templateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(RENDER_DESCRIPTOR_ENTRIES.size());
+        templateInfo.pDescriptorUpdateEntries = RENDER_DESCRIPTOR_ENTRIES.data();
+        templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+        templateInfo.descriptorSetLayout = descriptorSetLayout;
+
+        if (vkCreateDescriptorUpdateTemplate(device, &templateInfo, nullptr, &descriptorUpdateTemplate) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor update template!");
+        }
+    }
+
+    RenderDescriptorData renderDescriptorData(uint32_t imageIndex) const {
+        RenderDescriptorData data = {};
+        data.uniformBuffer = { uniformBuffers[imageIndex], 0, sizeof(UBORenderPass) };
+        data.texture = { textureSampler, currentTextureImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        data.shadowMap = { textureSampler, shadowMapColorImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        data.instanceBuffer = { instanceBuffer, 0, VK_WHOLE_SIZE };
+        data.clusterUniformBuffer = { clusterUniformBuffers[imageIndex], 0, sizeof(UBOClusterPass) };
+        data.pointLightBuffer = { pointLightBuffers[imageIndex], 0, VK_WHOLE_SIZE };
+        data.clusterLightBuffer = { clusterLightBuffers[imageIndex], 0, VK_WHOLE_SIZE };
+        data.shadowLightBuffer = { shadowLightBuffers[imageIndex], 0, VK_WHOLE_SIZE };
+        data.cubeShadowMap = { textureSampler, cubeShadowCubeView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        return data;
+    }
+
+    // The frame slot's previous submission has completed, so all of its sets can be recycled
+    void allocateFrameDescriptorSet(uint32_t imageIndex) {
+        DescriptorAllocator &allocator = frameDescriptorAllocators[currentFrame];
+        allocator.reset(device);
+        frameDescriptorSets[currentFrame] = allocator.allocate(device, descriptorSetLayout);
+
+        RenderDescriptorData data = renderDescriptorData(imageIndex);
+        vkUpdateDescriptorSetWithTemplate(device, frameDescriptorSets[currentFrame], descriptorUpdateTemplate, &data);
+
+        if (options.depthPrepass) {
+            frameDepthPrepassDescriptorSets[currentFrame] = allocator.allocate(device, shadowMapDescriptorSetLayout);
+            writeDepthPrepassDescriptorSet(frameDepthPrepassDescriptorSets[currentFrame], data);
+        }
+
+        if (options.clusteredLighting) {
+            frameClusterDescriptorSets[currentFrame] = allocator.allocate(device, clusterDescriptorSetLayout);
+            writeClusterDescriptorSet(frameClusterDescriptorSets[currentFrame], data);
+        }
+
+        if (options.cubeShadows) {
+            frameCubeShadowDescriptorSets[currentFrame] = allocator.allocate(device, cubeShadowDescriptorSetLayout);
+            writeCubeShadowDescriptorSet(frameCubeShadowDescriptorSets[currentFrame], data);
+        }
+
+        if (meshletPath == MESHLET_PATH_COMPUTE) {
+            frameMeshletCullDescriptorSets[currentFrame] = allocator.allocate(device, meshletCullDescriptorSetLayout);
+            writeMeshletCullDescriptorSet(frameMeshletCullDescriptorSets[currentFrame], data, imageIndex);
+        } else if (meshletPath == MESHLET_PATH_MESH_SHADER) {
+            frameMeshletDescriptorSets[currentFrame] = allocator.allocate(device, meshletDescriptorSetLayout);
+            writeMeshletDescriptorSet(frameMeshletDescriptorSets[currentFrame], data, imageIndex);
+        }
+
+        if (options.dynamicResolution) {
+            frameUpscaleDescriptorSets[currentFrame] = allocator.allocate(device, upscaleDescriptorSetLayout);
+
+            VkDescriptorImageInfo imageInfo = { sceneColorSampler, sceneColorImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+            VkWriteDescriptorSet descriptorWrite = {};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = frameUpscaleDescriptorSets[currentFrame];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pImageInfo = &imageInfo;
+            vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
         }
     }
 
-    void createShadowMapRenderPass() {
-        VkAttachmentDescription colorAttachment = {};
-        colorAttachment.format = shadowMapColorFormat;
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    void writeMeshletCullDescriptorSet(VkDescriptorSet descriptorSet, const RenderDescriptorData &data, uint32_t imageIndex) {
+        std::array<VkDescriptorBufferInfo, 4> bufferInfos = {{
+            data.instanceBuffer,
+            { meshletBuffer, 0, VK_WHOLE_SIZE },
+            { meshletObjectBuffer, 0, VK_WHOLE_SIZE },
+            { meshletDrawBuffers[imageIndex], 0, VK_WHOLE_SIZE }
+        }};
+
+        std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
+        for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = descriptorSet;
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].dstArrayElement = 0;
+            descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
 
-        VkAttachmentDescription depthAttachment = {};
-        depthAttachment.format = shadowMapDepthFormat;
-        depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
 
-        VkAttachmentReference colorAttachmentRef = {};
-        colorAttachmentRef.attachment = 0;
-        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    // Set 1 of the mesh shader pipeline; set 0 is the render pass set for render.frag
+    void writeMeshletDescriptorSet(VkDescriptorSet descriptorSet, const RenderDescriptorData &data, uint32_t imageIndex) {
+        std::array<VkDescriptorBufferInfo, 8> bufferInfos = {{
+            data.uniformBuffer,
+            data.instanceBuffer,
+            { meshletBuffer, 0, VK_WHOLE_SIZE },
+            { meshletObjectBuffer, 0, VK_WHOLE_SIZE },
+            { meshletVertexBuffer, 0, VK_WHOLE_SIZE },
+            { meshletTriangleBuffer, 0, VK_WHOLE_SIZE },
+            { vertexBuffer, 0, VK_WHOLE_SIZE },
+            { meshletDrawBuffers[imageIndex], 0, MESHLET_DRAW_BUFFER_HEADER_SIZE }
+        }};
+
+        std::array<VkWriteDescriptorSet, 8> descriptorWrites = {};
+        for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = descriptorSet;
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].dstArrayElement = 0;
+            descriptorWrites[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+
+    // cluster.comp reads the same buffers as render.frag, at bindings 0 to 2
+    void writeClusterDescriptorSet(VkDescriptorSet descriptorSet, const RenderDescriptorData &data) {
+        std::array<VkDescriptorBufferInfo, 3> bufferInfos = { data.clusterUniformBuffer, data.pointLightBuffer, data.clusterLightBuffer };
+        std::array<VkDescriptorType, 3> descriptorTypes = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+
+        std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+        for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = descriptorSet;
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].dstArrayElement = 0;
+            descriptorWrites[binding].descriptorType = descriptorTypes[binding];
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+
+    // shadow.vert only reads mvpMat, which UBORenderPass starts with as well
+    void writeDepthPrepassDescriptorSet(VkDescriptorSet descriptorSet, const RenderDescriptorData &data) {
+        VkDescriptorBufferInfo bufferInfo = data.uniformBuffer;
+        bufferInfo.range = sizeof(UBOShadowMapPass);
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = descriptorSet;
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[1].dstSet = descriptorSet;
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].dstArrayElement = 0;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[1].descriptorCount = 1;
+        descriptorWrites[1].pBufferInfo = &data.instanceBuffer;
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+
+    // The face matrices stay in cubeShadowUniformBuffer; the instances are the render pass ones
+    void writeCubeShadowDescriptorSet(VkDescriptorSet descriptorSet, const RenderDescriptorData &data) {
+        VkDescriptorBufferInfo bufferInfo = { cubeShadowUniformBuffer, 0, sizeof(UBOCubeShadowPass) };
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = descriptorSet;
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[1].dstSet = descriptorSet;
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].dstArrayElement = 0;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[1].descriptorCount = 1;
+        descriptorWrites[1].pBufferInfo = &data.instanceBuffer;
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+
+    void createShadowMapDescriptorSets() {
+        std::vector<VkDescriptorSetLayout> layouts(shadowLights.size(), shadowMapDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = shadowMapDescriptorPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+        allocInfo.pSetLayouts = layouts.data();
+
+        shadowMapDescriptorSets.resize(layouts.size());
+        if (vkAllocateDescriptorSets(device, &allocInfo, shadowMapDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate shadow map descriptor set!");
+        }
+
+        for (size_t light = 0; light < shadowMapDescriptorSets.size(); light++) {
+            writeShadowMapDescriptorSet(shadowMapDescriptorSets[light], light * shadowMapUniformStride);
+        }
+    }
+
+    void writeShadowMapDescriptorSet(VkDescriptorSet descriptorSet, VkDeviceSize uniformOffset) {
+        VkDescriptorBufferInfo bufferInfo = {};
+        bufferInfo.buffer = shadowMapUniformBuffer;
+        bufferInfo.offset = uniformOffset;
+        bufferInfo.range = sizeof(UBOShadowMapPass);
+
+        VkDescriptorBufferInfo instanceBufferInfo = {};
+        instanceBufferInfo.buffer = instanceBuffer;
+        instanceBufferInfo.offset = 0;
+        instanceBufferInfo.range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = descriptorSet;
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[1].dstSet = descriptorSet;
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].dstArrayElement = 0;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[1].descriptorCount = 1;
+        descriptorWrites[1].pBufferInfo = &instanceBufferInfo;
+
+        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+    }
+
+    // The render pass sets pick up the instance buffer when they are written each frame
+    void updateInstanceDescriptors() {
+        VkDescriptorBufferInfo instanceBufferInfo = {};
+        instanceBufferInfo.buffer = instanceBuffer;
+        instanceBufferInfo.offset = 0;
+        instanceBufferInfo.range = VK_WHOLE_SIZE;
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites(shadowMapDescriptorSets.size());
+        for (size_t light = 0; light < descriptorWrites.size(); light++) {
+            descriptorWrites[light].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[light].dstSet = shadowMapDescriptorSets[light];
+            descriptorWrites[light].dstBinding = 1;
+            descriptorWrites[light].dstArrayElement = 0;
+            descriptorWrites[light].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[light].descriptorCount = 1;
+            descriptorWrites[light].pBufferInfo = &instanceBufferInfo;
+        }
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create buffer!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate buffer memory!");
+        }
+
+        vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    }
+
+    VkCommandBuffer beginSingleTimeCommands() {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        return commandBuffer;
+    }
+
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+        vkEndCommandBuffer(commandBuffer);
+
+        uint64_t signalValue = ++timelineValue;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timelineSemaphore;
+
+        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+        waitForTimelineValue(signalValue);
+
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    }
+
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+        VkBufferCopy copyRegion = {};
+        copyRegion.size = size;
+        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+        endSingleTimeCommands(commandBuffer);
+    }
+
+    bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    bool usesThreadedRecording() const {
+        // Indirect draws are a single command, so only the direct draw list is split across threads
+        return options.recordThreadCount > 0 && !options.gpuCulling && !options.cpuCulling && !options.meshlets;
+    }
+
+    void createRecordWorkers() {
+        uint32_t workerCount = options.benchmarkRecording ? workerThreadCount() : options.recordThreadCount;
+
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        recordWorkers.resize(MAX_FRAMES_IN_FLIGHT);
+        for (auto &workers : recordWorkers) {
+            workers.resize(workerCount);
+            for (auto &worker : workers) {
+                VkCommandPoolCreateInfo poolInfo = {};
+                poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+                if (vkCreateCommandPool(device, &poolInfo, nullptr, &worker.commandPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create worker command pool!");
+                }
+
+                VkCommandBufferAllocateInfo allocInfo = {};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = worker.commandPool;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                allocInfo.commandBufferCount = 2;
+
+                VkCommandBuffer secondaryCommandBuffers[2];
+                if (vkAllocateCommandBuffers(device, &allocInfo, secondaryCommandBuffers) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate secondary command buffers!");
+                }
+                worker.commandBuffer = secondaryCommandBuffers[0];
+                worker.shadowMapCommandBuffer = secondaryCommandBuffers[1];
+            }
+        }
+    }
+
+    void bindDrawState(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet descriptorSet) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+        VkBuffer vertexBuffers[] = { vertexBuffer };
+        VkDeviceSize offsets[] = { 0 };
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descriptorSet, 0, nullptr);
+    }
+
+    void recordDrawBatches(VkCommandBuffer commandBuffer, VkPipelineLayout layout, const std::vector<DrawBatch> &batches, size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++) {
+            const DrawBatch &batch = batches[b];
+            if (options.pushConstants) {
+                // Every object becomes its own draw with its data pushed into the command buffer
+                for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++) {
+                    DrawPushConstants constants = drawPushConstants(instances[i]);
+                    vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &constants);
+                    vkCmdDrawIndexed(commandBuffer, batch.mesh.indexCount, 1, batch.mesh.firstIndex, 0, i);
+                }
+            } else {
+                vkCmdDrawIndexed(commandBuffer, batch.mesh.indexCount, batch.instanceCount, batch.mesh.firstIndex, 0, batch.firstInstance);
+            }
+        }
+    }
+
+    static DrawPushConstants drawPushConstants(const InstanceData &instance) {
+        DrawPushConstants constants;
+        constants.modelMat = instance.modelMat;
+        for (int column = 0; column < 3; column++) {
+            constants.normMat[column] = instance.normMat[column];
+        }
+        constants.materialIndex = instance.materialIndex;
+        return constants;
+    }
+
+    // Each worker records a disjoint range of the draw list into its own secondary command buffer.
+    // Returns the recorded buffers in draw order.
+    std::vector<VkCommandBuffer> recordSecondaryCommandBuffers(size_t i, bool shadowPass) {
+        const std::vector<DrawBatch> &batches = shadowPass ? shadowPassDrawBatches() : cameraDrawBatches();
+        std::vector<RecordWorker> &workers = recordWorkers[currentFrame];
+
+        const uint32_t threadCount = std::min(options.recordThreadCount, static_cast<uint32_t>(workers.size()));
+        uint32_t usedWorkers = parallelFor(batches.size(), 64, threadCount, [&](uint32_t worker, size_t begin, size_t end) {
+            VkCommandBuffer commandBuffer = shadowPass ? workers[worker].shadowMapCommandBuffer : workers[worker].commandBuffer;
+
+            VkCommandBufferInheritanceInfo inheritanceInfo = {};
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.renderPass = shadowPass ? shadowMapRenderPass : renderPass;
+            inheritanceInfo.subpass = shadowPass ? 0 : mainSubpass();
+            inheritanceInfo.framebuffer = shadowPass ? shadowMapFramebuffer : swapChainFramebuffers[i];
+            inheritanceInfo.pipelineStatistics = pipelineStatisticsEnabled ? PIPELINE_STATISTICS_FLAGS : 0;
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+            if (shadowPass) {
+                // Every worker draws its range into all tiles; the first one clears them beforehand
+                bindDrawState(commandBuffer, shadowMapGraphicsPipeline, shadowMapPipelineLayout, shadowMapDescriptorSets[0]);
+                for (uint32_t light : shadowTileUpdates) {
+                    recordShadowTile(commandBuffer, light, worker == 0 && cachesShadowTiles());
+                    recordDrawBatches(commandBuffer, shadowMapPipelineLayout, batches, begin, end);
+                }
+            } else {
+                bindDrawState(commandBuffer, graphicsPipeline, pipelineLayout, frameDescriptorSets[currentFrame]);
+                setRenderViewport(commandBuffer);
+                recordDrawBatches(commandBuffer, pipelineLayout, batches, begin, end);
+            }
+
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record secondary command buffer!");
+            }
+        });
+
+        std::vector<VkCommandBuffer> secondaryCommandBuffers(usedWorkers);
+        for (uint32_t worker = 0; worker < usedWorkers; worker++) {
+            secondaryCommandBuffers[worker] = shadowPass ? workers[worker].shadowMapCommandBuffer : workers[worker].commandBuffer;
+        }
+        return secondaryCommandBuffers;
+    }
+
+    void createFrameCommands() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        // One set per frame is enough today; the pools grow if more are allocated
+        for (auto &allocator : frameDescriptorAllocators) {
+            allocator.init(descriptorBindings, 4);
+        }
+
+        frameCommands.resize(MAX_FRAMES_IN_FLIGHT);
+        for (auto &frame : frameCommands) {
+            VkCommandPoolCreateInfo poolInfo = {};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.commandPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create frame command pool!");
+            }
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = frame.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 3;
+
+            VkCommandBuffer commandBuffers[3];
+            if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+            frame.commandBuffer = commandBuffers[0];
+            frame.shadowMapCommandBuffer = commandBuffers[1];
+            frame.cullCommandBuffer = commandBuffers[2];
+
+            if (gpuTimestampsSupported) {
+                VkQueryPoolCreateInfo queryPoolInfo = {};
+                queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                queryPoolInfo.queryCount = 2 * GPU_PASS_COUNT;
+
+                if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &frame.timestampQueryPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create frame timestamp query pool!");
+                }
+            }
+
+            if (pipelineStatisticsEnabled) {
+                VkQueryPoolCreateInfo queryPoolInfo = {};
+                queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+                queryPoolInfo.queryCount = GPU_PASS_COUNT;
+                queryPoolInfo.pipelineStatistics = PIPELINE_STATISTICS_FLAGS;
+
+                if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &frame.statisticsQueryPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create frame pipeline statistics query pool!");
+                }
+            }
+        }
+
+        if (gpuTimestampsSupported) {
+            VkQueryPoolCreateInfo queryPoolInfo = {};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 1;
+
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &calibrationQueryPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create calibration query pool!");
+            }
+        }
+    }
+
+    // Input assembly and vertex shader counters must not be active around mesh shader draws
+    bool collectsPipelineStatistics(GpuPass pass) const {
+        return !isComputePass(pass) && !(pass == GPU_PASS_MAIN && meshletPath == MESHLET_PATH_MESH_SHADER);
+    }
 
-        VkAttachmentReference depthAttachmentRef = {};
-        depthAttachmentRef.attachment = 1;
-        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    void beginGpuPass(VkCommandBuffer commandBuffer, GpuPass pass) {
+        FrameCommands &frame = frameCommands[currentFrame];
 
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments = &colorAttachmentRef;
-        subpass.pDepthStencilAttachment = &depthAttachmentRef;
+        // Spans the whole render pass, so the main pass includes the depth pre-pass when enabled
+        if (collectsPipelineStatistics(pass) && frame.statisticsQueryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, frame.statisticsQueryPool, pass, 1);
+            vkCmdBeginQuery(commandBuffer, frame.statisticsQueryPool, pass, 0);
+            frame.passStatisticsWritten[pass] = true;
+        }
 
-        VkSubpassDependency dependency = {};
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.dstSubpass = 0;
-        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        if (frame.timestampQueryPool == VK_NULL_HANDLE) {
+            return;
+        }
 
-        std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
-        VkRenderPassCreateInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.attachmentCount = attachments.size();
-        renderPassInfo.pAttachments = attachments.data();
-        renderPassInfo.subpassCount = 1;
-        renderPassInfo.pSubpasses = &subpass;
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies = &dependency;
+        vkCmdResetQueryPool(commandBuffer, frame.timestampQueryPool, 2 * pass, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestampQueryPool, 2 * pass);
+        frame.passTimestampsWritten[pass] = true;
+    }
 
-        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &shadowMapRenderPass) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create shadow map render pass!");
+    void endGpuPass(VkCommandBuffer commandBuffer, GpuPass pass) {
+        FrameCommands &frame = frameCommands[currentFrame];
+
+        if (collectsPipelineStatistics(pass) && frame.statisticsQueryPool != VK_NULL_HANDLE) {
+            vkCmdEndQuery(commandBuffer, frame.statisticsQueryPool, pass);
+        }
+
+        if (frame.timestampQueryPool == VK_NULL_HANDLE) {
+            return;
         }
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestampQueryPool, 2 * pass + 1);
     }
 
-    void createDescriptorSetLayout() {
-        VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-        uboLayoutBinding.binding = 0;
-        uboLayoutBinding.descriptorCount = 1;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uboLayoutBinding.pImmutableSamplers = nullptr;
-        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-        VkDescriptorSetLayoutBinding imageSamplerLayoutBinding = {};
-        imageSamplerLayoutBinding.binding = 1;
-        imageSamplerLayoutBinding.descriptorCount = 1;
-        imageSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        imageSamplerLayoutBinding.pImmutableSamplers = nullptr;
-        imageSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-        VkDescriptorSetLayoutBinding depthSamplerLayoutBinding = {};
-        depthSamplerLayoutBinding.binding = 2;
-        depthSamplerLayoutBinding.descriptorCount = 1;
-        depthSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        depthSamplerLayoutBinding.pImmutableSamplers = nullptr;
-        depthSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-        std::array<VkDescriptorSetLayoutBinding, 3> bindings = {uboLayoutBinding, imageSamplerLayoutBinding, depthSamplerLayoutBinding};
-        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = bindings.size();
-        layoutInfo.pBindings = bindings.data();
+    // Called once the frame slot's previous submission has completed
+    void collectGpuPassTimes() {
+        FrameCommands &frame = frameCommands[currentFrame];
+        for (uint32_t pass = 0; pass < GPU_PASS_COUNT; pass++) {
+            if (!frame.passTimestampsWritten[pass]) {
+                continue;
+            }
+            frame.passTimestampsWritten[pass] = false;
 
-        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor set layout!");
+            uint64_t timestamps[2];
+            VkResult result = vkGetQueryPoolResults(device, frame.timestampQueryPool, 2 * pass, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+            if (result != VK_SUCCESS) {
+                continue;
+            }
+
+            float passTime = (timestamps[1] - timestamps[0]) * timestampPeriod * 1.0e-6f;
+            frameStats.gpuPassTimeSum[pass] += passTime;
+            frameStats.gpuPassTimeCount[pass]++;
+
+            if (pass == GPU_PASS_MAIN && options.dynamicResolution) {
+                resolutionScaleController.update(passTime);
+            }
+
+#ifdef ENABLE_CPU_PROFILER
+            if (traceCaptureActive()) {
+                profileCollector.addGpuEvent(GPU_PASS_NAMES[pass], gpuTicksToCpuNs(timestamps[0]), gpuTicksToCpuNs(timestamps[1]));
+            }
+#endif
         }
     }
 
-    void createShadowMapDescriptorSetLayout() {
-        VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-        uboLayoutBinding.binding = 0;
-        uboLayoutBinding.descriptorCount = 1;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uboLayoutBinding.pImmutableSamplers = nullptr;
-        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-        std::array<VkDescriptorSetLayoutBinding, 1> bindings = {uboLayoutBinding};
-        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = bindings.size();
-        layoutInfo.pBindings = bindings.data();
+    // Called once the frame slot's previous submission has completed, like collectGpuPassTimes()
+    void collectPipelineStatistics() {
+        FrameCommands &frame = frameCommands[currentFrame];
+        for (uint32_t pass = 0; pass < GPU_PASS_COUNT; pass++) {
+            if (!frame.passStatisticsWritten[pass]) {
+                continue;
+            }
+            frame.passStatisticsWritten[pass] = false;
 
-        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &shadowMapDescriptorSetLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor set layout!");
+            std::array<uint64_t, PIPELINE_STATISTIC_COUNT> statistics;
+            VkResult result = vkGetQueryPoolResults(device, frame.statisticsQueryPool, pass, 1, sizeof(statistics), statistics.data(), sizeof(statistics), VK_QUERY_RESULT_64_BIT);
+            if (result != VK_SUCCESS) {
+                continue;
+            }
+
+            for (uint32_t statistic = 0; statistic < PIPELINE_STATISTIC_COUNT; statistic++) {
+                frameStats.pipelineStatisticSum[pass][statistic] += statistics[statistic];
+            }
+            frameStats.pipelineStatisticCount[pass]++;
         }
     }
 
-    void createGraphicsPipeline() {
-        auto vertShaderCode = readFile("../shaders/render.vert.spv");
-        auto fragShaderCode = readFile("../shaders/render.frag.spv");
+    // Pairs a GPU timestamp with a steady_clock time so GPU events can be placed on the CPU timeline.
+    // Uses VK_EXT_calibrated_timestamps when available; otherwise a timestamp is written by a
+    // one-shot submit and paired with the midpoint of the CPU time around the submit and wait.
+    void calibrateGpuClock() {
+        if (calibratedTimestampsEnabled) {
+            VkCalibratedTimestampInfoEXT timestampInfos[2] = {};
+            timestampInfos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+            timestampInfos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+            timestampInfos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+            timestampInfos[1].timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+
+            uint64_t timestamps[2];
+            uint64_t maxDeviation;
+            if (vkGetCalibratedTimestampsEXT(device, 2, timestampInfos, timestamps, &maxDeviation) == VK_SUCCESS) {
+                gpuCalibrationTicks = timestamps[0];
+                cpuCalibrationNs = timestamps[1];
+                return;
+            }
+        }
 
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+        if (calibrationQueryPool == VK_NULL_HANDLE) {
+            return;
+        }
 
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertShaderModule;
-        vertShaderStageInfo.pName = "main";
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        vkCmdResetQueryPool(commandBuffer, calibrationQueryPool, 0, 1);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, calibrationQueryPool, 0);
 
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragShaderStageInfo.module = fragShaderModule;
-        fragShaderStageInfo.pName = "main";
+        auto submitTime = std::chrono::steady_clock::now();
+        endSingleTimeCommands(commandBuffer);
+        auto completeTime = std::chrono::steady_clock::now();
 
-        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+        uint64_t timestamp;
+        if (vkGetQueryPoolResults(device, calibrationQueryPool, 0, 1, sizeof(timestamp), &timestamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS) {
+            gpuCalibrationTicks = timestamp;
+            cpuCalibrationNs = std::chrono::duration_cast<std::chrono::nanoseconds>((submitTime + (completeTime - submitTime) / 2).time_since_epoch()).count();
+        }
+    }
 
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    uint64_t gpuTicksToCpuNs(uint64_t ticks) const {
+        double deltaNs = static_cast<double>(static_cast<int64_t>(ticks - gpuCalibrationTicks)) * timestampPeriod;
+        return cpuCalibrationNs + static_cast<int64_t>(deltaNs);
+    }
 
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    // The fence of the current frame has been waited on, so its pools can be reset in bulk
+    // instead of resetting or reallocating individual command buffers.
+    void recordFrameCommands(uint32_t imageIndex) {
+        auto startTime = std::chrono::high_resolution_clock::now();
 
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
-        vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+        FrameCommands &frame = frameCommands[currentFrame];
+        vkResetCommandPool(device, frame.commandPool, 0);
+        for (const auto &worker : recordWorkers[currentFrame]) {
+            vkResetCommandPool(device, worker.commandPool, 0);
+        }
+        allocateFrameDescriptorSet(imageIndex);
 
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        inputAssembly.primitiveRestartEnable = VK_FALSE;
+        if (options.gpuCulling) {
+            recordCullCommandBuffer(frame.cullCommandBuffer, imageIndex);
+        }
+        recordShadowMapCommandBuffer(frame.shadowMapCommandBuffer, imageIndex);
+        recordCommandBuffer(frame.commandBuffer, imageIndex);
 
-        VkViewport viewport = {};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float) swapChainExtent.width;
-        viewport.height = (float) swapChainExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        frameStats.recordCpuTimeSum += std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - startTime).count();
+        frameStats.recordCpuTimeCount++;
+    }
 
-        VkRect2D scissor = {};
-        scissor.offset = {0, 0};
-        scissor.extent = swapChainExtent;
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, size_t i) {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-        VkPipelineViewportStateCreateInfo viewportState = {};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
-        viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-        VkPipelineRasterizationStateCreateInfo rasterizer = {};
-        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizer.depthClampEnable = VK_FALSE;
-        rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-        rasterizer.depthBiasEnable = VK_FALSE;
+        if (options.clusteredLighting) {
+            recordLightBinning(commandBuffer);
+        }
 
-        VkPipelineMultisampleStateCreateInfo multisampling = {};
-        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampling.sampleShadingEnable = VK_FALSE;
-        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        if (meshletPath != MESHLET_PATH_OBJECTS) {
+            recordMeshletCulling(commandBuffer, i);
+        }
 
-        VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-        depthStencil.depthTestEnable = VK_TRUE;
-        depthStencil.depthWriteEnable = VK_TRUE;
-        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-        depthStencil.depthBoundsTestEnable = VK_FALSE;
-        depthStencil.stencilTestEnable = VK_FALSE;
+        beginGpuPass(commandBuffer, GPU_PASS_MAIN);
+        setRenderViewport(commandBuffer);
 
-        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = swapChainFramebuffers[i];
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = renderExtent();
 
-        VkPipelineColorBlendStateCreateInfo colorBlending = {};
-        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlending.logicOpEnable = VK_FALSE;
-        colorBlending.logicOp = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount = 1;
-        colorBlending.pAttachments = &colorBlendAttachment;
-        colorBlending.blendConstants[0] = 0.0f;
-        colorBlending.blendConstants[1] = 0.0f;
-        colorBlending.blendConstants[2] = 0.0f;
-        colorBlending.blendConstants[3] = 0.0f;
+        std::array<VkClearValue, 2> clearValues = {};
+        clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+        clearValues[1].depthStencil = { 1.0f, 0 };
 
-        VkDescriptorSetLayout setLayouts[] = {descriptorSetLayout};
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = setLayouts;
+        renderPassInfo.clearValueCount = clearValues.size();
+        renderPassInfo.pClearValues = clearValues.data();
 
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
+        VkSubpassContents contents = usesThreadedRecording() ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+        if (options.depthPrepass) {
+            // The pre-pass is a handful of commands, so it is always recorded inline
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            bindDrawState(commandBuffer, depthPrepassPipeline, shadowMapPipelineLayout, frameDepthPrepassDescriptorSets[currentFrame]);
+            recordCameraDraws(commandBuffer, shadowMapPipelineLayout, i);
+            vkCmdNextSubpass(commandBuffer, contents);
+        } else {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
         }
 
-        VkGraphicsPipelineCreateInfo pipelineInfo = {};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.stageCount = 2;
-        pipelineInfo.pStages = shaderStages;
-        pipelineInfo.pVertexInputState = &vertexInputInfo;
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizer;
-        pipelineInfo.pMultisampleState = &multisampling;
-        pipelineInfo.pDepthStencilState = &depthStencil;
-        pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.layout = pipelineLayout;
-        pipelineInfo.renderPass = renderPass;
-        pipelineInfo.subpass = 0;
-        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+        if (usesThreadedRecording()) {
+            std::vector<VkCommandBuffer> secondaryCommandBuffers = recordSecondaryCommandBuffers(i, false);
+            vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+        } else if (meshletPath == MESHLET_PATH_MESH_SHADER) {
+            recordMeshShaderDraws(commandBuffer);
+        } else {
+            bindDrawState(commandBuffer, graphicsPipeline, pipelineLayout, frameDescriptorSets[currentFrame]);
+            recordCameraDraws(commandBuffer, pipelineLayout, i);
+        }
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
+        vkCmdEndRenderPass(commandBuffer);
+
+        endGpuPass(commandBuffer, GPU_PASS_MAIN);
+
+        if (meshletPath != MESHLET_PATH_OBJECTS) {
+            recordMeshletStatsCopy(commandBuffer, i);
         }
 
-        vkDestroyShaderModule(device, vertShaderModule, nullptr);
-        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        if (options.dynamicResolution) {
+            recordUpscalePass(commandBuffer, i);
+        }
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
     }
 
-    void createShadowMapGraphicsPipeline() {
-        auto vertShaderCode = readFile("../shaders/shadow.vert.spv");
-        auto fragShaderCode = readFile("../shaders/shadow.frag.spv");
+    // The cluster light lists are per swap chain image like the uniform buffers, so the
+    // previous reader finished before the image was acquired again
+    void recordLightBinning(VkCommandBuffer commandBuffer) {
+        beginGpuPass(commandBuffer, GPU_PASS_LIGHT_BINNING);
 
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterPipelineLayout, 0, 1, &frameClusterDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdDispatch(commandBuffer, (CLUSTER_COUNT + 63) / 64, 1, 1);
 
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertShaderModule;
-        vertShaderStageInfo.pName = "main";
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragShaderStageInfo.module = fragShaderModule;
-        fragShaderStageInfo.pName = "main";
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             1, &barrier,
+                             0, nullptr,
+                             0, nullptr);
 
-        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+        endGpuPass(commandBuffer, GPU_PASS_LIGHT_BINNING);
+    }
 
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    // Stretches the rendered region of sceneColorImage over the whole swap chain image
+    void recordUpscalePass(VkCommandBuffer commandBuffer, size_t i) {
+        beginGpuPass(commandBuffer, GPU_PASS_UPSCALE);
 
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = upscaleRenderPass;
+        renderPassInfo.framebuffer = upscaleFramebuffers[i];
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = swapChainExtent;
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
-        vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, upscalePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, upscalePipelineLayout, 0, 1, &frameUpscaleDescriptorSets[currentFrame], 0, nullptr);
 
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        inputAssembly.primitiveRestartEnable = VK_FALSE;
+        VkExtent2D extent = renderExtent();
+        UpscalePushConstants constants;
+        constants.uvScale = glm::vec2(extent.width, extent.height) / glm::vec2(swapChainExtent.width, swapChainExtent.height);
+        constants.uvMax = (glm::vec2(extent.width, extent.height) - 0.5f) / glm::vec2(swapChainExtent.width, swapChainExtent.height);
+        vkCmdPushConstants(commandBuffer, upscalePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(UpscalePushConstants), &constants);
 
-        VkViewport viewport = {};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float) SHADOW_MAP_SIZE;
-        viewport.height = (float) SHADOW_MAP_SIZE;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
-        VkExtent2D shadowMapExtent = {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE};
-        VkRect2D scissor = {};
-        scissor.offset = {0, 0};
-        scissor.extent = shadowMapExtent;
+        vkCmdEndRenderPass(commandBuffer);
 
-        VkPipelineViewportStateCreateInfo viewportState = {};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
-        viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+        endGpuPass(commandBuffer, GPU_PASS_UPSCALE);
+    }
 
-        VkPipelineRasterizationStateCreateInfo rasterizer = {};
-        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizer.depthClampEnable = VK_FALSE;
-        rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-        rasterizer.depthBiasEnable = VK_FALSE;
+    // Part of the camera view that is rendered this frame
+    VkExtent2D renderExtent() const {
+        if (!options.dynamicResolution) {
+            return swapChainExtent;
+        }
 
-        VkPipelineMultisampleStateCreateInfo multisampling = {};
-        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampling.sampleShadingEnable = VK_FALSE;
-        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        float scale = resolutionScaleController.scale();
+        return {
+            std::max(1u, static_cast<uint32_t>(swapChainExtent.width * scale + 0.5f)),
+            std::max(1u, static_cast<uint32_t>(swapChainExtent.height * scale + 0.5f))
+        };
+    }
 
-        VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-        depthStencil.depthTestEnable = VK_TRUE;
-        depthStencil.depthWriteEnable = VK_TRUE;
-        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-        depthStencil.depthBoundsTestEnable = VK_FALSE;
-        depthStencil.stencilTestEnable = VK_FALSE;
+    void setRenderViewport(VkCommandBuffer commandBuffer) {
+        VkExtent2D extent = renderExtent();
+
+        VkViewport viewport = {};
+        viewport.width = (float) extent.width;
+        viewport.height = (float) extent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
+        VkRect2D scissor = {};
+        scissor.extent = extent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
 
-        VkPipelineColorBlendStateCreateInfo colorBlending = {};
-        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlending.logicOpEnable = VK_FALSE;
-        colorBlending.logicOp = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount = 1;
-        colorBlending.pAttachments = &colorBlendAttachment;
-        colorBlending.blendConstants[0] = 0.0f;
-        colorBlending.blendConstants[1] = 0.0f;
-        colorBlending.blendConstants[2] = 0.0f;
-        colorBlending.blendConstants[3] = 0.0f;
+    void recordCameraDraws(VkCommandBuffer commandBuffer, VkPipelineLayout layout, size_t i) {
+        if (meshletPath == MESHLET_PATH_COMPUTE) {
+            vkCmdDrawIndexedIndirectCount(commandBuffer, meshletDrawBuffers[i], MESHLET_DRAW_BUFFER_HEADER_SIZE, meshletDrawBuffers[i], 0, meshletDrawCapacity, sizeof(VkDrawIndexedIndirectCommand));
+        } else if (options.gpuCulling) {
+            vkCmdDrawIndexedIndirectCount(commandBuffer, cameraDrawBuffers[i], 0, drawCountBuffers[i], 0, static_cast<uint32_t>(instances.size()), sizeof(VkDrawIndexedIndirectCommand));
+        } else if (options.cpuCulling) {
+            vkCmdDrawIndexedIndirectCount(commandBuffer, cpuDrawBuffers[i], 0, cpuDrawBuffers[i], cpuDrawCountOffset(), static_cast<uint32_t>(instances.size()), sizeof(VkDrawIndexedIndirectCommand));
+        } else {
+            const std::vector<DrawBatch> &batches = cameraDrawBatches();
+            recordDrawBatches(commandBuffer, layout, batches, 0, batches.size());
+        }
+    }
 
-        VkDescriptorSetLayout setLayouts[] = {shadowMapDescriptorSetLayout};
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = setLayouts;
+    void recordShadowMapCommandBuffer(VkCommandBuffer shadowMapCommandBuffer, size_t i) {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &shadowMapPipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
+        vkBeginCommandBuffer(shadowMapCommandBuffer, &beginInfo);
+        beginGpuPass(shadowMapCommandBuffer, GPU_PASS_SHADOW);
+
+        // The budget may leave every tile as it is
+        if (!shadowTileUpdates.empty()) {
+            recordShadowMapRenderPass(shadowMapCommandBuffer, i);
         }
 
-        VkGraphicsPipelineCreateInfo pipelineInfo = {};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.stageCount = 2;
-        pipelineInfo.pStages = shaderStages;
-        pipelineInfo.pVertexInputState = &vertexInputInfo;
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizer;
-        pipelineInfo.pMultisampleState = &multisampling;
-        pipelineInfo.pDepthStencilState = &depthStencil;
-        pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.layout = shadowMapPipelineLayout;
-        pipelineInfo.renderPass = shadowMapRenderPass;
-        pipelineInfo.subpass = 0;
-        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+        endGpuPass(shadowMapCommandBuffer, GPU_PASS_SHADOW);
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &shadowMapGraphicsPipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
+        if (options.cubeShadows) {
+            recordCubeShadowPass(shadowMapCommandBuffer);
         }
 
-        vkDestroyShaderModule(device, vertShaderModule, nullptr);
-        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        if (vkEndCommandBuffer(shadowMapCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
     }
 
-    void createFramebuffers() {
-        swapChainFramebuffers.resize(swapChainImageViews.size());
+    void recordShadowMapRenderPass(VkCommandBuffer shadowMapCommandBuffer, size_t i) {
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = shadowMapRenderPass;
+        renderPassInfo.framebuffer = shadowMapFramebuffer;
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = { shadowAtlasSize(), shadowAtlasSize() };
 
-        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-            std::array<VkImageView, 2> attachments = {
-                swapChainImageViews[i],
-                depthImageView
-            };
+        std::array<VkClearValue, 2> clearValues = {};
+        clearValues[0].color = { 1.0f, 0.0f, 0.0f, 1.0f };
+        clearValues[1].depthStencil = { 1.0f, 0 };
 
-            VkFramebufferCreateInfo framebufferInfo = {};
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.renderPass = renderPass;
-            framebufferInfo.attachmentCount = attachments.size();
-            framebufferInfo.pAttachments = attachments.data();
-            framebufferInfo.width = swapChainExtent.width;
-            framebufferInfo.height = swapChainExtent.height;
-            framebufferInfo.layers = 1;
+        renderPassInfo.clearValueCount = clearValues.size();
+        renderPassInfo.pClearValues = clearValues.data();
 
-            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
+        if (usesThreadedRecording()) {
+            vkCmdBeginRenderPass(shadowMapCommandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+            std::vector<VkCommandBuffer> secondaryCommandBuffers = recordSecondaryCommandBuffers(i, true);
+            vkCmdExecuteCommands(shadowMapCommandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+
+            vkCmdEndRenderPass(shadowMapCommandBuffer);
+        } else {
+            vkCmdBeginRenderPass(shadowMapCommandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            bindDrawState(shadowMapCommandBuffer, shadowMapGraphicsPipeline, shadowMapPipelineLayout, shadowMapDescriptorSets[0]);
+
+            // Each tile draws the list culled against its own light
+            for (uint32_t light : shadowTileUpdates) {
+                recordShadowTile(shadowMapCommandBuffer, light, cachesShadowTiles());
+
+                if (options.gpuCulling) {
+                    VkDeviceSize drawOffset = sizeof(VkDrawIndexedIndirectCommand) * instances.size() * light;
+                    vkCmdDrawIndexedIndirectCount(shadowMapCommandBuffer, lightDrawBuffers[i], drawOffset, drawCountBuffers[i], cullLightDrawCountOffset(light), static_cast<uint32_t>(instances.size()), sizeof(VkDrawIndexedIndirectCommand));
+                } else if (options.cpuCulling) {
+                    vkCmdDrawIndexedIndirectCount(shadowMapCommandBuffer, cpuDrawBuffers[i], cpuShadowDrawOffset(light), cpuDrawBuffers[i], cpuDrawCountOffset() + (1 + light) * sizeof(uint32_t), static_cast<uint32_t>(instances.size()), sizeof(VkDrawIndexedIndirectCommand));
+                } else {
+                    const std::vector<DrawBatch> &batches = shadowPassDrawBatches();
+                    recordDrawBatches(shadowMapCommandBuffer, shadowMapPipelineLayout, batches, 0, batches.size());
+                }
             }
+
+            vkCmdEndRenderPass(shadowMapCommandBuffer);
         }
     }
 
-    void createCommandPool() {
-        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+    // Restricts rendering to the light's tile and binds the light's matrix
+    void recordShadowTile(VkCommandBuffer commandBuffer, uint32_t light, bool clearTile) {
+        const ShadowAtlasTile &tile = shadowAtlasTiles[light];
 
-        VkCommandPoolCreateInfo poolInfo = {};
-        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+        VkViewport viewport = { static_cast<float>(tile.x), static_cast<float>(tile.y), static_cast<float>(tile.size), static_cast<float>(tile.size), 0.0f, 1.0f };
+        VkRect2D scissor = { { static_cast<int32_t>(tile.x), static_cast<int32_t>(tile.y) }, { tile.size, tile.size } };
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics command pool!");
+        if (clearTile) {
+            VkClearAttachment clearAttachment = {};
+            clearAttachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            clearAttachment.colorAttachment = 0;
+            clearAttachment.clearValue.color = { 1.0f, 0.0f, 0.0f, 1.0f };
+
+            VkClearRect clearRect = { scissor, 0, 1 };
+            vkCmdClearAttachments(commandBuffer, 1, &clearAttachment, 1, &clearRect);
         }
+
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 0, 1, &shadowMapDescriptorSets[light], 0, nullptr);
     }
 
-    void createDepthResources() {
-        VkFormat depthFormat = findDepthFormat();
+    // Renders all six faces of the key light's cube map, in one pass unless the mode is six passes
+    void recordCubeShadowPass(VkCommandBuffer commandBuffer) {
+        beginGpuPass(commandBuffer, GPU_PASS_CUBE_SHADOW);
 
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = { CUBE_SHADOW_SIZE, CUBE_SHADOW_SIZE };
 
-        transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+        // Beyond the range nothing is shadowed
+        std::array<VkClearValue, 2> clearValues = {};
+        clearValues[0].color = { 1.0f, 1.0f, 0.0f, 1.0f };
+        clearValues[1].depthStencil = { 1.0f, 0 };
+
+        renderPassInfo.clearValueCount = clearValues.size();
+        renderPassInfo.pClearValues = clearValues.data();
+
+        VkPipeline pipeline = cubeShadowPipelines[cubeShadowMode];
+        VkDescriptorSet descriptorSet = frameCubeShadowDescriptorSets[currentFrame];
+
+        if (cubeShadowMode == CUBE_SHADOW_SIX_PASSES) {
+            renderPassInfo.renderPass = cubeShadowRenderPass;
+            for (uint32_t face = 0; face < 6; face++) {
+                renderPassInfo.framebuffer = cubeShadowFaceFramebuffers[face];
+                vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+                bindDrawState(commandBuffer, pipeline, cubeShadowPipelineLayout, descriptorSet);
+                vkCmdPushConstants(commandBuffer, cubeShadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &face);
+                recordIndirectDraws(commandBuffer, cubeShadowFaceDraws[face]);
+
+                vkCmdEndRenderPass(commandBuffer);
+            }
+        } else {
+            bool multiview = cubeShadowMode == CUBE_SHADOW_MULTIVIEW;
+            renderPassInfo.renderPass = multiview ? cubeShadowMultiviewRenderPass : cubeShadowRenderPass;
+            renderPassInfo.framebuffer = multiview ? cubeShadowMultiviewFramebuffer : cubeShadowLayeredFramebuffer;
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            bindDrawState(commandBuffer, pipeline, cubeShadowPipelineLayout, descriptorSet);
+            recordIndirectDraws(commandBuffer, multiview ? cubeShadowMultiviewDraws : cubeShadowLayeredDraws);
+
+            vkCmdEndRenderPass(commandBuffer);
+        }
+
+        endGpuPass(commandBuffer, GPU_PASS_CUBE_SHADOW);
     }
 
-    void createShadowMapResources() {
-        shadowMapColorFormat = findSupportedFormat({VK_FORMAT_R32G32_SFLOAT}, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
-        shadowMapDepthFormat = findSupportedFormat({VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT}, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
-        createImage(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1, shadowMapColorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapColorImage, shadowMapColorImageMemory);
-        createImage(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1, shadowMapDepthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapDepthImage, shadowMapDepthImageMemory);
-        shadowMapColorImageView = createImageView(shadowMapColorImage, shadowMapColorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
-        shadowMapDepthImageView = createImageView(shadowMapDepthImage, shadowMapDepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-        //transitionImageLayout(shadowMapColorImage, shadowMapColorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1);
-        //transitionImageLayout(shadowMapDepthImage, shadowMapDepthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+    void recordIndirectDraws(VkCommandBuffer commandBuffer, const IndirectDrawRange &range) {
+        if (range.commandCount > 0) {
+            vkCmdDrawIndexedIndirect(commandBuffer, cubeShadowDrawBuffer, range.firstCommand * sizeof(VkDrawIndexedIndirectCommand), range.commandCount, sizeof(VkDrawIndexedIndirectCommand));
+        }
     }
 
-    void createShadowMapFramebuffer() {
-        std::array<VkImageView, 2> attachments = {
-            shadowMapColorImageView,
-            shadowMapDepthImageView
-        };
+    void createClusterDescriptorSetLayout() {
+        clusterDescriptorBindings = reflectDescriptorSetBindings({"cluster.comp.spv"});
+        clusterDescriptorSetLayout = descriptorSetLayoutCache.get(device, clusterDescriptorBindings);
+    }
 
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = shadowMapRenderPass;
-        framebufferInfo.attachmentCount = attachments.size();
-        framebufferInfo.pAttachments = attachments.data();
-        framebufferInfo.width = SHADOW_MAP_SIZE;
-        framebufferInfo.height = SHADOW_MAP_SIZE;
-        framebufferInfo.layers = 1;
+    void createClusterPipeline() {
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &clusterDescriptorSetLayout;
 
-        if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &shadowMapFramebuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to crate shadow map framebuffer!");
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &clusterPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create cluster pipeline layout!");
         }
+
+        clusterPipeline = buildComputePipeline(loadShaderModule("cluster.comp.spv"), clusterPipelineLayout);
     }
 
-    VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
-        for (VkFormat format : candidates) {
-            VkFormatProperties props;
-            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+    // Takes ownership of the shader module, like buildGraphicsPipeline(). The layouts of the
+    // compute pipelines live as long as the device, so it may also run on the shader reload thread.
+    VkPipeline buildComputePipeline(VkShaderModule compShaderModule, VkPipelineLayout layout) {
+        VkPipelineShaderStageCreateInfo compShaderStageInfo = {};
+        compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        compShaderStageInfo.module = compShaderModule;
+        compShaderStageInfo.pName = "main";
+
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage = compShaderStageInfo;
+        pipelineInfo.layout = layout;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-            if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features) {
-                return format;
-            } else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
-                return format;
-            }
+        VkPipeline pipeline;
+        VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute pipeline!");
         }
 
-        throw std::runtime_error("failed to find supported format!");
+        return pipeline;
     }
 
-    VkFormat findDepthFormat() {
-        return findSupportedFormat(
-            {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
-            VK_IMAGE_TILING_OPTIMAL,
-            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-        );
+    void createCullDescriptorSetLayout() {
+        cullDescriptorBindings = reflectDescriptorSetBindings({"cull.comp.spv"});
+        cullDescriptorSetLayout = descriptorSetLayoutCache.get(device, cullDescriptorBindings);
     }
 
-    bool hasStencilComponent(VkFormat format) {
-        return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
-    }
+    void createCullPipeline() {
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-    void createTextureImage() {
-        int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load(TEX_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        VkDeviceSize imageSize = texWidth * texHeight * 4;
-        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create cull pipeline layout!");
+        }
 
-        if (!pixels) {
-            throw std::runtime_error("failed to load texture image!");
+        cullPipeline = buildComputePipeline(loadShaderModule("cull.comp.spv"), cullPipelineLayout);
+    }
+
+    void createCullBuffers() {
+        std::vector<CullObject> cullObjects(instances.size());
+        for (size_t i = 0; i < instances.size(); i++) {
+            const MeshRange &mesh = instanceMesh(i);
+            const glm::mat4 &modelMat = instances[i].modelMat;
+            float scale = std::max(glm::length(glm::vec3(modelMat[0])), std::max(glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))));
+
+            cullObjects[i].boundingSphere = glm::vec4(glm::vec3(modelMat * glm::vec4(glm::vec3(mesh.boundingSphere), 1.0f)), mesh.boundingSphere.w * scale);
+            cullObjects[i].aabbCenter = glm::vec4(objectBounds.centerX[i], objectBounds.centerY[i], objectBounds.centerZ[i], 0.0f);
+            cullObjects[i].aabbExtent = glm::vec4(objectBounds.extentX[i], objectBounds.extentY[i], objectBounds.extentZ[i], 0.0f);
+            cullObjects[i].firstIndex = mesh.firstIndex;
+            cullObjects[i].indexCount = mesh.indexCount;
+            cullObjects[i].flags = instances[i].flags;
         }
 
+        VkDeviceSize bufferSize = sizeof(cullObjects[0]) * cullObjects.size();
+
         VkBuffer stagingBuffer;
         VkDeviceMemory stagingBufferMemory;
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
-        void *data;
-        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
+        void* data;
+        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+            memcpy(data, cullObjects.data(), (size_t) bufferSize);
         vkUnmapMemory(device, stagingBufferMemory);
 
-        stbi_image_free(pixels);
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cullObjectBuffer, cullObjectBufferMemory);
 
-        createImage(texWidth, texHeight, mipLevels, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-
-        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-        copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+        copyBuffer(stagingBuffer, cullObjectBuffer, bufferSize);
 
         vkDestroyBuffer(device, stagingBuffer, nullptr);
         vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
 
-        generateMipMaps(textureImage, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+    // The outputs of cull.comp, one set per swap chain image like cpuDrawBuffers. The host waits
+    // for an image's previous frame before recording it again, so no frame overwrites draws that
+    // another frame in flight still reads.
+    void createCullDrawBuffers() {
+        cameraDrawBuffers.resize(swapChainImages.size());
+        cameraDrawBuffersMemory.resize(swapChainImages.size());
+        lightDrawBuffers.resize(swapChainImages.size());
+        lightDrawBuffersMemory.resize(swapChainImages.size());
+        drawCountBuffers.resize(swapChainImages.size());
+        drawCountBuffersMemory.resize(swapChainImages.size());
+
+        VkDeviceSize drawBufferSize = sizeof(VkDrawIndexedIndirectCommand) * instances.size();
+        // Camera and total light draw counts, the light triangle count and padding, the light
+        // space bounds of the receivers that cull.comp gathers in its first pass, then the draw
+        // count of each shadow light
+        VkDeviceSize countBufferSize = cullLightDrawCountOffset(options.shadowLightCount);
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(drawBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cameraDrawBuffers[i], cameraDrawBuffersMemory[i]);
+            createBuffer(drawBufferSize * options.shadowLightCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lightDrawBuffers[i], lightDrawBuffersMemory[i]);
+            createBuffer(countBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawCountBuffers[i], drawCountBuffersMemory[i]);
+        }
     }
 
-    void generateMipMaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
-        VkFormatProperties formatProperties;
-        vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
+    void destroyCullDrawBuffers() {
+        for (size_t i = 0; i < cameraDrawBuffers.size(); i++) {
+            vkDestroyBuffer(device, cameraDrawBuffers[i], nullptr);
+            vkFreeMemory(device, cameraDrawBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, lightDrawBuffers[i], nullptr);
+            vkFreeMemory(device, lightDrawBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, drawCountBuffers[i], nullptr);
+            vkFreeMemory(device, drawCountBuffersMemory[i], nullptr);
+        }
+    }
 
-        if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-            throw std::runtime_error("texture image format does not support linear blitting!");
+    VkDeviceSize cullLightDrawCountOffset(uint32_t light) const {
+        return (10 + light) * sizeof(uint32_t);
+    }
+
+    void destroyCullBuffers() {
+        vkDestroyBuffer(device, cullObjectBuffer, nullptr);
+        vkFreeMemory(device, cullObjectBufferMemory, nullptr);
+    }
+
+    void createCullUniformBuffers() {
+        cullUniformBuffers.resize(swapChainImages.size());
+        cullUniformBuffersMemory.resize(swapChainImages.size());
+        cullStatsBuffers.resize(swapChainImages.size());
+        cullStatsBuffersMemory.resize(swapChainImages.size());
+
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(sizeof(UBOCullPass), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullUniformBuffers[i], cullUniformBuffersMemory[i]);
+            createBuffer(4 * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullStatsBuffers[i], cullStatsBuffersMemory[i]);
         }
+    }
 
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    void createCullDescriptorPool() {
+        auto poolSizes = descriptorPoolSizes(cullDescriptorBindings, static_cast<uint32_t>(swapChainImages.size()));
 
-        VkImageMemoryBarrier barrier = {};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.image = image;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
-        barrier.subresourceRange.levelCount = 1;
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
 
-        int32_t mipWidth = texWidth;
-        int32_t mipHeight = texHeight;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &cullDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create cull descriptor pool!");
+        }
+    }
 
-        for (uint32_t i = 1; i < mipLevels; i++) {
-            barrier.subresourceRange.baseMipLevel = i - 1;
-            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    void createCullDescriptorSets() {
+        std::vector<VkDescriptorSetLayout> layouts(swapChainImages.size(), cullDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = cullDescriptorPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
+        allocInfo.pSetLayouts = layouts.data();
 
-            vkCmdPipelineBarrier(commandBuffer,
-                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-                                 0, nullptr,
-                                 0, nullptr,
-                                 1, &barrier);
+        cullDescriptorSets.resize(swapChainImages.size());
+        if (vkAllocateDescriptorSets(device, &allocInfo, cullDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate cull descriptor sets!");
+        }
 
-            VkImageBlit blit = {};
-            blit.srcOffsets[0] = {0, 0, 0};
-            blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-            blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.srcSubresource.mipLevel = i - 1;
-            blit.srcSubresource.baseArrayLayer = 0;
-            blit.srcSubresource.layerCount = 1;
-            blit.dstOffsets[0] = {0, 0, 0};
-            blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
-            blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.dstSubresource.mipLevel = i;
-            blit.dstSubresource.baseArrayLayer = 0;
-            blit.dstSubresource.layerCount = 1;
+        updateCullDescriptorSets();
+    }
+
+    void updateCullDescriptorSets() {
+        for (size_t i = 0; i < cullDescriptorSets.size(); i++) {
+            std::array<VkDescriptorBufferInfo, 5> bufferInfos = {};
+            bufferInfos[0].buffer = cullUniformBuffers[i];
+            bufferInfos[0].range = sizeof(UBOCullPass);
+            bufferInfos[1].buffer = cullObjectBuffer;
+            bufferInfos[1].range = VK_WHOLE_SIZE;
+            bufferInfos[2].buffer = cameraDrawBuffers[i];
+            bufferInfos[2].range = VK_WHOLE_SIZE;
+            bufferInfos[3].buffer = lightDrawBuffers[i];
+            bufferInfos[3].range = VK_WHOLE_SIZE;
+            bufferInfos[4].buffer = drawCountBuffers[i];
+            bufferInfos[4].range = VK_WHOLE_SIZE;
+
+            std::array<VkWriteDescriptorSet, 5> descriptorWrites = {};
+            for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+                descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[binding].dstSet = cullDescriptorSets[i];
+                descriptorWrites[binding].dstBinding = binding;
+                descriptorWrites[binding].dstArrayElement = 0;
+                descriptorWrites[binding].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrites[binding].descriptorCount = 1;
+                descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+            }
+
+            vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+
+    void recordCullCommandBuffer(VkCommandBuffer commandBuffer, size_t i) {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        beginGpuPass(commandBuffer, GPU_PASS_CULL);
+
+        // This image's previous frame has completed, so its draw buffers are free to overwrite
+        vkCmdFillBuffer(commandBuffer, drawCountBuffers[i], 0, VK_WHOLE_SIZE, 0);
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-            vkCmdBlitImage(commandBuffer,
-                           image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                           image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                           1, &blit,
-                           VK_FILTER_LINEAR);
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier,
+                             0, nullptr,
+                             0, nullptr);
 
-            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[i], 0, nullptr);
 
-            vkCmdPipelineBarrier(commandBuffer,
-                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-                                 0, nullptr,
-                                 0, nullptr,
-                                 1, &barrier);
+        uint32_t cullPass = CULL_PASS_RECEIVERS;
+        vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cullPass), &cullPass);
+        vkCmdDispatch(commandBuffer, (static_cast<uint32_t>(instances.size()) + 63) / 64, 1, 1);
 
-            if (mipWidth > 1) mipWidth /= 2;
-            if (mipHeight > 1) mipHeight /= 2;
-        }
+        // The casters are tested against the receiver bounds of the whole first pass
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-        barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier,
+                             0, nullptr,
+                             0, nullptr);
+
+        cullPass = CULL_PASS_CASTERS;
+        vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cullPass), &cullPass);
+        vkCmdDispatch(commandBuffer, (static_cast<uint32_t>(instances.size()) + 63) / 64, 1, 1);
+
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
 
         vkCmdPipelineBarrier(commandBuffer,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             1, &barrier,
                              0, nullptr,
+                             0, nullptr);
+
+        VkBufferCopy copyRegion = {};
+        copyRegion.size = 4 * sizeof(uint32_t);
+        vkCmdCopyBuffer(commandBuffer, drawCountBuffers[i], cullStatsBuffers[i], 1, &copyRegion);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             1, &barrier,
                              0, nullptr,
-                             1, &barrier);
+                             0, nullptr);
 
-        endSingleTimeCommands(commandBuffer);
-    }
+        endGpuPass(commandBuffer, GPU_PASS_CULL);
 
-    void createTextureImageView() {
-        textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record cull command buffer!");
+        }
     }
 
-    void createTextureSampler() {
-        VkSamplerCreateInfo samplerInfo = {};
-        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-        samplerInfo.magFilter = VK_FILTER_LINEAR;
-        samplerInfo.minFilter = VK_FILTER_LINEAR;
-        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-        samplerInfo.anisotropyEnable = VK_TRUE;
-        samplerInfo.maxAnisotropy = 16;
-        samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-        samplerInfo.unnormalizedCoordinates = VK_FALSE;
-        samplerInfo.compareEnable = VK_FALSE;
-        samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-        samplerInfo.minLod = 0;
-        samplerInfo.maxLod = static_cast<float>(mipLevels);
-        samplerInfo.mipLodBias = 0;
+    void collectCullStats(uint32_t imageIndex) {
+        uint32_t drawCounts[4];
 
-        if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create texture sampler!");
-        }
+        void* data;
+        vkMapMemory(device, cullStatsBuffersMemory[imageIndex], 0, sizeof(drawCounts), 0, &data);
+            memcpy(drawCounts, data, sizeof(drawCounts));
+        vkUnmapMemory(device, cullStatsBuffersMemory[imageIndex]);
+
+        frameStats.objectCount = static_cast<uint32_t>(instances.size());
+        frameStats.cameraVisibleCount = drawCounts[0];
+        frameStats.shadowDrawCount = drawCounts[1];
+        frameStats.shadowTriangleCount = drawCounts[2];
     }
 
-    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
-        VkImageViewCreateInfo viewInfo = {};
-        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        viewInfo.image = image;
-        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        viewInfo.format = format;
-        viewInfo.subresourceRange.aspectMask = aspectFlags;
-        viewInfo.subresourceRange.baseMipLevel = 0;
-        viewInfo.subresourceRange.levelCount = mipLevels;
-        viewInfo.subresourceRange.baseArrayLayer = 0;
-        viewInfo.subresourceRange.layerCount = 1;
+    void createDeviceLocalBuffer(const void *contents, VkDeviceSize bufferSize, VkBufferUsageFlags usage, VkBuffer &buffer, VkDeviceMemory &bufferMemory) {
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
-        VkImageView imageView;
-        if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create texture image view!");
-        }
+        void* data;
+        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+            memcpy(data, contents, (size_t) bufferSize);
+        vkUnmapMemory(device, stagingBufferMemory);
 
-        return imageView;
-    }
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
 
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
-        VkImageCreateInfo imageInfo = {};
-        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.extent.width = width;
-        imageInfo.extent.height = height;
-        imageInfo.extent.depth = 1;
-        imageInfo.mipLevels = mipLevels;
-        imageInfo.arrayLayers = 1;
-        imageInfo.format = format;
-        imageInfo.tiling = tiling;
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageInfo.usage = usage;
-        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        copyBuffer(stagingBuffer, buffer, bufferSize);
 
-        if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create image!");
-        }
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
 
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, image, &memRequirements);
+    void createMeshletBuffers() {
+        createDeviceLocalBuffer(meshlets.data(), sizeof(meshlets[0]) * meshlets.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshletBuffer, meshletBufferMemory);
+        createDeviceLocalBuffer(meshletVertices.data(), sizeof(meshletVertices[0]) * meshletVertices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshletVertexBuffer, meshletVertexBufferMemory);
+        createDeviceLocalBuffer(meshletTriangles.data(), sizeof(meshletTriangles[0]) * meshletTriangles.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshletTriangleBuffer, meshletTriangleBufferMemory);
+    }
 
-        VkMemoryAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    // First meshlet and meshlet count per object. Also sizes the draw buffers for every meshlet visible.
+    void createMeshletObjectBuffer() {
+        std::vector<glm::uvec2> objectMeshlets(instances.size());
+        meshletDrawCapacity = 0;
+        meshletTriangleTotal = 0;
+        for (size_t i = 0; i < instances.size(); i++) {
+            const MeshRange &mesh = instanceMesh(i);
+            objectMeshlets[i] = glm::uvec2(mesh.firstMeshlet, mesh.meshletCount);
+            meshletDrawCapacity += mesh.meshletCount;
+            meshletTriangleTotal += mesh.indexCount / 3;
+        }
 
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        if (meshletPathSupported[MESHLET_PATH_MESH_SHADER]) {
+            uint64_t taskGroupCount = static_cast<uint64_t>(meshletTaskGroupsPerObject()) * instances.size();
+            if (taskGroupCount > maxTaskWorkGroupTotalCount) {
+                throw std::runtime_error("too many objects for one mesh shader draw: " + std::to_string(taskGroupCount) + " task workgroups");
+            }
         }
 
-        vkBindImageMemory(device, image, imageMemory, 0);
+        createDeviceLocalBuffer(objectMeshlets.data(), sizeof(objectMeshlets[0]) * objectMeshlets.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, meshletObjectBuffer, meshletObjectBufferMemory);
     }
 
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    void destroyMeshletObjectBuffer() {
+        vkDestroyBuffer(device, meshletObjectBuffer, nullptr);
+        vkFreeMemory(device, meshletObjectBufferMemory, nullptr);
+    }
 
-        VkImageMemoryBarrier barrier = {};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = image;
+    // The counters of the cull are followed by one indirect draw per visible meshlet
+    void createMeshletDrawBuffers() {
+        VkDeviceSize bufferSize = MESHLET_DRAW_BUFFER_HEADER_SIZE + sizeof(VkDrawIndexedIndirectCommand) * meshletDrawCapacity;
 
-        if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        meshletDrawBuffers.resize(swapChainImages.size());
+        meshletDrawBuffersMemory.resize(swapChainImages.size());
+        meshletStatsBuffers.resize(swapChainImages.size());
+        meshletStatsBuffersMemory.resize(swapChainImages.size());
+        meshletStatsPending.assign(swapChainImages.size(), false);
 
-            if (hasStencilComponent(format)) {
-                barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-            }
-        } else {
-            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletDrawBuffers[i], meshletDrawBuffersMemory[i]);
+            createBuffer(MESHLET_DRAW_BUFFER_HEADER_SIZE, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, meshletStatsBuffers[i], meshletStatsBuffersMemory[i]);
         }
+    }
 
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = mipLevels;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
+    void destroyMeshletDrawBuffers() {
+        for (size_t i = 0; i < meshletDrawBuffers.size(); i++) {
+            vkDestroyBuffer(device, meshletDrawBuffers[i], nullptr);
+            vkFreeMemory(device, meshletDrawBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, meshletStatsBuffers[i], nullptr);
+            vkFreeMemory(device, meshletStatsBuffersMemory[i], nullptr);
+        }
+    }
 
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
+    void createMeshletCullPipeline() {
+        meshletCullDescriptorBindings = reflectDescriptorSetBindings({"meshlet_cull.comp.spv"});
+        meshletCullDescriptorSetLayout = descriptorSetLayoutCache.get(device, meshletCullDescriptorBindings);
 
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullPushConstants) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &meshletCullDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &meshletCullPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create meshlet cull pipeline layout!");
+        }
 
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        meshletCullPipeline = buildComputePipeline(loadShaderModule("meshlet_cull.comp.spv"), meshletCullPipelineLayout);
+    }
 
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    void createMeshletDescriptorSetLayout() {
+        meshletDescriptorBindings = reflectDescriptorSetBindings({"meshlet.task.spv", "meshlet.mesh.spv"}, 1);
+        meshletDescriptorSetLayout = descriptorSetLayoutCache.get(device, meshletDescriptorBindings);
+    }
 
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    void createMeshShaderPipeline() {
+        std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayout, meshletDescriptorSetLayout };
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_TASK_BIT_EXT, 0, sizeof(MeshletCullPushConstants) };
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        } else {
-            throw std::invalid_argument("unsupported layout transition!");
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &meshShaderPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mesh shader pipeline layout!");
         }
 
-        vkCmdPipelineBarrier(
-            commandBuffer,
-            sourceStage, destinationStage,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &barrier
-        );
-
-        endSingleTimeCommands(commandBuffer);
+        meshShaderPipeline = buildMeshShaderPipeline(loadShaderModule("meshlet.task.spv"), loadShaderModule("meshlet.mesh.spv"), loadShaderModule("render.frag.spv"));
     }
 
-    void copyImage(VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    // The state of buildGraphicsPipeline() without vertex input and input assembly. The mesh shader
+    // path is not available with the depth pre-pass, so depth is always tested and written.
+    VkPipeline buildMeshShaderPipeline(VkShaderModule taskShaderModule, VkShaderModule meshShaderModule, VkShaderModule fragShaderModule) {
+        std::array<VkBool32, 2> fragConstants = {
+            options.clusteredLighting ? VK_TRUE : VK_FALSE,
+            options.cubeShadows ? VK_TRUE : VK_FALSE
+        };
+        std::array<VkSpecializationMapEntry, 2> fragSpecializationEntries = {{
+            { 1, 0, sizeof(VkBool32) },
+            { 2, sizeof(VkBool32), sizeof(VkBool32) }
+        }};
+        VkSpecializationInfo fragSpecializationInfo = { static_cast<uint32_t>(fragSpecializationEntries.size()), fragSpecializationEntries.data(), sizeof(fragConstants), fragConstants.data() };
+
+        std::array<VkPipelineShaderStageCreateInfo, 3> shaderStages = {};
+        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[0].stage = VK_SHADER_STAGE_TASK_BIT_EXT;
+        shaderStages[0].module = taskShaderModule;
+        shaderStages[0].pName = "main";
+
+        shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[1].stage = VK_SHADER_STAGE_MESH_BIT_EXT;
+        shaderStages[1].module = meshShaderModule;
+        shaderStages[1].pName = "main";
+
+        shaderStages[2].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[2].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderStages[2].module = fragShaderModule;
+        shaderStages[2].pName = "main";
+        shaderStages[2].pSpecializationInfo = &fragSpecializationInfo;
 
-        VkImageSubresourceLayers subResource = {};
-        subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        subResource.baseArrayLayer = 0;
-        subResource.mipLevel = 0;
-        subResource.layerCount = 1;
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
 
-        VkImageCopy region = {};
-        region.srcSubresource = subResource;
-        region.dstSubresource = subResource;
-        region.srcOffset = {0, 0, 0};
-        region.dstOffset = {0, 0, 0};
-        region.extent.width = width;
-        region.extent.height = height;
-        region.extent.depth = 1;
+        std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState = {};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
 
-        vkCmdCopyImage(
-            commandBuffer,
-            srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1, &region
-        );
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
 
-        endSingleTimeCommands(commandBuffer);
-    }
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = msaaSamples;
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
 
-        VkBufferImageCopy region = {};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageOffset = {0, 0, 0};
-        region.imageExtent = {
-                width,
-                height,
-                1
-        };
+        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
 
-        vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+        pipelineInfo.pStages = shaderStages.data();
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = meshShaderPipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = mainSubpass();
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-        endSingleTimeCommands(commandBuffer);
-    }
+        VkPipeline pipeline;
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
 
-    void loadModel() {
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string err, warn;
+        vkDestroyShaderModule(device, taskShaderModule, nullptr);
+        vkDestroyShaderModule(device, meshShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
-            throw std::runtime_error(err);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mesh shader pipeline!");
         }
 
-        std::unordered_map<Vertex, int> uniqueVertices = {};
+        return pipeline;
+    }
 
-        for (const auto& shape : shapes) {
-            for (const auto& index : shape.mesh.indices) {
-                Vertex vertex = {};
+    uint32_t meshletTaskGroupsPerObject() const {
+        return (maxMeshletsPerMesh + MESHLET_TASK_GROUP_SIZE - 1) / MESHLET_TASK_GROUP_SIZE;
+    }
 
-                if (index.vertex_index >= 0) {
-                    vertex.pos = {
-                        attrib.vertices[3 * index.vertex_index + 0],
-                        attrib.vertices[3 * index.vertex_index + 1],
-                        attrib.vertices[3 * index.vertex_index + 2]
-                    };
-                }
+    // Clears this image's meshlet counters and, on the compute path, culls the meshlets into
+    // indirect draws. The mesh shader path culls in its task shader during the main pass.
+    void recordMeshletCulling(VkCommandBuffer commandBuffer, size_t i) {
+        const bool computePath = meshletPath == MESHLET_PATH_COMPUTE;
+        const VkPipelineStageFlags cullStage = computePath ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT;
 
-                if (index.normal_index >= 0) {
-                    vertex.normal = {
-                        attrib.normals[3 * index.normal_index + 0],
-                        attrib.normals[3 * index.normal_index + 1],
-                        attrib.normals[3 * index.normal_index + 2]
-                    };
-                }
+        if (computePath) {
+            beginGpuPass(commandBuffer, GPU_PASS_MESHLET_CULL);
+        }
 
-                if (index.texcoord_index >= 0) {
-                    vertex.texCoord = {
-                        attrib.texcoords[2 * index.texcoord_index + 0],
-                        1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                    };
-                }
+        vkCmdFillBuffer(commandBuffer, meshletDrawBuffers[i], 0, MESHLET_DRAW_BUFFER_HEADER_SIZE, 0);
 
-                if (uniqueVertices.count(vertex) == 0) {
-                    uniqueVertices[vertex] = vertices.size();
-                    vertices.push_back(vertex);
-                }
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, cullStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-                indices.push_back(uniqueVertices[vertex]);
-            }
+        if (!computePath) {
+            return;
         }
 
-        std::vector<Vertex> floorVertices = {
-            Vertex{ glm::vec3{-20.0f, -2.0f, -20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{0.0f, 0.0f} },
-            Vertex{ glm::vec3{ 20.0f, -2.0f, -20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{0.0f, 1.0f} },
-            Vertex{ glm::vec3{-20.0f, -2.0f,  20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{1.0f, 0.0f} },
-            Vertex{ glm::vec3{ 20.0f, -2.0f,  20.0f}, glm::vec3{0.0f, 1.0f, 0.0f}, glm::vec2{1.0f, 1.0f} }
-        };
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipelineLayout, 0, 1, &frameMeshletCullDescriptorSets[currentFrame], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, meshletCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullPushConstants), &meshletCullConstants);
 
-        const uint32_t baseIndex = static_cast<uint32_t>(vertices.size());
-        std::vector<uint32_t> floorIndices = {
-            baseIndex + 0, baseIndex + 3, baseIndex + 1,
-            baseIndex + 0, baseIndex + 2, baseIndex + 3
-        };
+        uint32_t objectCount = static_cast<uint32_t>(instances.size());
+        vkCmdDispatch(commandBuffer, std::min(objectCount, MAX_WORKGROUPS_PER_DIMENSION), (objectCount + MAX_WORKGROUPS_PER_DIMENSION - 1) / MAX_WORKGROUPS_PER_DIMENSION, 1);
 
-        vertices.insert(vertices.end(), floorVertices.begin(), floorVertices.end());
-        indices.insert(indices.end(), floorIndices.begin(), floorIndices.end());
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        endGpuPass(commandBuffer, GPU_PASS_MESHLET_CULL);
     }
 
-    void createVertexBuffer() {
-        VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+    // One task shader workgroup per MESHLET_TASK_GROUP_SIZE meshlets of every object
+    void recordMeshShaderDraws(VkCommandBuffer commandBuffer) {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshShaderPipeline);
+        std::array<VkDescriptorSet, 2> descriptorSets = { frameDescriptorSets[currentFrame], frameMeshletDescriptorSets[currentFrame] };
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshShaderPipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, nullptr);
+        vkCmdPushConstants(commandBuffer, meshShaderPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT, 0, sizeof(MeshletCullPushConstants), &meshletCullConstants);
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        uint32_t objectCount = static_cast<uint32_t>(instances.size());
+        vkCmdDrawMeshTasksEXT(commandBuffer, meshletTaskGroupsPerObject(), std::min(objectCount, MAX_WORKGROUPS_PER_DIMENSION), (objectCount + MAX_WORKGROUPS_PER_DIMENSION - 1) / MAX_WORKGROUPS_PER_DIMENSION);
+    }
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, vertices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+    // Copies the counters of the cull for collectMeshletStats()
+    void recordMeshletStatsCopy(VkCommandBuffer commandBuffer, size_t i) {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        VkPipelineStageFlags cullStage = meshletPath == MESHLET_PATH_COMPUTE ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT;
+        vkCmdPipelineBarrier(commandBuffer, cullStage, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+        VkBufferCopy copyRegion = {};
+        copyRegion.size = MESHLET_DRAW_BUFFER_HEADER_SIZE;
+        vkCmdCopyBuffer(commandBuffer, meshletDrawBuffers[i], meshletStatsBuffers[i], 1, &copyRegion);
 
-        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        meshletStatsPending[i] = true;
     }
 
-    void createIndexBuffer() {
-        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    void collectMeshletStats(uint32_t imageIndex) {
+        if (!meshletStatsPending[imageIndex]) {
+            return;
+        }
+        meshletStatsPending[imageIndex] = false;
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        uint32_t counters[2];
 
         void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, indices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
-
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
-
-        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+        vkMapMemory(device, meshletStatsBuffersMemory[imageIndex], 0, sizeof(counters), 0, &data);
+            memcpy(counters, data, sizeof(counters));
+        vkUnmapMemory(device, meshletStatsBuffersMemory[imageIndex]);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        frameStats.meshletVisibleSum += counters[0];
+        frameStats.meshletTriangleSum += counters[1];
+        frameStats.meshletStatsCount++;
     }
 
-    void createUniformBuffers() {
-        VkDeviceSize bufferSize = sizeof(UBORenderPass);
-
-        uniformBuffers.resize(swapChainImages.size());
-        uniformBuffersMemory.resize(swapChainImages.size());
+    // Per-frame averages of the meshlets that passed the frustum and cone tests
+    void reportMeshlets() {
+        std::cout << "meshlets (" << MESHLET_PATH_NAMES[meshletPath] << "): " << meshlets.size() << " built, " << meshletDrawCapacity << " in all objects";
+        if (frameStats.meshletStatsCount > 0) {
+            double visible = static_cast<double>(frameStats.meshletVisibleSum) / frameStats.meshletStatsCount;
+            double triangles = static_cast<double>(frameStats.meshletTriangleSum) / frameStats.meshletStatsCount;
+            std::cout << ", visible " << visible << " (culled " << 100.0 * (1.0 - visible / meshletDrawCapacity) << "%)"
+                      << ", triangles " << triangles << " of " << meshletTriangleTotal << " (culled " << 100.0 * (1.0 - triangles / meshletTriangleTotal) << "%)";
+        }
+        std::cout << std::endl;
+    }
 
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+    // Per-frame triangles of the selected levels against the full meshes, before culling
+    void reportLods() {
+        std::cout << "lods (error <= " << lodErrorPixels << " px, shadow bias " << shadowLodBias << "): teapot";
+        for (uint32_t lod = 0; lod < teapotMesh.lodCount; lod++) {
+            std::cout << (lod > 0 ? " / " : " ") << teapotMesh.lods[lod].indexCount / 3;
+        }
+        std::cout << " triangles";
+
+        if (frameStats.lodSelectCount > 0) {
+            const char *passNames[] = { "camera", "shadow" };
+            for (int pass = 0; pass < 2; pass++) {
+                double triangles = static_cast<double>(frameStats.lodTriangleSum[pass]) / frameStats.lodSelectCount;
+                double fullTriangles = static_cast<double>(frameStats.lodFullTriangleSum[pass]) / frameStats.lodSelectCount;
+                std::cout << ", " << passNames[pass] << " " << triangles << " of " << fullTriangles
+                          << " (saved " << (fullTriangles > 0.0 ? 100.0 * (1.0 - triangles / fullTriangles) : 0.0) << "%)";
+            }
+            std::cout << ", objects per level:";
+            for (uint32_t lod = 0; lod < options.lodCount; lod++) {
+                std::cout << " " << static_cast<double>(frameStats.lodObjectSum[lod]) / frameStats.lodSelectCount;
+            }
         }
+        std::cout << std::endl;
     }
 
-    void createShadowMapUniformBuffer() {
-        VkDeviceSize bufferSize = sizeof(UBOShadowMapPass);
-        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shadowMapUniformBuffer, shadowMapUniformBufferMemory); 
+    VkDeviceSize cpuShadowDrawOffset(uint32_t light) const {
+        return sizeof(VkDrawIndexedIndirectCommand) * instances.size() * (1 + light);
     }
 
-    void createDescriptorPool() {
-        std::array<VkDescriptorPoolSize, 3> poolSizes = {};
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-        poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[1].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-        poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[2].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
+    VkDeviceSize cpuDrawCountOffset() const {
+        return sizeof(VkDrawIndexedIndirectCommand) * instances.size() * (1 + options.shadowLightCount);
+    }
 
-        VkDescriptorPoolCreateInfo poolInfo = {};
-        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-        poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
+    void createCpuDrawBuffers() {
+        cpuDrawBuffers.resize(swapChainImages.size());
+        cpuDrawBuffersMemory.resize(swapChainImages.size());
 
-        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
+        // Camera draw commands and those of each shadow light, followed by their draw counts
+        VkDeviceSize bufferSize = cpuDrawCountOffset() + (1 + options.shadowLightCount) * sizeof(uint32_t);
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cpuDrawBuffers[i], cpuDrawBuffersMemory[i]);
         }
     }
 
-    void createShadowMapDescriptorPool() {
-        std::array<VkDescriptorPoolSize, 1> poolSizes = {};
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = 1;
-        
-        VkDescriptorPoolCreateInfo poolInfo = {};
-        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-        poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = 1;
-
-        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &shadowMapDescriptorPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create shadow map descriptor pool!");
+    void destroyCpuDrawBuffers() {
+        for (size_t i = 0; i < cpuDrawBuffers.size(); i++) {
+            vkDestroyBuffer(device, cpuDrawBuffers[i], nullptr);
+            vkFreeMemory(device, cpuDrawBuffersMemory[i], nullptr);
         }
     }
 
-    void createDescriptorSets() {
-        std::vector<VkDescriptorSetLayout> layouts(swapChainImages.size(), descriptorSetLayout);
-        VkDescriptorSetAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<int32_t>(swapChainImages.size());
-        allocInfo.pSetLayouts = layouts.data();
+    void cullObjectsOnCpu(const glm::mat4 &mvpMat, const glm::mat4 &mvpMatLightSpace, uint32_t currentImage) {
+        auto startTime = std::chrono::high_resolution_clock::now();
 
-        descriptorSets.resize(swapChainImages.size());
-        if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate descriptor set!");
+        glm::vec4 cameraPlanes[6];
+        glm::vec4 lightPlanes[MAX_SHADOW_LIGHTS][6];
+        extractFrustumPlanes(mvpMat, cameraPlanes);
+        for (uint32_t light : shadowTileUpdates) {
+            extractFrustumPlanes(shadowLights[light].mvpMat, lightPlanes[light]);
         }
 
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
-            VkDescriptorBufferInfo bufferInfo = {};
-            bufferInfo.buffer = uniformBuffers[i];
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(UBORenderPass);
-
-            VkDescriptorImageInfo textureImageInfo = {};
-            textureImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            textureImageInfo.imageView = textureImageView;
-            textureImageInfo.sampler = textureSampler;
-
-            VkDescriptorImageInfo depthImageInfo = {};
-            depthImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            depthImageInfo.imageView = shadowMapColorImageView;
-            depthImageInfo.sampler = textureSampler;
-
-            std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
-
-            descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[0].dstSet = descriptorSets[i];
-            descriptorWrites[0].dstBinding = 0;
-            descriptorWrites[0].dstArrayElement = 0;
-            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWrites[0].descriptorCount = 1;
-            descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-            descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[1].dstSet = descriptorSets[i];
-            descriptorWrites[1].dstBinding = 1;
-            descriptorWrites[1].dstArrayElement = 0;
-            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWrites[1].descriptorCount = 1;
-            descriptorWrites[1].pImageInfo = &textureImageInfo;
-
-            descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[2].dstSet = descriptorSets[i];
-            descriptorWrites[2].dstBinding = 2;
-            descriptorWrites[2].dstArrayElement = 0;
-            descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWrites[2].descriptorCount = 1;
-            descriptorWrites[2].pImageInfo = &depthImageInfo;
+        updateLightSpaceBounds(mvpMatLightSpace);
 
-            vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        // parallelFor may use fewer workers than requested, so start every output empty
+        const uint32_t workerCount = workerThreadCount();
+        cullWorkerOutputs.assign(workerCount, CullWorkerOutput());
+
+        // Camera visible objects are the shadow receivers, gather their extent in light space
+        parallelFor(instances.size(), 1024, workerCount, [&](uint32_t worker, size_t begin, size_t end) {
+            cullObjectBounds(cameraPlanes, objectBounds, begin, end, objectVisibility.data());
+
+            CullWorkerOutput &output = cullWorkerOutputs[worker];
+            for (size_t i = begin; i < end; i++) {
+                if (objectVisibility[i]) {
+                    const MeshLod &lod = instanceMesh(i).lods[usesLods() ? cameraLods[i] : 0];
+                    output.drawCommands.push_back({ lod.indexCount, 1, lod.firstIndex, 0, static_cast<uint32_t>(i) });
+
+                    glm::vec3 center(lightSpaceBounds.centerX[i], lightSpaceBounds.centerY[i], lightSpaceBounds.centerZ[i]);
+                    glm::vec3 extent(lightSpaceBounds.extentX[i], lightSpaceBounds.extentY[i], lightSpaceBounds.extentZ[i]);
+                    output.receiverMin = glm::min(output.receiverMin, center - extent);
+                    output.receiverMax = glm::max(output.receiverMax, center + extent);
+                }
+            }
+        });
+
+        glm::vec3 receiverMin(std::numeric_limits<float>::max());
+        glm::vec3 receiverMax(std::numeric_limits<float>::lowest());
+        for (const auto &output : cullWorkerOutputs) {
+            receiverMin = glm::min(receiverMin, output.receiverMin);
+            receiverMax = glm::max(receiverMax, output.receiverMax);
         }
+
+        // Each tile rendered this frame gets the casters inside its light's frustum. For the key light
+        // a caster must also overlap the receivers in the light's view and lie in front of them.
+        parallelFor(instances.size(), 1024, workerCount, [&](uint32_t worker, size_t begin, size_t end) {
+            CullWorkerOutput &output = cullWorkerOutputs[worker];
+            for (uint32_t light : shadowTileUpdates) {
+                uint8_t *visible = lightVisibility.data() + light * instances.size();
+                cullObjectBounds(lightPlanes[light], objectBounds, begin, end, visible);
+
+                for (size_t i = begin; i < end; i++) {
+                    if (!(instances[i].flags & INSTANCE_FLAG_CAST_SHADOW) || !visible[i]) {
+                        continue;
+                    }
+
+                    if (light == 0) {
+                        glm::vec3 center(lightSpaceBounds.centerX[i], lightSpaceBounds.centerY[i], lightSpaceBounds.centerZ[i]);
+                        glm::vec3 extent(lightSpaceBounds.extentX[i], lightSpaceBounds.extentY[i], lightSpaceBounds.extentZ[i]);
+                        glm::vec3 casterMin = center - extent;
+                        glm::vec3 casterMax = center + extent;
+                        if (casterMax.x < receiverMin.x || casterMin.x > receiverMax.x ||
+                            casterMax.y < receiverMin.y || casterMin.y > receiverMax.y ||
+                            casterMin.z > receiverMax.z) {
+                            continue;
+                        }
+                    }
+
+                    const MeshLod &lod = instanceMesh(i).lods[usesLods() ? shadowLods[i] : 0];
+                    output.shadowDrawCommands[light].push_back({ lod.indexCount, 1, lod.firstIndex, 0, static_cast<uint32_t>(i) });
+                    output.shadowTriangleCount += lod.indexCount / 3;
+                }
+            }
+        });
+
+        // The camera count first, then one count per shadow light. Tiles that are not rendered stay empty.
+        std::vector<uint32_t> drawCounts(1 + shadowLights.size(), 0);
+        uint32_t shadowDrawCount = 0;
+        uint64_t shadowTriangleCount = 0;
+
+        void* data;
+        vkMapMemory(device, cpuDrawBuffersMemory[currentImage], 0, cpuDrawCountOffset() + sizeof(uint32_t) * drawCounts.size(), 0, &data);
+            auto *drawCommands = static_cast<VkDrawIndexedIndirectCommand*>(data);
+            for (const auto &output : cullWorkerOutputs) {
+                memcpy(drawCommands + drawCounts[0], output.drawCommands.data(), sizeof(VkDrawIndexedIndirectCommand) * output.drawCommands.size());
+                drawCounts[0] += static_cast<uint32_t>(output.drawCommands.size());
+
+                for (uint32_t light : shadowTileUpdates) {
+                    const auto &shadowDrawCommands = output.shadowDrawCommands[light];
+                    memcpy(drawCommands + instances.size() * (1 + light) + drawCounts[1 + light], shadowDrawCommands.data(), sizeof(VkDrawIndexedIndirectCommand) * shadowDrawCommands.size());
+                    drawCounts[1 + light] += static_cast<uint32_t>(shadowDrawCommands.size());
+                    shadowDrawCount += static_cast<uint32_t>(shadowDrawCommands.size());
+                }
+                shadowTriangleCount += output.shadowTriangleCount;
+            }
+            memcpy(static_cast<char*>(data) + cpuDrawCountOffset(), drawCounts.data(), sizeof(uint32_t) * drawCounts.size());
+        vkUnmapMemory(device, cpuDrawBuffersMemory[currentImage]);
+
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        frameStats.objectCount = static_cast<uint32_t>(instances.size());
+        frameStats.cameraVisibleCount = drawCounts[0];
+        frameStats.shadowDrawCount = shadowDrawCount;
+        frameStats.shadowTriangleCount = shadowTriangleCount;
+        frameStats.cullCpuTimeSum += std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - startTime).count();
+        frameStats.cullCpuTimeCount++;
     }
 
-    void createShadowMapDescriptorSet() {
-        VkDescriptorSetAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = shadowMapDescriptorPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts = &shadowMapDescriptorSetLayout;
+    void createSyncObjects() {
+        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 
-        if (vkAllocateDescriptorSets(device, &allocInfo, &shadowMapDescriptorSet) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate shadow map descriptor set!");
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create synchronization objects for a frame!");
+            }
         }
 
-        VkDescriptorBufferInfo bufferInfo = {};
-        bufferInfo.buffer = shadowMapUniformBuffer;
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UBOShadowMapPass);
+        imageTimelineValues.assign(swapChainImages.size(), 0);
+    }
 
-        std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
+    void createTimelineSemaphore() {
+        VkSemaphoreTypeCreateInfo typeInfo = {};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
 
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = shadowMapDescriptorSet;
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &typeInfo;
 
-        vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timelineSemaphore) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timeline semaphore!");
+        }
+
+        timelineValue = 0;
     }
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-        VkBufferCreateInfo bufferInfo = {};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = size;
-        bufferInfo.usage = usage;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    uint64_t completedTimelineValue() {
+        uint64_t value = 0;
+        vkGetSemaphoreCounterValue(device, timelineSemaphore, &value);
+        return value;
+    }
 
-        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create buffer!");
+    void waitForTimelineValue(uint64_t value) {
+        if (value == 0) {
+            return;
         }
 
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+        VkSemaphoreWaitInfo waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timelineSemaphore;
+        waitInfo.pValues = &value;
 
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
+        if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("failed to wait for timeline semaphore!");
         }
+    }
 
-        vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    // Defers destruction of a resource until the GPU has passed the given timeline value
+    void releaseAfter(uint64_t value, std::function<void()> release) {
+        deferredReleases.push_back({value, std::move(release)});
     }
 
-    VkCommandBuffer beginSingleTimeCommands() {
-        VkCommandBufferAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool = commandPool;
-        allocInfo.commandBufferCount = 1;
+    void collectDeferredReleases(uint64_t completedValue) {
+        while (!deferredReleases.empty() && deferredReleases.front().timelineValue <= completedValue) {
+            deferredReleases.front().release();
+            deferredReleases.pop_front();
+        }
+    }
 
-        VkCommandBuffer commandBuffer;
-        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+    void updateUniformBuffer(uint32_t currentImage) {
+        glm::mat4 mvpMat;
+        glm::mat4 mvpMatLightSpace;
+        {
+            void *data;
+            vkMapMemory(device, shadowMapUniformBufferMemory, 0, shadowMapUniformStride * shadowLights.size(), 0, &data);
+            for (size_t light = 0; light < shadowLights.size(); light++) {
+                UBOShadowMapPass ubo = {};
+                ubo.mvpMat = shadowLights[light].mvpMat;
+                memcpy(static_cast<char*>(data) + light * shadowMapUniformStride, &ubo, sizeof(ubo));
+            }
+            vkUnmapMemory(device, shadowMapUniformBufferMemory);
 
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            mvpMatLightSpace = shadowLights[0].mvpMat;
+        }
 
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        {
+            static auto startTime = std::chrono::high_resolution_clock::now();
 
-        return commandBuffer;
-    }
+            auto currentTime = std::chrono::high_resolution_clock::now();
+            float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-        vkEndCommandBuffer(commandBuffer);
+            glm::mat4 model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 view = glm::lookAt(glm::vec3(5.0f, 5.0f, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, CAMERA_NEAR, CAMERA_FAR);
+            proj[1][1] *= -1;
 
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+            UBORenderPass ubo = {};
+            ubo.mvpMat = proj * view * model;
+            mvpMat = ubo.mvpMat;
+            ubo.mvMat = view * model;
+            ubo.normMat = glm::transpose(glm::inverse(ubo.mvMat));
+            ubo.lightPos = LIGHT_POS;
+            ubo.mvpMatLightSpace = mvpMatLightSpace;
 
-        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(graphicsQueue);
+            void* data;
+            vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
+                memcpy(data, &ubo, sizeof(ubo));
+            vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
 
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-    }
+            if (options.clusteredLighting) {
+                updateClusterBuffers(currentImage, ubo.mvMat, proj, time);
+            }
+
+            updateShadowAtlas(currentImage, ubo.mvMat, proj);
+
+            if (usesLods()) {
+                selectLods(mvpMat);
+            }
+
+            // The cameraPos is in the space of the model matrices of the instances
+            if (options.meshlets) {
+                extractFrustumPlanes(mvpMat, meshletCullConstants.cameraPlanes);
+                meshletCullConstants.cameraPos = glm::inverse(ubo.mvMat)[3];
+                meshletCullConstants.objectCount = static_cast<uint32_t>(instances.size());
+            }
+        }
+
+        if (options.gpuCulling) {
+            UBOCullPass ubo = {};
+            extractFrustumPlanes(mvpMat, ubo.cameraPlanes);
+            for (uint32_t light : shadowTileUpdates) {
+                extractFrustumPlanes(shadowLights[light].mvpMat, ubo.lightPlanes[light]);
+                ubo.lightMask |= 1u << light;
+            }
+            ubo.lightMat = mvpMatLightSpace;
+            ubo.objectCount = static_cast<uint32_t>(instances.size());
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+            void* data;
+            vkMapMemory(device, cullUniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
+                memcpy(data, &ubo, sizeof(ubo));
+            vkUnmapMemory(device, cullUniformBuffersMemory[currentImage]);
+        }
 
-        VkBufferCopy copyRegion = {};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        if (options.cpuCulling) {
+            cullObjectsOnCpu(mvpMat, mvpMatLightSpace, currentImage);
+        }
 
-        endSingleTimeCommands(commandBuffer);
+        if (options.cubeShadows && !cubeShadowDrawsValid) {
+            createCubeShadowDraws();
+        }
     }
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
+    // Sizes each tile from the on-screen size of the region its light covers, repacks the atlas
+    // when a size changed and picks the tiles that this frame's shadow pass renders
+    void updateShadowAtlas(uint32_t currentImage, const glm::mat4 &mvMat, const glm::mat4 &proj) {
+        glm::vec4 cameraPlanes[6];
+        extractFrustumPlanes(proj * mvMat, cameraPlanes);
+
+        // The key light covers the whole scene and asks for the whole atlas, unless it has the cube
+        // map. The spot lights ask for about one texel per pixel of their lit disc, and nothing
+        // while it is off screen.
+        std::vector<float> desiredSizes(shadowLights.size(), 0.0f);
+        desiredSizes[0] = options.cubeShadows ? 0.0f : static_cast<float>(shadowAtlasSize());
+        for (size_t light = 1; light < shadowLights.size(); light++) {
+            const ShadowLight &shadowLight = shadowLights[light];
+
+            bool visible = true;
+            for (const glm::vec4 &plane : cameraPlanes) {
+                visible = visible && glm::dot(glm::vec3(plane), shadowLight.target) + plane.w >= -shadowLight.coneRadius;
+            }
+            if (visible) {
+                float depth = std::max(-(mvMat * glm::vec4(shadowLight.target, 1.0f)).z, CAMERA_NEAR);
+                desiredSizes[light] = shadowLight.coneRadius * std::abs(proj[1][1]) / depth * renderExtent().height;
             }
         }
 
-        throw std::runtime_error("failed to find suitable memory type!");
-    }
+        std::vector<uint32_t> previousSizes(shadowAtlasTiles.size());
+        for (size_t light = 0; light < shadowAtlasTiles.size(); light++) {
+            previousSizes[light] = shadowAtlasTiles[light].size;
+        }
 
-    void createCommandBuffers() {
-        if (commandBuffers.size() > 0) {
-            vkFreeCommandBuffers(device, commandPool, commandBuffers.size(), commandBuffers.data());
+        std::vector<uint32_t> sizes = shadowAtlasAllocator.fitSizes(desiredSizes, previousSizes);
+        if (sizes != previousSizes) {
+            std::vector<ShadowAtlasTile> tiles = shadowAtlasAllocator.pack(sizes);
+            for (size_t light = 0; light < tiles.size(); light++) {
+                const ShadowAtlasTile &previous = shadowAtlasTiles[light];
+                if (tiles[light].x != previous.x || tiles[light].y != previous.y || tiles[light].size != previous.size) {
+                    shadowTilesValid[light] = false;
+                }
+            }
+            shadowAtlasTiles.swap(tiles);
         }
 
-        commandBuffers.resize(swapChainFramebuffers.size());
+        // Tiles that moved have to be rendered right away. Within the budget, the others are
+        // refreshed by age weighted with their size.
+        shadowTileUpdates.clear();
+        uint64_t texels = 0;
+        std::vector<uint32_t> refreshCandidates;
+        for (uint32_t light = 0; light < shadowLights.size(); light++) {
+            uint64_t tileTexels = static_cast<uint64_t>(shadowAtlasTiles[light].size) * shadowAtlasTiles[light].size;
+            if (tileTexels == 0) {
+                continue;
+            }
 
-        VkCommandBufferAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool = commandPool;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+            if (!cachesShadowTiles() || !shadowTilesValid[light]) {
+                shadowTileUpdates.push_back(light);
+                texels += tileTexels;
+            } else {
+                refreshCandidates.push_back(light);
+            }
+        }
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
+        if (cachesShadowTiles()) {
+            std::sort(refreshCandidates.begin(), refreshCandidates.end(), [this](uint32_t a, uint32_t b) {
+                return static_cast<uint64_t>(shadowTileAges[a] + 1) * shadowAtlasTiles[a].size > static_cast<uint64_t>(shadowTileAges[b] + 1) * shadowAtlasTiles[b].size;
+            });
+
+            const uint64_t budget = static_cast<uint64_t>(options.shadowBudgetMtexels * 1.0e6);
+            for (uint32_t light : refreshCandidates) {
+                uint64_t tileTexels = static_cast<uint64_t>(shadowAtlasTiles[light].size) * shadowAtlasTiles[light].size;
+                if (texels + tileTexels <= budget) {
+                    shadowTileUpdates.push_back(light);
+                    texels += tileTexels;
+                }
+            }
         }
 
-        for (size_t i = 0; i < commandBuffers.size(); i++) {
-            VkCommandBufferBeginInfo beginInfo = {};
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        for (uint32_t light = 0; light < shadowLights.size(); light++) {
+            shadowTileAges[light]++;
+        }
+        for (uint32_t light : shadowTileUpdates) {
+            shadowTilesValid[light] = true;
+            shadowTileAges[light] = 0;
+        }
 
-            vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+        frameStats.shadowTileUpdateSum += static_cast<uint32_t>(shadowTileUpdates.size());
+        frameStats.shadowTexelUpdateSum += texels;
 
-            VkRenderPassBeginInfo renderPassInfo = {};
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass = renderPass;
-            renderPassInfo.framebuffer = swapChainFramebuffers[i];
-            renderPassInfo.renderArea.offset = {0, 0};
-            renderPassInfo.renderArea.extent = swapChainExtent;
+        VkDeviceSize bufferSize = SHADOW_LIGHT_BUFFER_HEADER_SIZE + shadowLights.size() * sizeof(ShadowLightData);
+        void *data;
+        vkMapMemory(device, shadowLightBuffersMemory[currentImage], 0, bufferSize, 0, &data);
+        *static_cast<uint32_t*>(data) = static_cast<uint32_t>(shadowLights.size());
+        ShadowLightData *lights = reinterpret_cast<ShadowLightData*>(static_cast<char*>(data) + SHADOW_LIGHT_BUFFER_HEADER_SIZE);
+        const float atlasSize = static_cast<float>(shadowAtlasSize());
+        for (size_t light = 0; light < shadowLights.size(); light++) {
+            const ShadowAtlasTile &tile = shadowAtlasTiles[light];
+            lights[light].mvpMat = shadowLights[light].mvpMat;
+            lights[light].atlasRect = glm::vec4(tile.x, tile.y, tile.size, tile.size) / atlasSize;
+            lights[light].posCameraSpace = mvMat * glm::vec4(shadowLights[light].position, 1.0f);
+            lights[light].posWorldSpace = glm::vec4(shadowLights[light].position, light == 0 && options.cubeShadows ? CUBE_SHADOW_RANGE : 0.0f);
+            lights[light].color = glm::vec4(shadowLights[light].color, 1.0f);
+        }
+        vkUnmapMemory(device, shadowLightBuffersMemory[currentImage]);
+    }
 
-            std::array<VkClearValue, 2> clearValues = {};
-            clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-            clearValues[1].depthStencil = { 1.0f, 0 };
+    // Lights are binned and shaded in camera space, like f_posCameraSpace in render.frag
+    void updateClusterBuffers(uint32_t currentImage, const glm::mat4 &mvMat, const glm::mat4 &proj, float time) {
+        VkExtent2D extent = renderExtent();
+        float logDepthRange = std::log(CAMERA_FAR / CAMERA_NEAR);
 
-            renderPassInfo.clearValueCount = clearValues.size();
-            renderPassInfo.pClearValues = clearValues.data();
+        UBOClusterPass ubo = {};
+        ubo.invProjMat = glm::inverse(proj);
+        ubo.gridSize = glm::uvec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, CLUSTER_LIGHT_CAPACITY);
+        ubo.screen = glm::vec4(extent.width / (float) CLUSTER_GRID_X, extent.height / (float) CLUSTER_GRID_Y, extent.width, extent.height);
+        ubo.depthSlicing = glm::vec4(CAMERA_NEAR, CAMERA_FAR, CLUSTER_GRID_Z / logDepthRange, -CLUSTER_GRID_Z * std::log(CAMERA_NEAR) / logDepthRange);
+        ubo.lightCount = activePointLightCount;
 
-            vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        void* data;
+        vkMapMemory(device, clusterUniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
+            memcpy(data, &ubo, sizeof(ubo));
+        vkUnmapMemory(device, clusterUniformBuffersMemory[currentImage]);
 
-            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        if (activePointLightCount == 0) {
+            return;
+        }
 
-            VkBuffer vertexBuffers[] = { vertexBuffer };
-            VkDeviceSize offsets[] = { 0 };
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+        vkMapMemory(device, pointLightBuffersMemory[currentImage], 0, activePointLightCount * sizeof(PointLight), 0, &data);
+        PointLight *lights = static_cast<PointLight*>(data);
+        for (uint32_t i = 0; i < activePointLightCount; i++) {
+            const PointLightSource &source = pointLightSources[i];
+            float angle = source.phase + time * source.angularSpeed;
+            glm::vec3 pos = source.center + source.orbitRadius * glm::vec3(std::cos(angle), 0.0f, std::sin(angle));
 
-            vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            lights[i].posRadius = glm::vec4(glm::vec3(mvMat * glm::vec4(pos, 1.0f)), source.radius);
+            lights[i].color = glm::vec4(source.color, 1.0f);
+        }
+        vkUnmapMemory(device, pointLightBuffersMemory[currentImage]);
+    }
 
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+    void updateFrameStats() {
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        if (lastFrameTime.time_since_epoch().count() == 0) {
+            lastFrameTime = currentTime;
+            lastStatsReportTime = currentTime;
+            return;
+        }
 
-            vkCmdDrawIndexed(commandBuffers[i], indices.size(), 1, 0, 0, 0);
+#ifdef ENABLE_CPU_PROFILER
+        profileCollector.collect(options.printStats, traceCaptureActive());
+        if (traceCaptureActive() && --traceFramesRemaining == 0) {
+            finishTraceCapture();
+        }
+#endif
 
-            vkCmdEndRenderPass(commandBuffers[i]);
+        float frameTime = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastFrameTime).count();
+        frameStats.frameTimeSum += frameTime;
+        frameStats.frameTimes.push_back(frameTime);
+        frameStats.frameCount++;
+        lastFrameTime = currentTime;
 
-            if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to record command buffer!");
-            }
+        if (options.printStats && std::chrono::duration<float>(currentTime - lastStatsReportTime).count() >= 1.0f) {
+            reportFrameStats();
+            frameStats = FrameStats();
+            lastStatsReportTime = currentTime;
         }
     }
 
-    void createShadowMapCommandBuffer() {
-        VkCommandBufferAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool = commandPool;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount = 1;
-
-        if (vkAllocateCommandBuffers(device, &allocInfo, &shadowMapCommandBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate shadow map command buffer!");
+    void reportShadowAtlas() {
+        uint64_t usedTexels = 0;
+        uint32_t tiledLightCount = 0;
+        for (const ShadowAtlasTile &tile : shadowAtlasTiles) {
+            usedTexels += static_cast<uint64_t>(tile.size) * tile.size;
+            tiledLightCount += tile.size > 0 ? 1 : 0;
         }
 
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-        vkBeginCommandBuffer(shadowMapCommandBuffer, &beginInfo);
+        const double atlasTexels = static_cast<double>(shadowAtlasSize()) * shadowAtlasSize();
+        std::cout << "shadow atlas: " << shadowAtlasSize() << "x" << shadowAtlasSize()
+                  << ", " << tiledLightCount << "/" << shadowLights.size() << " lights in tiles"
+                  << ", occupancy " << 100.0 * usedTexels / atlasTexels << "%"
+                  << ", updated per frame: " << static_cast<float>(frameStats.shadowTileUpdateSum) / frameStats.frameCount << " tiles, "
+                  << frameStats.shadowTexelUpdateSum / 1.0e6 / frameStats.frameCount << " Mtexels";
+        if (cachesShadowTiles()) {
+            std::cout << " (budget " << options.shadowBudgetMtexels << " Mtexels)";
+        }
+        std::cout << std::endl;
+    }
 
-        VkRenderPassBeginInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = shadowMapRenderPass;
-        renderPassInfo.framebuffer = shadowMapFramebuffer;
-        renderPassInfo.renderArea.offset = { 0, 0 };
-        renderPassInfo.renderArea.extent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE };
+    // Multiview draws every object that touches any face into all six faces, the other modes
+    // only into the faces that it touches
+    void reportCubeShadow() {
+        uint32_t objectFaces = cubeShadowMode == CUBE_SHADOW_MULTIVIEW ? 6 * cubeShadowMultiviewObjectCount : cubeShadowObjectFaceCount;
+        std::cout << "cube shadow: " << CUBE_SHADOW_SIZE << "x" << CUBE_SHADOW_SIZE << " x6, " << CUBE_SHADOW_MODE_NAMES[cubeShadowMode]
+                  << ", " << cubeShadowCasterCount << " casters drawn into " << objectFaces << " of " << 6 * cubeShadowCasterCount << " faces" << std::endl;
+    }
 
-        std::array<VkClearValue, 2> clearValues = {};
-        clearValues[0].color = { 1.0f, 0.0f, 0.0f, 1.0f };
-        clearValues[1].depthStencil = { 1.0f, 0 };
+    void reportFrameStats() {
+        float frameTime = frameStats.frameTimeSum / frameStats.frameCount;
+        std::cout << "frame time: " << frameTime << " ms (" << 1000.0f / frameTime << " fps)"
+                  << ", " << presentModeName(swapChainPresentMode) << " / " << swapChainImages.size() << " images"
+                  << (msaaSamples != VK_SAMPLE_COUNT_1_BIT ? ", " + std::to_string(static_cast<uint32_t>(msaaSamples)) + "x MSAA" : "") << std::endl;
+        if (shadowLights.size() > 1 || cachesShadowTiles()) {
+            reportShadowAtlas();
+        }
+        if (options.cubeShadows) {
+            reportCubeShadow();
+        }
+        if (options.meshlets) {
+            reportMeshlets();
+        }
+        if (usesLods()) {
+            reportLods();
+        }
+        if (options.clusteredLighting) {
+            std::cout << "point lights: " << activePointLightCount << " in " << CLUSTER_GRID_X << "x" << CLUSTER_GRID_Y << "x" << CLUSTER_GRID_Z << " clusters" << std::endl;
+        }
+        if (options.dynamicResolution) {
+            VkExtent2D extent = renderExtent();
+            std::cout << "resolution scale: " << resolutionScaleController.scale()
+                      << " (" << extent.width << "x" << extent.height << " of " << swapChainExtent.width << "x" << swapChainExtent.height << ")"
+                      << ", main pass target " << resolutionScaleController.target() << " ms" << std::endl;
+        }
+        printDistribution("frame time distribution", frameStats.frameTimes);
+        printDistribution("acquire to present call", frameStats.presentLatencies);
+        printDistribution("acquire to display", frameStats.displayLatencies);
+#ifdef ENABLE_CPU_PROFILER
+        profileCollector.report();
+#endif
 
-        renderPassInfo.clearValueCount = clearValues.size();
-        renderPassInfo.pClearValues = clearValues.data();
+        for (uint32_t pass = 0; pass < GPU_PASS_COUNT; pass++) {
+            if (frameStats.gpuPassTimeCount[pass] > 0) {
+                std::cout << "gpu " << GPU_PASS_NAMES[pass] << ": " << frameStats.gpuPassTimeSum[pass] / frameStats.gpuPassTimeCount[pass] << " ms" << std::endl;
+            }
 
-        vkCmdBeginRenderPass(shadowMapCommandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            // Per-frame averages, so that a time regression can be matched to a change in work
+            if (frameStats.pipelineStatisticCount[pass] > 0) {
+                std::cout << "gpu " << GPU_PASS_NAMES[pass] << " work:";
+                for (uint32_t statistic = 0; statistic < PIPELINE_STATISTIC_COUNT; statistic++) {
+                    std::cout << (statistic > 0 ? ", " : " ") << frameStats.pipelineStatisticSum[pass][statistic] / frameStats.pipelineStatisticCount[pass]
+                              << " " << PIPELINE_STATISTIC_NAMES[statistic];
+                }
+                std::cout << (pass == GPU_PASS_MAIN && options.depthPrepass ? " (with depth pre-pass)" : "") << std::endl;
+            }
+        }
 
-        vkCmdBindPipeline(shadowMapCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapGraphicsPipeline);
+        float recordTime = frameStats.recordCpuTimeCount > 0 ? frameStats.recordCpuTimeSum / frameStats.recordCpuTimeCount : 0.0f;
+        std::cout << "command recording: " << recordTime << " ms/frame" << std::endl;
 
-        VkBuffer vertexBuffers[] = { vertexBuffer };
-        VkDeviceSize offsets[] = { 0 };
-        vkCmdBindVertexBuffers(shadowMapCommandBuffer, 0, 1, vertexBuffers, offsets);
+        if (options.gpuCulling) {
+            // The cull pass timestamps cover the whole cull submission, including the count copy
+            float cullTime = frameStats.gpuPassTimeCount[GPU_PASS_CULL] > 0 ? frameStats.gpuPassTimeSum[GPU_PASS_CULL] / frameStats.gpuPassTimeCount[GPU_PASS_CULL] : 0.0f;
+            std::cout << "gpu culling: " << frameStats.objectCount << " objects"
+                      << ", camera visible " << frameStats.cameraVisibleCount << " (culled " << frameStats.objectCount - frameStats.cameraVisibleCount << ")"
+                      << ", cull time " << cullTime << " ms" << std::endl;
+        }
 
-        vkCmdBindIndexBuffer(shadowMapCommandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        if (options.cpuCulling) {
+            float cullTime = frameStats.cullCpuTimeCount > 0 ? frameStats.cullCpuTimeSum / frameStats.cullCpuTimeCount : 0.0f;
+            std::cout << "cpu culling (" << cullObjectBoundsPath() << ", " << workerThreadCount() << " threads): " << frameStats.objectCount << " objects"
+                      << ", camera visible " << frameStats.cameraVisibleCount << " (culled " << frameStats.objectCount - frameStats.cameraVisibleCount << ")"
+                      << ", cull time " << cullTime << " ms" << std::endl;
+        }
 
-        vkCmdBindDescriptorSets(shadowMapCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 0, 1, &shadowMapDescriptorSet, 0, nullptr);
+        // Without culling every rendered tile draws the whole list
+        if (!options.gpuCulling && !options.cpuCulling) {
+            frameStats.shadowDrawCount = static_cast<uint32_t>(shadowPassDrawBatches().size() * shadowTileUpdates.size());
+            frameStats.shadowTriangleCount = batchTriangleCount(shadowPassDrawBatches()) * shadowTileUpdates.size();
+        }
 
-        vkCmdDrawIndexed(shadowMapCommandBuffer, indices.size(), 1, 0, 0, 0);
+        std::cout << "shadow pass: " << frameStats.shadowDrawCount << " draws"
+                  << ", " << frameStats.shadowTriangleCount << " triangles" << std::endl;
+    }
 
-        vkCmdEndRenderPass(shadowMapCommandBuffer);
+    // Runs at a frame boundary: starts a reload for changed sources and swaps in finished pipelines.
+    // Frame commands are re-recorded every frame, so a swapped pipeline is used from this frame on.
+    void updateShaderReload() {
+        std::set<std::string> changed = shaderWatcher->poll();
+        pendingShaderChanges.insert(changed.begin(), changed.end());
+
+        if (shaderReloadTask.valid() && shaderReloadTask.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            ShaderReloadResult result = shaderReloadTask.get();
+            if (!result.error.empty()) {
+                std::cerr << "shader reload failed: " << result.error << std::endl;
+            } else {
+                adoptShaderCode(result);
+                swapPipeline(graphicsPipeline, result.graphicsPipeline);
+                swapPipeline(shadowMapGraphicsPipeline, result.shadowMapGraphicsPipeline);
+                swapPipeline(depthPrepassPipeline, result.depthPrepassPipeline);
+                swapPipeline(meshShaderPipeline, result.meshShaderPipeline);
+                swapPipeline(cullPipeline, result.cullPipeline);
+                swapPipeline(clusterPipeline, result.clusterPipeline);
+                swapPipeline(meshletCullPipeline, result.meshletCullPipeline);
+                std::cout << "shaders reloaded" << std::endl;
+            }
+        }
 
-        if (vkEndCommandBuffer(shadowMapCommandBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
+        if (!shaderReloadTask.valid() && !pendingShaderChanges.empty()) {
+            shaderReloadTask = std::async(std::launch::async, &HelloTriangleApplication::reloadShaders, this, pendingShaderChanges);
+            pendingShaderChanges.clear();
         }
     }
 
-    void createSyncObjects() {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-
-        VkSemaphoreCreateInfo semaphoreInfo = {};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    // The old pipeline may still be referenced by frames in flight
+    void swapPipeline(VkPipeline &current, VkPipeline replacement) {
+        if (replacement == VK_NULL_HANDLE) {
+            return;
+        }
 
-        VkFenceCreateInfo fenceInfo = {};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        VkPipeline retired = current;
+        current = replacement;
+        releaseAfter(timelineValue, [this, retired]() {
+            vkDestroyPipeline(device, retired, nullptr);
+        });
+    }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create synchronization objects for a frame!");
-            }
+    void destroyReloadedPipelines(ShaderReloadResult &result) {
+        for (VkPipeline *pipeline : { &result.graphicsPipeline, &result.shadowMapGraphicsPipeline, &result.depthPrepassPipeline, &result.meshShaderPipeline,
+                                      &result.cullPipeline, &result.clusterPipeline, &result.meshletCullPipeline }) {
+            vkDestroyPipeline(device, *pipeline, nullptr);
+            *pipeline = VK_NULL_HANDLE;
         }
+    }
 
-        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &shadowMapFinishedSemaphore) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create shadow map finished semaphore!");
+    void adoptShaderCode(ShaderReloadResult &result) {
+        for (auto &shader : result.shaderCode) {
+            shaderOverrides[shader.first] = std::move(shader.second);
         }
     }
 
-    void updateUniformBuffer(uint32_t currentImage) {
-        glm::mat4 mvpMatLightSpace;
-        {
-            glm::mat4 model= glm::mat4(1.0f);
-            glm::mat4 view = glm::lookAt(LIGHT_POS, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-            glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.0f, 1.0f, 50.0f);
-
-            UBOShadowMapPass ubo = {};
-            ubo.mvpMat = proj * view * model;
-            mvpMatLightSpace = ubo.mvpMat;
+    // Runs on the reload thread. shaderOverrides and the swap chain are only modified on the
+    // render thread after this task has been joined, so they can be read here without locking.
+    ShaderReloadResult reloadShaders(std::set<std::string> sources) {
+        ShaderReloadResult result;
+#if defined(SHADER_SOURCE_DIR) && defined(SHADER_BINARY_DIR)
+        try {
+            for (const auto &source : sources) {
+                std::string spirvPath = std::string(SHADER_BINARY_DIR) + "/" + source + ".spv";
+                // Task and mesh shaders need SPIR-V 1.4, as in the build
+                bool meshStage = source.size() > 5 && (source.compare(source.size() - 5, 5, ".task") == 0 || source.compare(source.size() - 5, 5, ".mesh") == 0);
+                std::string command = "glslangValidator -V " + std::string(meshStage ? "--target-env spirv1.4 " : "") + "\"" + std::string(SHADER_SOURCE_DIR) + "/" + source + "\" -o \"" + spirvPath + "\"";
+                std::string output;
+                if (runCommand(command, output) != 0) {
+                    throw std::runtime_error("glslangValidator failed for " + source + ":\n" + output);
+                }
 
-            void *data;
-            vkMapMemory(device, shadowMapUniformBufferMemory, 0, sizeof(ubo), 0, &data);
-                memcpy(data, &ubo, sizeof(ubo));
-            vkUnmapMemory(device, shadowMapUniformBufferMemory);
-        }
+                auto code = readFile(spirvPath);
+                std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+                memcpy(words.data(), code.data(), words.size() * sizeof(uint32_t));
+                result.shaderCode[source + ".spv"] = std::move(words);
+            }
 
-        {
-            static auto startTime = std::chrono::high_resolution_clock::now();
+            auto shaderModule = [this, &result](const std::string &name) {
+                auto compiled = result.shaderCode.find(name);
+                if (compiled != result.shaderCode.end()) {
+                    return createShaderModule(compiled->second.data(), compiled->second.size() * sizeof(uint32_t));
+                }
+                return loadShaderModule(name);
+            };
 
-            auto currentTime = std::chrono::high_resolution_clock::now();
-            float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+            if (sources.count("render.vert") || sources.count("render.frag")) {
+                result.graphicsPipeline = buildGraphicsPipeline(shaderModule("render.vert.spv"), shaderModule("render.frag.spv"));
+            }
+            if (sources.count("shadow.vert") || sources.count("shadow.frag")) {
+                result.shadowMapGraphicsPipeline = buildShadowMapGraphicsPipeline(shaderModule("shadow.vert.spv"), shaderModule("shadow.frag.spv"));
+            }
+            if (options.depthPrepass && sources.count("shadow.vert")) {
+                result.depthPrepassPipeline = buildDepthPrepassPipeline(shaderModule("shadow.vert.spv"));
+            }
+            // The mesh shader path shades with render.frag as well
+            if (meshShaderPipeline != VK_NULL_HANDLE && (sources.count("render.frag") || sources.count("meshlet.task") || sources.count("meshlet.mesh"))) {
+                result.meshShaderPipeline = buildMeshShaderPipeline(shaderModule("meshlet.task.spv"), shaderModule("meshlet.mesh.spv"), shaderModule("render.frag.spv"));
+            }
+            if (options.gpuCulling && sources.count("cull.comp")) {
+                result.cullPipeline = buildComputePipeline(shaderModule("cull.comp.spv"), cullPipelineLayout);
+            }
+            if (options.clusteredLighting && sources.count("cluster.comp")) {
+                result.clusterPipeline = buildComputePipeline(shaderModule("cluster.comp.spv"), clusterPipelineLayout);
+            }
+            if (options.meshlets && sources.count("meshlet_cull.comp")) {
+                result.meshletCullPipeline = buildComputePipeline(shaderModule("meshlet_cull.comp.spv"), meshletCullPipelineLayout);
+            }
+        } catch (const std::runtime_error &e) {
+            destroyReloadedPipelines(result);
+            result.error = e.what();
+        }
+#endif
+        return result;
+    }
 
-            glm::mat4 model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            glm::mat4 view = glm::lookAt(glm::vec3(5.0f, 5.0f, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            glm::mat4 proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 1.0f, 50.0f);
-            proj[1][1] *= -1;
+    // Matches past presentation timings against the acquire time of the same present.
+    // actualPresentTime is in the CLOCK_MONOTONIC domain, which is what steady_clock uses on Linux.
+    void collectPresentationTimings() {
+        uint32_t timingCount = 0;
+        if (vkGetPastPresentationTimingGOOGLE(device, swapChain, &timingCount, nullptr) != VK_SUCCESS || timingCount == 0) {
+            return;
+        }
 
-            UBORenderPass ubo = {};
-            ubo.mvpMat = proj * view * model;
-            ubo.mvMat = view * model;
-            ubo.normMat = glm::transpose(glm::inverse(ubo.mvMat));
-            ubo.lightPos = LIGHT_POS;
-            ubo.mvpMatLightSpace = mvpMatLightSpace;
+        std::vector<VkPastPresentationTimingGOOGLE> timings(timingCount);
+        if (vkGetPastPresentationTimingGOOGLE(device, swapChain, &timingCount, timings.data()) < 0) {
+            return;
+        }
 
-            void* data;
-            vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-                memcpy(data, &ubo, sizeof(ubo));
-            vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+        for (uint32_t i = 0; i < timingCount; i++) {
+            uint64_t &acquireTime = presentAcquireTimes[timings[i].presentID % presentAcquireTimes.size()];
+            if (acquireTime != 0 && timings[i].actualPresentTime > acquireTime) {
+                frameStats.displayLatencies.push_back(static_cast<float>(timings[i].actualPresentTime - acquireTime) * 1.0e-6f);
+            }
+            acquireTime = 0;
         }
     }
 
     void drawFrame() {
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+        PROFILE_SCOPE("drawFrame");
+
+        {
+            PROFILE_SCOPE("wait frame in flight");
+            waitForTimelineValue(frameTimelineValues[currentFrame]);
+        }
+        collectGpuPassTimes();
+        collectPipelineStatistics();
 
         uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        VkResult result;
+        {
+            PROFILE_SCOPE("vkAcquireNextImageKHR");
+            result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        }
+        auto acquireTime = std::chrono::steady_clock::now();
 
         if (result == VK_ERROR_OUT_OF_DATE_KHR) {
             recreateSwapChain();
@@ -1981,26 +8833,75 @@ private:
             throw std::runtime_error("failed to acquire swap chain image!");
         }
 
-        updateUniformBuffer(imageIndex);
+        if (imageTimelineValues[imageIndex] != 0) {
+            PROFILE_SCOPE("wait image in flight");
+            waitForTimelineValue(imageTimelineValues[imageIndex]);
+
+            // The previous culling results for this image are complete now
+            if (options.gpuCulling) {
+                collectCullStats(imageIndex);
+            }
+            if (options.meshlets) {
+                collectMeshletStats(imageIndex);
+            }
+        }
+
+        collectDeferredReleases(completedTimelineValue());
+
+        if (shaderWatcher) {
+            updateShaderReload();
+        }
+
+        updateTextureStreaming();
+        {
+            PROFILE_SCOPE("updateUniformBuffer");
+            updateUniformBuffer(imageIndex);
+        }
+        {
+            PROFILE_SCOPE("recordFrameCommands");
+            recordFrameCommands(imageIndex);
+        }
+
+        const uint64_t previousFrameTimelineValue = timelineValue;
+        const uint64_t shadowMapTimelineValue = ++timelineValue;
+        const uint64_t frameTimelineValue = ++timelineValue;
 
         // Shadow map pass
         {
             VkSubmitInfo submitInfo = {};
             submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-            VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-            VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-            submitInfo.waitSemaphoreCount = 1;
+            // The shadow map is shared by all frames in flight, so it must not be overwritten
+            // before the previous frame has finished sampling it.
+            // The wait value of the binary acquire semaphore is ignored.
+            VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame], timelineSemaphore};
+            VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+            submitInfo.waitSemaphoreCount = 2;
             submitInfo.pWaitSemaphores = waitSemaphores;
             submitInfo.pWaitDstStageMask = waitStages;
 
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &shadowMapCommandBuffer;
+            uint64_t waitValues[] = {0, previousFrameTimelineValue};
+            VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            timelineInfo.waitSemaphoreValueCount = 2;
+            timelineInfo.pWaitSemaphoreValues = waitValues;
+            timelineInfo.signalSemaphoreValueCount = 1;
+            timelineInfo.pSignalSemaphoreValues = &shadowMapTimelineValue;
+            submitInfo.pNext = &timelineInfo;
+
+            std::vector<VkCommandBuffer> submitCommandBuffers;
+            if (options.gpuCulling) {
+                submitCommandBuffers.push_back(frameCommands[currentFrame].cullCommandBuffer);
+            }
+            submitCommandBuffers.push_back(frameCommands[currentFrame].shadowMapCommandBuffer);
+
+            submitInfo.commandBufferCount = static_cast<uint32_t>(submitCommandBuffers.size());
+            submitInfo.pCommandBuffers = submitCommandBuffers.data();
 
-            VkSemaphore signalSemaphores[] = {shadowMapFinishedSemaphore};
             submitInfo.signalSemaphoreCount = 1;
-            submitInfo.pSignalSemaphores = signalSemaphores;
+            submitInfo.pSignalSemaphores = &timelineSemaphore;
 
+            PROFILE_SCOPE("vkQueueSubmit shadow");
             if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, nullptr) != VK_SUCCESS) {
                 throw std::runtime_error("failed to submit shadow map draw command buffer");
             }
@@ -2011,30 +8912,44 @@ private:
             VkSubmitInfo submitInfo = {};
             submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-            VkSemaphore waitSemaphores[] = {shadowMapFinishedSemaphore};
-            VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+            // The shadow map is sampled in the fragment shader
+            VkSemaphore waitSemaphores[] = {timelineSemaphore};
+            VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT};
             submitInfo.waitSemaphoreCount = 1;
             submitInfo.pWaitSemaphores = waitSemaphores;
             submitInfo.pWaitDstStageMask = waitStages;
 
             submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+            submitInfo.pCommandBuffers = &frameCommands[currentFrame].commandBuffer;
 
-            VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-            submitInfo.signalSemaphoreCount = 1;
+            VkSemaphore signalSemaphores[] = {timelineSemaphore, renderFinishedSemaphores[currentFrame]};
+            submitInfo.signalSemaphoreCount = 2;
             submitInfo.pSignalSemaphores = signalSemaphores;
 
-            vkResetFences(device, 1, &inFlightFences[currentFrame]);
-
-            if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to submit draw command buffer!");
+            uint64_t signalValues[] = {frameTimelineValue, 0};
+            VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            timelineInfo.waitSemaphoreValueCount = 1;
+            timelineInfo.pWaitSemaphoreValues = &shadowMapTimelineValue;
+            timelineInfo.signalSemaphoreValueCount = 2;
+            timelineInfo.pSignalSemaphoreValues = signalValues;
+            submitInfo.pNext = &timelineInfo;
+
+            {
+                PROFILE_SCOPE("vkQueueSubmit main");
+                if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to submit draw command buffer!");
+                }
             }
 
+            frameTimelineValues[currentFrame] = frameTimelineValue;
+            imageTimelineValues[imageIndex] = frameTimelineValue;
+
             VkPresentInfoKHR presentInfo = {};
             presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
             presentInfo.waitSemaphoreCount = 1;
-            presentInfo.pWaitSemaphores = signalSemaphores;
+            presentInfo.pWaitSemaphores = &renderFinishedSemaphores[currentFrame];
 
             VkSwapchainKHR swapChains[] = {swapChain};
             presentInfo.swapchainCount = 1;
@@ -2042,7 +8957,33 @@ private:
 
             presentInfo.pImageIndices = &imageIndex;
 
-            result = vkQueuePresentKHR(presentQueue, &presentInfo);
+            VkPresentTimeGOOGLE presentTime = {};
+            VkPresentTimesInfoGOOGLE presentTimesInfo = {};
+            if (displayTimingEnabled) {
+                presentTime.presentID = nextPresentId++;
+                presentTime.desiredPresentTime = 0;
+                presentAcquireTimes[presentTime.presentID % presentAcquireTimes.size()] = std::chrono::duration_cast<std::chrono::nanoseconds>(acquireTime.time_since_epoch()).count();
+
+                presentTimesInfo.sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE;
+                presentTimesInfo.swapchainCount = 1;
+                presentTimesInfo.pTimes = &presentTime;
+                presentInfo.pNext = &presentTimesInfo;
+            }
+
+            {
+                PROFILE_SCOPE("vkQueuePresentKHR");
+                result = vkQueuePresentKHR(presentQueue, &presentInfo);
+            }
+
+            frameStats.presentLatencies.push_back(std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - acquireTime).count());
+            if (displayTimingEnabled && result == VK_SUCCESS) {
+                collectPresentationTimings();
+            }
+
+            if (!firstFrameReported) {
+                reportStartupTime("time to first frame");
+                firstFrameReported = true;
+            }
 
             if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
                 framebufferResized = false;
@@ -2052,14 +8993,62 @@ private:
             }
         }
 
-        currentFrame = (currentFrame + 1) & MAX_FRAMES_IN_FLIGHT;
+        updateFrameStats();
+
+        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    }
+
+    VkShaderModule loadShaderModule(const std::string &name) {
+        std::vector<char> storage;
+        size_t size;
+        const uint32_t *code = findShaderCode(name, size, storage);
+        return createShaderModule(code, size);
+    }
+
+    // Embedded SPIR-V is used in place. With --shader-dev, or in builds without
+    // EMBED_SHADERS, the shader is read from ../shaders/ into storage instead.
+    const uint32_t *findShaderCode(const std::string &name, size_t &size, std::vector<char> &storage) {
+        auto override = shaderOverrides.find(name);
+        if (override != shaderOverrides.end()) {
+            size = override->second.size() * sizeof(uint32_t);
+            return override->second.data();
+        }
+
+#ifdef EMBED_SHADERS
+        if (!options.shaderDevMode) {
+            for (const auto &shader : EMBEDDED_SHADERS) {
+                if (name == shader.name) {
+                    size = shader.size;
+                    return shader.code;
+                }
+            }
+        }
+#endif
+        storage = readFile("../shaders/" + name);
+        size = storage.size();
+        return reinterpret_cast<const uint32_t*>(storage.data());
+    }
+
+    static VkShaderStageFlags shaderStageFromName(const std::string &name) {
+        if (name.find(".vert") != std::string::npos) {
+            return VK_SHADER_STAGE_VERTEX_BIT;
+        } else if (name.find(".frag") != std::string::npos) {
+            return VK_SHADER_STAGE_FRAGMENT_BIT;
+        } else if (name.find(".comp") != std::string::npos) {
+            return VK_SHADER_STAGE_COMPUTE_BIT;
+        } else if (name.find(".task") != std::string::npos) {
+            return VK_SHADER_STAGE_TASK_BIT_EXT;
+        } else if (name.find(".mesh") != std::string::npos) {
+            return VK_SHADER_STAGE_MESH_BIT_EXT;
+        }
+        throw std::runtime_error("unknown shader stage: " + name);
     }
 
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
+    VkShaderModule createShaderModule(const uint32_t *code, size_t size) {
         VkShaderModuleCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = code.size();
-        createInfo.pCode = (uint32_t*) code.data();
+        createInfo.codeSize = size;
+        createInfo.pCode = code;
 
         VkShaderModule shaderModule;
         if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
@@ -2080,6 +9069,16 @@ private:
     }
 
     VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes) {
+        if (options.presentMode.has_value()) {
+            if (std::find(availablePresentModes.begin(), availablePresentModes.end(), options.presentMode.value()) != availablePresentModes.end()) {
+                return options.presentMode.value();
+            }
+
+            // FIFO is the only mode every implementation has to support
+            std::cerr << "present mode " << presentModeName(options.presentMode.value()) << " is not supported, using fifo" << std::endl;
+            return VK_PRESENT_MODE_FIFO_KHR;
+        }
+
         for (const auto& availablePresentMode : availablePresentModes) {
             if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
                 return availablePresentMode;
@@ -2145,7 +9144,114 @@ private:
         VkPhysicalDeviceFeatures supportedFeatures;
         vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-        return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+        bool gpuCullingSupported = !options.gpuCulling || (checkIndirectCountSupport(device) && checkGpuCullingSupport(device));
+        bool cpuCullingSupported = !options.cpuCulling || checkIndirectCountSupport(device);
+        bool cubeShadowsSupported = !options.cubeShadows || (supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance);
+        bool meshletsSupported = !options.meshlets || checkIndirectCountSupport(device);
+
+        return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy && checkTimelineSemaphoreSupport(device) && gpuCullingSupported && cpuCullingSupported && cubeShadowsSupported && meshletsSupported;
+    }
+
+    bool checkTimelineSemaphoreSupport(VkPhysicalDevice device) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+
+        if (properties.apiVersion < VK_API_VERSION_1_2) {
+            return false;
+        }
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+        VkPhysicalDeviceFeatures2 features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &vulkan12Features;
+        vkGetPhysicalDeviceFeatures2(device, &features);
+
+        return vulkan12Features.timelineSemaphore;
+    }
+
+    bool checkGpuCullingSupport(VkPhysicalDevice device) {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+        QueueFamilyIndices indices = findQueueFamilies(device);
+        return indices.graphicsFamily.has_value() && (queueFamilies[indices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT);
+    }
+
+    bool checkIndirectCountSupport(VkPhysicalDevice device) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+
+        if (properties.apiVersion < VK_API_VERSION_1_2) {
+            return false;
+        }
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+        VkPhysicalDeviceFeatures2 features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &vulkan12Features;
+        vkGetPhysicalDeviceFeatures2(device, &features);
+
+        return vulkan12Features.drawIndirectCount && features.features.multiDrawIndirect && features.features.drawIndirectFirstInstance;
+    }
+
+    // The task shader culls the meshlets, so both stages are required
+    bool checkMeshShaderSupport(VkPhysicalDevice device) {
+        if (!checkDeviceExtensionSupport(device, VK_EXT_MESH_SHADER_EXTENSION_NAME)) {
+            return false;
+        }
+
+        VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures = {};
+        meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+
+        VkPhysicalDeviceFeatures2 features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &meshShaderFeatures;
+        vkGetPhysicalDeviceFeatures2(device, &features);
+
+        return meshShaderFeatures.taskShader && meshShaderFeatures.meshShader;
+    }
+
+    // Requires the device and CLOCK_MONOTONIC time domains; the latter is what steady_clock uses on Linux
+    bool checkCalibratedTimestampSupport(VkPhysicalDevice device) {
+        if (!checkDeviceExtensionSupport(device, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)) {
+            return false;
+        }
+
+        auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+        if (getTimeDomains == nullptr) {
+            return false;
+        }
+
+        uint32_t timeDomainCount = 0;
+        getTimeDomains(device, &timeDomainCount, nullptr);
+        std::vector<VkTimeDomainEXT> timeDomains(timeDomainCount);
+        getTimeDomains(device, &timeDomainCount, timeDomains.data());
+
+        bool deviceDomain = std::find(timeDomains.begin(), timeDomains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != timeDomains.end();
+        bool monotonicDomain = std::find(timeDomains.begin(), timeDomains.end(), VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) != timeDomains.end();
+        return deviceDomain && monotonicDomain;
+    }
+
+    bool checkDeviceExtensionSupport(VkPhysicalDevice device, const char *extensionName) {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& extension : availableExtensions) {
+            if (strcmp(extension.extensionName, extensionName) == 0) {
+                return true;
+            }
+        }
+        return false;
     }
 
     bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
@@ -2260,10 +9366,15 @@ private:
     }
 };
 
-int main() {
-    HelloTriangleApplication app;
-
+int main(int argc, char **argv) {
     try {
+        AppOptions options = AppOptions::parse(argc, argv);
+        if (options.benchmarkCpuCulling) {
+            runCpuCullingBenchmark();
+            return EXIT_SUCCESS;
+        }
+
+        HelloTriangleApplication app(options);
         app.run();
     } catch (const std::runtime_error& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 faceMats[6];
+    vec4 lightPosRange;
+} ubo;
+
+layout(location = 0) in vec3 f_posWorldSpace;
+
+layout(location = 0) out vec4 out_color;
+
+// Moments of the distance to the light relative to its range, which unlike the depth of one
+// face can be compared in any direction
+void main(void) {
+    float depth = length(f_posWorldSpace - ubo.lightPosRange.xyz) / ubo.lightPosRange.w;
+    float dzdx = dFdx(depth);
+    float dzdy = dFdy(depth);
+    float momentum = depth * depth + 0.25 * (dzdx * dzdx + dzdy * dzdy);
+    out_color = vec4(depth, momentum, 0.0, 1.0);
+}
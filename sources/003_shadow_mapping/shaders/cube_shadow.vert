@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_multiview : require
+
+// Multiview: every draw is broadcast to the six faces, gl_ViewIndex selects the face
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 faceMats[6];
+    vec4 lightPosRange;
+} ubo;
+
+struct InstanceData {
+    mat4 modelMat;
+    mat4 normMat;
+    uint materialIndex;
+    uint flags;
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(location = 0) in vec3 in_pos;
+
+layout(location = 0) out vec3 f_posWorldSpace;
+
+void main() {
+    vec4 pos = instances[gl_InstanceIndex].modelMat * vec4(in_pos, 1.0);
+    gl_Position = ubo.faceMats[gl_ViewIndex] * pos;
+    f_posWorldSpace = pos.xyz;
+}
@@ -0,0 +1,33 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// One render pass per face, which is pushed before its draws
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 faceMats[6];
+    vec4 lightPosRange;
+} ubo;
+
+struct InstanceData {
+    mat4 modelMat;
+    mat4 normMat;
+    uint materialIndex;
+    uint flags;
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(push_constant) uniform FaceConstants {
+    uint face;
+} faceConstants;
+
+layout(location = 0) in vec3 in_pos;
+
+layout(location = 0) out vec3 f_posWorldSpace;
+
+void main() {
+    vec4 pos = instances[gl_InstanceIndex].modelMat * vec4(in_pos, 1.0);
+    gl_Position = ubo.faceMats[faceConstants.face] * pos;
+    f_posWorldSpace = pos.xyz;
+}
@@ -0,0 +1,33 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shader_viewport_layer_array : require
+
+// Layered rendering: every object is instanced once per face it touches, with the instance
+// index object * 6 + face, and the vertex shader routes it to that face's layer
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 faceMats[6];
+    vec4 lightPosRange;
+} ubo;
+
+struct InstanceData {
+    mat4 modelMat;
+    mat4 normMat;
+    uint materialIndex;
+    uint flags;
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(location = 0) in vec3 in_pos;
+
+layout(location = 0) out vec3 f_posWorldSpace;
+
+void main() {
+    int face = gl_InstanceIndex % 6;
+    vec4 pos = instances[gl_InstanceIndex / 6].modelMat * vec4(in_pos, 1.0);
+    gl_Position = ubo.faceMats[face] * pos;
+    gl_Layer = face;
+    f_posWorldSpace = pos.xyz;
+}
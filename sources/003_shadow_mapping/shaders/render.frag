@@ -8,12 +8,79 @@ layout(location = 1) in vec3 f_normCameraSpace;
 layout(location = 2) in vec3 f_lightPosCameraSpace;
 layout(location = 3) in vec2 f_uv;
 layout(location = 4) in vec4 f_posScreenLightSpace;
+layout(location = 5) flat in uint f_materialIndex;
+layout(location = 6) in vec3 f_posWorldSpace;
 
 layout(location = 0) out vec4 out_color;
 
 layout(binding = 1) uniform sampler2D u_imageTex;
 layout(binding = 2) uniform sampler2D u_depthTex;
 
+// With --point-lights the point lights binned by cluster.comp are added to the shadowed light
+layout(constant_id = 1) const bool USE_CLUSTERED_LIGHTS = false;
+
+layout(binding = 4) uniform ClusterUniformBuffer {
+    mat4 invProjMat;
+    uvec4 gridSize;      // x, y, z and the light capacity of a cluster
+    vec4 screen;         // tile size (xy) and render extent (zw) in pixels
+    vec4 depthSlicing;   // near, far, slice scale and slice bias
+    uint lightCount;
+} clusters;
+
+struct PointLight {
+    vec4 posRadius;
+    vec4 color;
+};
+
+layout(std430, binding = 5) readonly buffer PointLightBuffer {
+    PointLight pointLights[];
+};
+
+layout(std430, binding = 6) readonly buffer ClusterLightBuffer {
+    uint clusterLights[];
+};
+
+// Light 0 is the key light of ubo.mvpMatLightSpace, the others are spot lights. Every light
+// has its own tile of the shadow atlas in u_depthTex; atlasRect is its offset and size in UV.
+struct ShadowLight {
+    mat4 mvpMat;
+    vec4 atlasRect;
+    vec4 posCameraSpace;
+    vec4 posWorldSpace;  // w: range of the cube shadow map, if any
+    vec4 color;
+};
+
+layout(std430, binding = 7) readonly buffer ShadowLightBuffer {
+    uint shadowLightCount;
+    ShadowLight shadowLights[];
+};
+
+// With --cube-shadows the key light is shadowed in every direction by u_cubeShadowTex
+// instead of its atlas tile
+layout(constant_id = 2) const bool USE_CUBE_SHADOW = false;
+
+layout(binding = 8) uniform samplerCube u_cubeShadowTex;
+
+// Material 0 is the textured floor, the others are gold, silver, copper and jade
+const vec3 materialDiffuse[4] = vec3[4](
+    vec3(0.75164, 0.60648, 0.22648),
+    vec3(0.50754, 0.50754, 0.50754),
+    vec3(0.7038, 0.27048, 0.0828),
+    vec3(0.54, 0.89, 0.63)
+);
+const vec3 materialSpecular[4] = vec3[4](
+    vec3(0.628281, 0.555802, 0.366065),
+    vec3(0.508273, 0.508273, 0.508273),
+    vec3(0.256777, 0.137622, 0.086014),
+    vec3(0.316228, 0.316228, 0.316228)
+);
+const vec3 materialAmbient[4] = vec3[4](
+    vec3(0.24725, 0.1995, 0.0745),
+    vec3(0.19225, 0.19225, 0.19225),
+    vec3(0.19125, 0.0735, 0.0225),
+    vec3(0.135, 0.2225, 0.1575)
+);
+
 const int nPCFSamples = 32;
 vec3 samples[] = vec3[64](
     vec3(-0.015809, -0.008987, 0.175437),
@@ -82,47 +149,141 @@ vec3 samples[] = vec3[64](
     vec3(-0.003478, 0.008937, 0.766257)
 );
 
-void main() {
-    vec3 V = normalize(-f_posCameraSpace);
-    vec3 N = normalize(f_normCameraSpace);
-    vec3 L = normalize(f_lightPosCameraSpace - f_posCameraSpace);
-    vec3 H = normalize(V + L);
-    float NdotL = max(0.0, dot(N, L));
-    float NdotH = max(0.0, dot(N, H));
+float momentVisibility(vec2 moment, float zValue, float bias) {
+    if (zValue <= moment.x + bias) {
+        return 1.0;
+    }
+    float variance = moment.y - moment.x * moment.x;
+    float gap = abs(zValue - moment.x);
+    return clamp(1.0 - 0.5 * variance / (variance + gap * gap), 0.0, 1.0);
+}
 
-    float zValue = f_posScreenLightSpace.z / f_posScreenLightSpace.w;
-    vec2 uv = f_posScreenLightSpace.xy / f_posScreenLightSpace.w * 0.5 + 0.5;
+// Lights that did not get a tile in the atlas are not shadowed
+float shadowVisibility(vec4 posScreenLightSpace, vec4 atlasRect, float NdotL) {
+    if (atlasRect.z <= 0.0) {
+        return 1.0;
+    }
+
+    float zValue = posScreenLightSpace.z / posScreenLightSpace.w;
+    vec2 uv = atlasRect.xy + (posScreenLightSpace.xy / posScreenLightSpace.w * 0.5 + 0.5) * atlasRect.zw;
+
+    // The filter must not reach into the neighbouring tiles
+    vec2 halfTexel = 0.5 / vec2(textureSize(u_depthTex, 0));
+    vec2 uvMin = atlasRect.xy + halfTexel;
+    vec2 uvMax = atlasRect.xy + atlasRect.zw - halfTexel;
 
     float visibility = 0.0;
     float bias = 0.005 * tan(acos(NdotL));
     bias = clamp(bias, 0.0, 1.0e-5);
 
     for (int i = 0; i < nPCFSamples; i++) {
-        vec2 jitter = samples[i].xy * 0.002;
-        vec2 moment = texture(u_depthTex, uv + jitter).xy;
-        if (zValue <= moment.x + bias) {
-            visibility += 1.0;
-        } else {
-            float variance = moment.y - moment.x * moment.x;
-            float gap = abs(zValue - moment.x);
-            visibility += clamp(1.0 - 0.5 * variance / (variance + gap * gap), 0.0, 1.0);
+        vec2 jitter = samples[i].xy * 0.002 * atlasRect.zw;
+        vec2 moment = texture(u_depthTex, clamp(uv + jitter, uvMin, uvMax)).xy;
+        visibility += momentVisibility(moment, zValue, bias);
+    }
+    return visibility / float(nPCFSamples);
+}
+
+// The cube map stores the distance to the light divided by its range. The filter jitters
+// the lookup direction by about as much as shadowVisibility() jitters within a tile.
+float cubeShadowVisibility(vec4 lightPosRange, float NdotL) {
+    vec3 toFragment = f_posWorldSpace - lightPosRange.xyz;
+    float zValue = length(toFragment) / lightPosRange.w;
+
+    float visibility = 0.0;
+    float bias = 0.005 * tan(acos(NdotL));
+    bias = clamp(bias, 0.0, 1.0e-5);
+
+    for (int i = 0; i < nPCFSamples; i++) {
+        vec3 jitter = vec3(samples[i].xy, samples[i].z - 0.5) * 0.004 * length(toFragment);
+        vec2 moment = texture(u_cubeShadowTex, toFragment + jitter).xy;
+        visibility += momentVisibility(moment, zValue, bias);
+    }
+    return visibility / float(nPCFSamples);
+}
+
+// The cone of a spot light is the circle inscribed into its frustum
+vec3 shadeSpotLights(vec3 N, vec3 V, vec3 rhoDiff, vec3 rhoSpec) {
+    vec3 rgb = vec3(0.0);
+    for (uint k = 1u; k < shadowLightCount; k++) {
+        vec4 posScreenLightSpace = shadowLights[k].mvpMat * vec4(f_posWorldSpace, 1.0);
+        if (posScreenLightSpace.w <= 0.0) {
+            continue;
+        }
+
+        float cone = smoothstep(1.0, 0.8, length(posScreenLightSpace.xy / posScreenLightSpace.w));
+        if (cone <= 0.0) {
+            continue;
         }
+
+        vec3 L = normalize(shadowLights[k].posCameraSpace.xyz - f_posCameraSpace);
+        vec3 H = normalize(V + L);
+        float NdotL = max(0.0, dot(N, L));
+        float visibility = shadowVisibility(posScreenLightSpace, shadowLights[k].atlasRect, NdotL);
+        rgb += shadowLights[k].color.rgb * cone * visibility * (rhoDiff * NdotL + rhoSpec * pow(max(0.0, dot(N, H)), 64.0));
+    }
+    return rgb;
+}
+
+// Loops over the lights of the fragment's cluster only
+vec3 shadePointLights(vec3 N, vec3 V, vec3 rhoDiff, vec3 rhoSpec) {
+    uvec4 grid = clusters.gridSize;
+    float viewDepth = -f_posCameraSpace.z;
+
+    uvec3 cluster;
+    cluster.xy = min(uvec2(gl_FragCoord.xy / clusters.screen.xy), grid.xy - 1u);
+    cluster.z = uint(clamp(log(viewDepth) * clusters.depthSlicing.z + clusters.depthSlicing.w, 0.0, float(grid.z - 1u)));
+    uint offset = ((cluster.z * grid.y + cluster.y) * grid.x + cluster.x) * (grid.w + 1u);
+
+    vec3 rgb = vec3(0.0);
+    uint count = clusterLights[offset];
+    for (uint i = 0u; i < count; i++) {
+        PointLight light = pointLights[clusterLights[offset + 1u + i]];
+        vec3 toLight = light.posRadius.xyz - f_posCameraSpace;
+        float dist = max(length(toLight), 1.0e-4);
+        vec3 L = toLight / dist;
+        vec3 H = normalize(V + L);
+
+        // Inverse-square falloff, windowed to reach zero at the light radius
+        float window = clamp(1.0 - pow(dist / light.posRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (dist * dist + 1.0);
+        rgb += light.color.rgb * attenuation * (rhoDiff * max(0.0, dot(N, L)) + rhoSpec * pow(max(0.0, dot(N, H)), 64.0));
     }
-    visibility /= float(nPCFSamples);
+    return rgb;
+}
+
+void main() {
+    vec3 V = normalize(-f_posCameraSpace);
+    vec3 N = normalize(f_normCameraSpace);
+    vec3 L = normalize(f_lightPosCameraSpace - f_posCameraSpace);
+    vec3 H = normalize(V + L);
+    float NdotL = max(0.0, dot(N, L));
+    float NdotH = max(0.0, dot(N, H));
+
+    float visibility = USE_CUBE_SHADOW
+        ? cubeShadowVisibility(shadowLights[0].posWorldSpace, NdotL)
+        : shadowVisibility(f_posScreenLightSpace, shadowLights[0].atlasRect, NdotL);
 
-    vec3 rhoDiff = vec3(0.75164, 0.60648, 0.22648);
-    vec3 rhoSpec = vec3(0.628281, 0.555802, 0.366065);
-    vec3 rhoAmbi = vec3(0.24725, 0.1995, 0.0745);
-    if (length(f_uv) != 0.0) {
+    vec3 rhoDiff = vec3(0.0);
+    vec3 rhoSpec = vec3(0.0);
+    vec3 rhoAmbi = vec3(0.0);
+    if (f_materialIndex == 0u) {
         rhoDiff = texture(u_imageTex, f_uv).rgb;
-        rhoSpec = vec3(0.0);
-        rhoAmbi = vec3(0.0);
+    } else {
+        uint m = (f_materialIndex - 1u) % 4u;
+        rhoDiff = materialDiffuse[m];
+        rhoSpec = materialSpecular[m];
+        rhoAmbi = materialAmbient[m];
     }
 
     vec3 diffuse = rhoDiff * NdotL;
     vec3 specular = rhoSpec * pow(NdotH, 64.0);
     vec3 ambient = rhoAmbi;
     vec3 rgb = visibility * (diffuse + specular + ambient);
+    rgb += shadeSpotLights(N, V, rhoDiff, rhoSpec);
+    if (USE_CLUSTERED_LIGHTS) {
+        rgb += shadePointLights(N, V, rhoDiff, rhoSpec);
+    }
     out_color = vec4(rgb, 1.0);
 }
   
\ No newline at end of file
@@ -9,6 +9,26 @@ layout(binding = 0) uniform UniformBufferObject {
 	vec3 lightPos;
 } ubo;
 
+struct InstanceData {
+    mat4 modelMat;
+    mat4 normMat;
+    uint materialIndex;
+    uint flags;
+};
+
+layout(std430, binding = 3) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+// With --push-constants every object is drawn on its own and its data is pushed per draw
+layout(constant_id = 0) const bool USE_PUSH_CONSTANTS = false;
+
+layout(push_constant) uniform DrawConstants {
+    mat4 modelMat;
+    mat3 normMat;
+    uint materialIndex;
+} draw;
+
 layout(location = 0) in vec3 in_pos;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_uv;
@@ -18,12 +38,34 @@ layout(location = 1) out vec3 f_normCameraSpace;
 layout(location = 2) out vec3 f_lightPosCameraSpace;
 layout(location = 3) out vec2 f_uv;
 layout(location = 4) out vec4 f_posScreenLightSpace;
+layout(location = 5) flat out uint f_materialIndex;
+layout(location = 6) out vec3 f_posWorldSpace;
+
+// Must match the depth pre-pass written by shadow.vert for the EQUAL depth test
+invariant gl_Position;
 
 void main() {
-    gl_Position = ubo.mvpMat * vec4(in_pos, 1.0);
-	f_posCameraSpace = (ubo.mvMat * vec4(in_pos, 1.0)).xyz;
-	f_normCameraSpace = (ubo.normMat * vec4(in_normal, 0.0)).xyz;
+    mat4 modelMat;
+    mat4 normMat;
+    uint materialIndex;
+    if (USE_PUSH_CONSTANTS) {
+        modelMat = draw.modelMat;
+        normMat = mat4(draw.normMat);
+        materialIndex = draw.materialIndex;
+    } else {
+        InstanceData instance = instances[gl_InstanceIndex];
+        modelMat = instance.modelMat;
+        normMat = instance.normMat;
+        materialIndex = instance.materialIndex;
+    }
+    vec4 pos = modelMat * vec4(in_pos, 1.0);
+
+    gl_Position = ubo.mvpMat * pos;
+	f_posCameraSpace = (ubo.mvMat * pos).xyz;
+	f_normCameraSpace = (ubo.normMat * normMat * vec4(in_normal, 0.0)).xyz;
 	f_lightPosCameraSpace = (ubo.mvMat * vec4(ubo.lightPos, 1.0)).xyz;
 	f_uv = in_uv;
-	f_posScreenLightSpace = ubo.mvpMatLightSpace * vec4(in_pos, 1.0);
+	f_posScreenLightSpace = ubo.mvpMatLightSpace * pos;
+	f_materialIndex = materialIndex;
+	f_posWorldSpace = pos.xyz;
 }
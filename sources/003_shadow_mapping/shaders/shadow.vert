@@ -5,13 +5,35 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 mvpMat;
 } ubo;
 
+struct InstanceData {
+    mat4 modelMat;
+    mat4 normMat;
+    uint materialIndex;
+    uint flags;
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(constant_id = 0) const bool USE_PUSH_CONSTANTS = false;
+
+// Only the model matrix of the per-draw data pushed for render.vert is needed here
+layout(push_constant) uniform DrawConstants {
+    mat4 modelMat;
+} draw;
+
 layout(location = 0) in vec3 in_pos;
 layout(location = 1) in vec3 in_normal;
 layout(location = 2) in vec2 in_uv;
 
 layout(location = 0) out vec4 f_posScreenSpace;
 
+// Also used for the depth pre-pass, whose depth render.vert has to reproduce exactly
+invariant gl_Position;
+
 void main() {
-    gl_Position = ubo.mvpMat * vec4(in_pos, 1.0);
+    mat4 modelMat = USE_PUSH_CONSTANTS ? draw.modelMat : instances[gl_InstanceIndex].modelMat;
+    gl_Position = ubo.mvpMat * (modelMat * vec4(in_pos, 1.0));
     f_posScreenSpace = gl_Position;
 }
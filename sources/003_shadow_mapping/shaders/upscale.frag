@@ -0,0 +1,20 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform sampler2D sceneColor;
+
+// The scene only covers the top-left uvScale of sceneColor
+layout(push_constant) uniform UpscaleParams {
+    vec2 uvScale;
+    vec2 uvMax;
+} params;
+
+layout(location = 0) in vec2 f_texCoord;
+
+layout(location = 0) out vec4 out_color;
+
+void main(void) {
+    // Clamped half a texel inside the rendered region, so bilinear filtering never reads past it
+    vec2 uv = min(f_texCoord * params.uvScale, params.uvMax);
+    out_color = texture(sceneColor, uv);
+}
@@ -0,0 +1,10 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) out vec2 f_texCoord;
+
+// A single triangle that covers the whole screen, generated from the vertex index
+void main(void) {
+    f_texCoord = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(f_texCoord * 2.0 - 1.0, 0.0, 1.0);
+}